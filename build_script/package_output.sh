@@ -2,7 +2,23 @@ package_output() {
     echo "打包..."
     
     cd $BUILD_PROG_WORKING_DIR/output
-    zip -r base.zip *
+    zip -r base.zip * -x base.zip components.conf
+
+    echo "生成组件清单..."
+    # 安装器按清单安装，大小用于确认界面显示（字节）
+    # 直接取安装包里解压后的总大小，与实际打进包的文件一致（* 不含顶层的隐藏文件）
+    local install_size=$(unzip -Zt base.zip | awk '{ print $3 }')
+    cat > components.conf <<EOF
+# 组件清单，安装包路径相对于本文件所在目录
+[BASE]
+prompt = Base System
+type = bool
+default = y
+archive = base.zip
+download_size = $(stat -c %s base.zip)
+install_size = ${install_size}
+help = Core runtime, shell and package manager
+EOF
     
     echo "运行事务后清理..."
     cd $BUILD_PROG_WORKING_DIR
@@ -15,8 +15,10 @@ configure_libandroid-selinux() {
     
     cp -f "$builder_files_path/Makefile-android" "$BUILD_PROG_WORKING_DIR/selinux/libselinux"
     cp -f "$builder_files_path/termux_build.h" "$BUILD_PROG_WORKING_DIR/selinux/libselinux/include"
+    cp -f "$builder_files_path/label_file_cache.c" "$BUILD_PROG_WORKING_DIR/selinux/libselinux/src"
+    cp -f "$builder_files_path/selinux-compile-contexts" "$BUILD_PROG_WORKING_DIR/selinux/libselinux"
     
-    echo "coped 2 files!"
+    echo "coped 4 files!"
 }
 
 apply_patches_libandroid-selinux() {
@@ -35,7 +37,11 @@ build_libandroid-selinux() {
     local local_saved_arch="$TARGET_ARCH"
     unset TARGET_ARCH
     
-    make -C libselinux -f Makefile-android
+    # 编进库里的缓存路径要用设备上的安装目录，文件装进 output
+    local runtime_prefix=/data/data/com.manager.ssb/files
+    make -C libselinux -f Makefile-android RUNTIME_PREFIX=$runtime_prefix
+    make -C libselinux -f Makefile-android install \
+        PREFIX=$BUILD_PROG_WORKING_DIR/output RUNTIME_PREFIX=$runtime_prefix
     
     export TARGET_ARCH="$local_saved_arch"  # 恢复原值    
     # echo "clean up..."
@@ -38,12 +38,12 @@ configure_glibc() {
     echo "x86_64 configure files removed."
     
     echo "Installing custom system call implementations..."
-    cp -v $BUILD_PROG_WORKING_DIR/builderfiles/glibc/{shm{at,ctl,dt,get}.c,mprotect.c,syscall.c,fakesyscall*.h,fake_epoll_pwait2.c,setfs{u,g}id.c} \
+    cp -v $BUILD_PROG_WORKING_DIR/builderfiles/glibc/{shm{at,ctl,dt,get,_open,_unlink}.c,mprotect.c,syscall.c,fakesyscall*.h,fake_epoll_pwait2.c,fake_statx.c,syscall-probe.c,syscall-stats.{c,h},setfs{u,g}id.c} \
         sysdeps/unix/sysv/linux/
     echo "System call files installed."
     
     echo "Installing Android-compatible user/group parsing scripts..."
-    cp -v $BUILD_PROG_WORKING_DIR/builderfiles/glibc/{android_passwd_group.*,android_system_user_ids.h} \
+    cp -v $BUILD_PROG_WORKING_DIR/builderfiles/glibc/{android_passwd_group.*,android_ids_cache.h,android_system_user_ids.h} \
         nss/
     echo "Android user/group files installed."
     
@@ -53,8 +53,8 @@ configure_glibc() {
         $BUILD_PROG_WORKING_DIR/builderfiles/glibc/android_system_user_ids.h
     echo "Android IDs generation completed."
     
-    echo "Installing Android-compatible syslog implementation..."
-    cp -v $BUILD_PROG_WORKING_DIR/builderfiles/glibc/syslog.c misc/
+    echo "Installing Android-compatible syslog and code memory implementation..."
+    cp -v $BUILD_PROG_WORKING_DIR/builderfiles/glibc/{syslog.c,syslog-ring.h,mmap_code.c} misc/
     echo "Syslog installed."
     
     echo "Installing System V shared memory emulation for Android..."
@@ -71,42 +71,12 @@ configure_glibc() {
             sysdeps/unix/sysv/linux/${i///*/}/syscallS.S
         echo "File rename completed for ${i}."
         
-        echo "Processing syscall replacements for ${i}..."
-        local header_disabled_syscall="$BUILD_PROG_WORKING_DIR/glibc-glibc-${PKG_VERSIONS[glibc]}/sysdeps/unix/sysv/linux/${i}/disabled-syscall.h"
-        
-        echo "Removing disabled syscalls from arch-syscall.h..."
-        {
-            for j in $(jq -r '.[] | .[]' $BUILD_PROG_WORKING_DIR/builderfiles/glibc/fakesyscall.json); do
-                echo "Processing syscall: $j"
-                grep "#define __NR_${j} " sysdeps/unix/sysv/linux/${i}/arch-syscall.h || echo "Syscall $j not found in arch-syscall.h"
-                sed -i "/#define __NR_${j} /d" sysdeps/unix/sysv/linux/${i}/arch-syscall.h
-            done
-        } >> $header_disabled_syscall
-        echo "Syscall removal completed for ${i}."
-        
-        echo "Generating fake syscall mappings for ${i}..."
-        {
-            echo -e "\n#define DISABLED_SYSCALL_WITH_FAKESYSCALL \\"
-            local IFS=$'\n'
-            for j in $(jq -r '. | keys | .[]' $BUILD_PROG_WORKING_DIR/builderfiles/glibc/fakesyscall.json); do
-                echo "Mapping fake syscall: $j"
-                local need_return=false
-                for z in $(jq -r '."'${j}'" | .[]' $BUILD_PROG_WORKING_DIR/builderfiles/glibc/fakesyscall.json); do
-                    if grep -q "^#define __NR_${z} " $header_disabled_syscall; then
-                        echo -e "\tcase __NR_${z}: \\"
-                        need_return=true
-                    elif [[ ${z} =~ ^[0-9]+$ ]]; then
-                        echo -e "\tcase ${z}: \\"
-                        need_return=true
-                    fi
-                done
-                [ "${need_return}" = "true" ] && echo -e "\t\treturn ${j}; \\"
-            done
-            unset IFS
-        } >> $header_disabled_syscall
-        
-        sed -i '$ s| \\||' $header_disabled_syscall
-        echo "Fake syscall mappings generated for ${i}."
+        echo "Generating fake syscall table for ${i}..."
+        bash $BUILD_PROG_WORKING_DIR/builderfiles/glibc/gen-fakesyscall.sh \
+            $BUILD_PROG_WORKING_DIR/builderfiles/glibc/fakesyscall.json \
+            sysdeps/unix/sysv/linux/${i}/arch-syscall.h \
+            sysdeps/unix/sysv/linux/${i}/disabled-syscall.h
+        echo "Fake syscall table generated for ${i}."
         
         echo "=== Architecture ${i} configuration completed ==="
     done
@@ -170,10 +140,34 @@ configure_glibc() {
 build_glibc() {
     echo "编译..."
     
-    cd $BUILD_PROG_WORKING_DIR/musl-${PKG_VERSIONS[musl]}
+    cd $BUILD_PROG_WORKING_DIR/glibc-glibc-${PKG_VERSIONS[glibc]}/glibc_build
     
     make all -j
-    make install prefix=$BUILD_PROG_WORKING_DIR/output syslibdir=$BUILD_PROG_WORKING_DIR/output/lib
+    
+    # 路径按设备上的安装目录配置，先装进临时根目录，再把应用目录下的文件放进 output
+    local install_root=$BUILD_PROG_WORKING_DIR/glibc_root
+    rm -rf $install_root
+    make install install_root=$install_root
+    # ld.so.cache 取决于设备上装了哪些库，不随包分发
+    rm -f $install_root$APP_INSTALL_DIR/etc/ld.so.cache
+    mkdir -p $BUILD_PROG_WORKING_DIR/output
+    cp -r $install_root$APP_DIR/. $BUILD_PROG_WORKING_DIR/output/
+    rm -rf $install_root
+    
+    # ld.so 先查 ld.so.cache 再搜索库目录，安装器装完包后运行 etc/postinst.d 下的脚本重建缓存，
+    # passwd/group 缓存也取决于设备上的用户
+    install -d -m 755 $BUILD_PROG_WORKING_DIR/output/etc/postinst.d
+    cat > $BUILD_PROG_WORKING_DIR/output/etc/postinst.d/40-ldconfig <<EOF
+#!/system/bin/sh
+${APP_INSTALL_DIR}/bin/ldconfig || true
+if [ -x ${APP_INSTALL_DIR}/bin/ldconfig32 ]; then
+    ${APP_INSTALL_DIR}/bin/ldconfig32 || true
+fi
+if [ -x ${APP_INSTALL_DIR}/bin/mkidscache ]; then
+    ${APP_INSTALL_DIR}/bin/mkidscache || true
+fi
+EOF
+    chmod 755 $BUILD_PROG_WORKING_DIR/output/etc/postinst.d/40-ldconfig
 }
 
 termux_step_configure() {
@@ -237,6 +231,32 @@ termux_glibc_make_syscall_without_fsc() {
 	echo "DONE"
 }
 
+termux_glibc_make_logring() {
+	echo "Compiling 'logring'..."
+	$CC ${TERMUX_PKG_BUILDER_DIR}/logring.c -o ${TERMUX_PREFIX}/bin/logring \
+		-I${TERMUX_PKG_BUILDER_DIR} -DLOG_RING_PATH=\"${TERMUX_PREFIX}/var/log/syslog.ring\"
+	install -dm755 ${TERMUX_PREFIX}/var/log
+	echo "DONE"
+}
+
+termux_glibc_make_syscallstats() {
+	echo "Compiling 'syscallstats'..."
+	$CC ${TERMUX_PKG_BUILDER_DIR}/syscallstats.c -o ${TERMUX_PREFIX}/bin/syscallstats \
+		-DSYSCALL_STATS_DIR=\"${TERMUX_PREFIX_CLASSICAL}/tmp\"
+	echo "DONE"
+}
+
+termux_glibc_make_mkidscache() {
+	echo "Compiling 'mkidscache'..."
+	$CC ${TERMUX_PKG_BUILDER_DIR}/mkidscache.c -o ${TERMUX_PREFIX}/bin/mkidscache \
+		-I${TERMUX_PKG_BUILDER_DIR} \
+		-DANDROID_IDS_CACHE_PATH=\"${TERMUX_PREFIX}/var/cache/android-ids.cache\" \
+		-DPASSWD_PATH=\"${TERMUX_PREFIX}/etc/passwd\" \
+		-DGROUP_PATH=\"${TERMUX_PREFIX}/etc/group\"
+	install -dm755 ${TERMUX_PREFIX}/var/cache
+	echo "DONE"
+}
+
 termux_step_make_install() {
 	rm -fr ${TERMUX__PREFIX__INCLUDE_DIR}/gnu
 
@@ -253,9 +273,15 @@ termux_step_make_install() {
 	fi
 	make install
 
+	# The cache depends on the libraries installed on the device, it is
+	# built there by etc/postinst.d/40-ldconfig (see build_glibc).
 	rm -f ${TERMUX_PREFIX}/etc/ld.so.cache
 	rm -f ${TERMUX_PREFIX}/bin/{tzselect,zdump,zic}
 
+	echo "include ${TERMUX_PREFIX}/etc/ld.so.conf.d/*.conf" > ${TERMUX_PREFIX}/etc/ld.so.conf
+	install -dm755 ${TERMUX_PREFIX}/etc/ld.so.conf.d
+	install -dm755 ${TERMUX_PREFIX}/var/cache/ldconfig
+
 	install -dm755 ${TERMUX__PREFIX__LIB_DIR}/tmpfiles.d
 	install -m644 ${TERMUX_PKG_SRCDIR}/nscd/nscd.conf ${TERMUX_PREFIX}/etc/nscd.conf
 	install -m644 ${TERMUX_PKG_SRCDIR}/nscd/nscd.tmpfiles ${TERMUX__PREFIX__LIB_DIR}/tmpfiles.d/nscd.conf
@@ -283,6 +309,9 @@ termux_step_make_install() {
 	ln -sfr $PATH_DYNAMIC_LINKER ${TERMUX__PREFIX__LIB_DIR}/ld.so
 
 	termux_glibc_make_syscall_without_fsc
+	termux_glibc_make_logring
+	termux_glibc_make_mkidscache
+	termux_glibc_make_syscallstats
 }
 
 termux_step_make_install_multilib() {
@@ -294,6 +323,7 @@ termux_step_make_install_multilib() {
 	cp -TR ${glibc32_dir}/${TERMUX__PREFIX__INCLUDE_DIR} $TERMUX__PREFIX__INCLUDE_DIR
 	cp -r ${glibc32_dir}/${TERMUX_PREFIX}/bin/ldd ${TERMUX_PREFIX}/bin/ldd32
 	cp -r ${glibc32_dir}/${TERMUX_PREFIX}/bin/ldconfig ${TERMUX_PREFIX}/bin/ldconfig32
+	install -dm755 ${TERMUX_PREFIX}/var/cache/ldconfig32
 	cp -r ${glibc32_dir}/${TERMUX_PREFIX}/bin/getconf ${TERMUX_PREFIX}/bin/getconf32
 	sed -i 's/ldd/ldd32/g' ${TERMUX_PREFIX}/bin/ldd32
 
@@ -57,13 +57,6 @@ setup_toolchain_musl() {
     fi
     
     # 设置环境变量
-    export ac_cv_func_getpwent=no
-    export ac_cv_func_endpwent=no
-    export ac_cv_func_getpwnam=no
-    export ac_cv_func_getpwuid=no
     export ac_cv_func_sigsetmask=no
     export ac_cv_c_bigendian=no
-    export ac_cv_func_setgrent=no
-    export ac_cv_func_getgrent=no
-    export ac_cv_func_endgrent=no
 }
\ No newline at end of file
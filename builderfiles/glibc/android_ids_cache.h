@@ -0,0 +1,56 @@
+/* <android_ids_cache.h> - layout of the passwd/group cache file written
+ * by mkidscache at install time and mapped read-only by the Android
+ * lookups in android_passwd_group.c.
+ *
+ * The file holds the users and groups present on the device: a header,
+ * an array of entries, two hash indexes (by kind and id, by kind and
+ * name) and the names. Buckets and chains store entry index + 1, 0 ends
+ * a chain. Everything is 32-bit and in host byte order, so the file is
+ * only meant for the device it was generated on.
+ */
+
+#ifndef _ANDROID_IDS_CACHE_H
+#define _ANDROID_IDS_CACHE_H
+
+#include <stdint.h>
+
+#define ANDROID_IDS_CACHE_MAGIC 0x43444941 // "AIDC"
+#define ANDROID_IDS_CACHE_VERSION 1
+
+#define ANDROID_IDS_CACHE_USER 0
+#define ANDROID_IDS_CACHE_GROUP 1
+
+struct android_ids_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t file_size;
+	uint32_t count; // entries
+	uint32_t buckets; // per index, power of two
+	uint32_t entries_offset;
+	uint32_t id_index_offset;
+	uint32_t name_index_offset;
+	uint32_t strings_offset;
+	uint32_t strings_size; // ends with a NUL
+};
+
+struct android_ids_cache_entry {
+	uint32_t id;
+	uint32_t kind;
+	uint32_t name; // offset in the strings
+	uint32_t next_by_id;
+	uint32_t next_by_name;
+};
+
+static inline uint32_t android_ids_cache_id_hash(uint32_t kind, uint32_t id) {
+	return (id ^ (kind << 31)) * 2654435761u;
+}
+
+// FNV-1a
+static inline uint32_t android_ids_cache_name_hash(uint32_t kind, const char* name) {
+	uint32_t h = 2166136261u ^ kind;
+	for (; *name != '\0'; name++)
+		h = (h ^ (unsigned char)*name) * 16777619u;
+	return h;
+}
+
+#endif // _ANDROID_IDS_CACHE_H
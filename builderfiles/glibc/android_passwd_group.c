@@ -4,23 +4,49 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "android_ids.h"
+#include "android_ids_cache.h"
 #include "android_passwd_group.h"
 
+// Per-thread buffer of the non-reentrant lookups, holds a name and the
+// member list of a group.
+#define ANDROID_NAME_BUF_SIZE 256
+
+// android_ids is sorted by aid (see gen-android-ids.sh).
 struct android_id_info * find_android_id_info_by_id(unsigned id) {
-	for (size_t n = 0; n < android_id_count; ++n)
-		if (android_ids[n].aid == id)
-			return &android_ids[n];
+	size_t low = 0, high = android_id_count;
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (android_ids[mid].aid < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low < android_id_count && android_ids[low].aid == id)
+		return &android_ids[low];
 	return NULL;
 }
 
+// One probe in the perfect hash generated with android_ids.
 struct android_id_info * find_android_id_info_by_name(const char* name) {
-	for (size_t n = 0; n < android_id_count; ++n)
-		if (!strcmp(android_ids[n].name, name))
-			return &android_ids[n];
-	return NULL;
+	int seed = android_name_seeds[android_name_hash(name, 0) % android_id_count];
+	if (seed == 0)
+		return NULL;
+	unsigned slot = (seed < 0) ? (unsigned)(-seed - 1) : android_name_hash(name, seed) % android_id_count;
+	struct android_id_info* info = &android_ids[android_name_slots[slot]];
+	if (strcmp(info->name, name) != 0)
+		return NULL;
+	return info;
 }
 
 int is_oem_id_android(id_t id) {
@@ -64,11 +90,12 @@ int is_valid_id_android(id_t id, int is_group) {
 }
 
 id_t oem_id_from_name_android(const char* name) {
-	unsigned int id;
-	if (sscanf(name, "oem_%u", &id) != 1) {
+	char* end;
+	if (strncmp(name, "oem_", 4) != 0 || !isdigit(name[4])) {
 		return 0;
 	}
-	if (!is_oem_id_android(id)) {
+	unsigned long id = strtoul(name + 4, &end, 10);
+	if (end[0] != 0 || id > UINT32_MAX || !is_oem_id_android(id)) {
 		return 0;
 	}
 	return (id_t)id;
@@ -81,9 +108,7 @@ id_t app_id_from_name_android(const char* name, int is_group) {
 	int is_shared_gid = 0;
 
 	if (is_group && name[0] == 'a' && name[1] == 'l' && name[2] == 'l') {
-		end = malloc(strlen(name));
-		for (int i=3; i<strlen(name); i++)
-			strncat(end, &name[i], 1);
+		end = (char*)name + 3;
 		userid = 0;
 		is_shared_gid = 1;
 	} else if (name[0] == 'u' && isdigit(name[1])) {
@@ -144,135 +169,554 @@ id_t app_id_from_name_android(const char* name, int is_group) {
 	return (appid + userid*AID_USER_OFFSET);
 }
 
-void get_name_by_uid_android(uid_t uid, char *name_u) {
+static const char digit_pairs_android[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// Appends the decimal digits of value at p, returns the new end.
+static char* put_uint_android(char* p, unsigned value) {
+	char digits[10];
+	char* start = digits + sizeof(digits);
+
+	while (value >= 100) {
+		start -= 2;
+		memcpy(start, &digit_pairs_android[(value % 100) * 2], 2);
+		value /= 100;
+	}
+	if (value >= 10) {
+		start -= 2;
+		memcpy(start, &digit_pairs_android[value * 2], 2);
+	} else {
+		*--start = '0' + value;
+	}
+	size_t len = digits + sizeof(digits) - start;
+	memcpy(p, start, len);
+	return p + len;
+}
+
+static char* put_str_android(char* p, const char* str, size_t len) {
+	memcpy(p, str, len);
+	return p + len;
+}
+
+// Copies the name built in name[0, end) out, with snprintf's return value.
+static int finish_name_android(char* buf, size_t size, const char* name, const char* end) {
+	size_t len = end - name;
+	if (len < size) {
+		memcpy(buf, name, len);
+		buf[len] = 0;
+	}
+	return len;
+}
+
+// u<userid>_<kind><id><suffix>, e.g. u0_a123_cache
+static int format_user_name_android(char* buf, size_t size, unsigned userid, char kind,
+		unsigned id, const char* suffix, size_t suffix_len) {
+	char name[48];
+	char* p = name;
+	*p++ = 'u';
+	p = put_uint_android(p, userid);
+	*p++ = '_';
+	*p++ = kind;
+	p = put_uint_android(p, id);
+	p = put_str_android(p, suffix, suffix_len);
+	return finish_name_android(buf, size, name, p);
+}
+
+// <prefix><id>, e.g. oem_2901
+static int format_id_name_android(char* buf, size_t size, const char* prefix, size_t prefix_len, unsigned id) {
+	char name[24];
+	char* p = put_str_android(name, prefix, prefix_len);
+	p = put_uint_android(p, id);
+	return finish_name_android(buf, size, name, p);
+}
+
+static int copy_info_name_android(char* buf, size_t size, const struct android_id_info* info) {
+	const char* name = info->name;
+	return finish_name_android(buf, size, name, name + strlen(name));
+}
+
+#define LITERAL_ANDROID(str) str, sizeof(str) - 1
+
+// The names below are written into the caller's buffer, size bytes
+// including the terminating null. They return the length of the name,
+// 0 if the id has none; a result >= size means the buffer is too small.
+int get_name_by_uid_android(uid_t uid, char* name_u, size_t size) {
 	uid_t appid = uid % AID_USER_OFFSET;
 	uid_t userid = uid / AID_USER_OFFSET;
 	struct android_id_info* info;
 
 	if (appid >= AID_ISOLATED_START) {
-		sprintf(name_u, "u%u_i%u", userid, appid - AID_ISOLATED_START);
+		return format_user_name_android(name_u, size, userid, 'i', appid - AID_ISOLATED_START, LITERAL_ANDROID(""));
 	} else if (appid < AID_APP_START) {
 		if ((info = find_android_id_info_by_id(appid)) != NULL)
-			sprintf(name_u, "%s", info->name);
+			return copy_info_name_android(name_u, size, info);
+		return 0;
 	} else {
-		sprintf(name_u, "u%u_a%u", userid, appid - AID_APP_START);
+		return format_user_name_android(name_u, size, userid, 'a', appid - AID_APP_START, LITERAL_ANDROID(""));
 	}
 }
 
-void get_name_by_gid_android(gid_t gid, char *name_g) {
+int get_name_by_gid_android(gid_t gid, char* name_g, size_t size) {
 	uid_t appid = gid % AID_USER_OFFSET;
 	uid_t userid = gid / AID_USER_OFFSET;
 	struct android_id_info* info;
 
 	if (appid >= AID_ISOLATED_START) {
-		sprintf(name_g, "u%u_i%u", userid, appid - AID_ISOLATED_START);
+		return format_user_name_android(name_g, size, userid, 'i', appid - AID_ISOLATED_START, LITERAL_ANDROID(""));
 	} else if (userid == 0 && appid >= AID_SHARED_GID_START && appid <= AID_SHARED_GID_END) {
-		sprintf(name_g, "all_a%u", appid - AID_SHARED_GID_START);
+		return format_id_name_android(name_g, size, LITERAL_ANDROID("all_a"), appid - AID_SHARED_GID_START);
 	} else if (appid >= AID_EXT_CACHE_GID_START && appid <= AID_EXT_CACHE_GID_END) {
-		sprintf(name_g, "u%u_a%u_ext_cache", userid, appid - AID_EXT_CACHE_GID_START);
+		return format_user_name_android(name_g, size, userid, 'a', appid - AID_EXT_CACHE_GID_START, LITERAL_ANDROID("_ext_cache"));
 	} else if (appid >= AID_EXT_GID_START && appid <= AID_EXT_GID_END) {
-		sprintf(name_g, "u%u_a%u_ext", userid, appid - AID_EXT_GID_START);
+		return format_user_name_android(name_g, size, userid, 'a', appid - AID_EXT_GID_START, LITERAL_ANDROID("_ext"));
 	} else if (appid >= AID_CACHE_GID_START && appid <= AID_CACHE_GID_END) {
-		sprintf(name_g, "u%u_a%u_cache", userid, appid - AID_CACHE_GID_START);
+		return format_user_name_android(name_g, size, userid, 'a', appid - AID_CACHE_GID_START, LITERAL_ANDROID("_cache"));
 	} else if (appid < AID_APP_START) {
 		if ((info = find_android_id_info_by_id(appid)) != NULL)
-			sprintf(name_g, "%s", info->name);
+			return copy_info_name_android(name_g, size, info);
+		return 0;
 	} else {
-		sprintf(name_g, "u%u_a%u", userid, appid - AID_APP_START);
+		return format_user_name_android(name_g, size, userid, 'a', appid - AID_APP_START, LITERAL_ANDROID(""));
 	}
 }
 
-struct passwd * get_passwd_android(const char* name, uid_t uid) {
-	static struct passwd res;
-
-	res.pw_name = (char *)name;
-	res.pw_passwd = (char *)"*";
-	res.pw_uid = uid;
-	res.pw_gid = uid;
-	res.pw_gecos = (char *)"";
-	res.pw_dir = (char *)APP_HOME_DIR;
-	res.pw_shell = (char *)(APP_PREFIX_DIR "/bin/login");
+// The cache of present users and groups written by mkidscache. Lookups
+// try it first and fall back to computing the entry. The file is stat'ed
+// again at most once a second and mapped anew when it was replaced; an
+// old mapping is never unmapped because other threads may still use it.
+#define ANDROID_IDS_CACHE_PATH APP_PREFIX_DIR "/var/cache/android-ids.cache"
+
+struct android_ids_cache {
+	const struct android_ids_cache_header* header;
+	const struct android_ids_cache_entry* entries;
+	const uint32_t* id_index;
+	const uint32_t* name_index;
+	const char* strings;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	off_t size;
+};
+
+static struct android_ids_cache* ids_cache_android;
+static long ids_cache_next_check_android;
+
+static int is_in_file_android(uint64_t offset, uint64_t size, uint64_t file_size) {
+	return offset % 4 == 0 && offset <= file_size && size <= file_size - offset;
+}
 
-	return &res;
+static struct android_ids_cache* map_ids_cache_android(int fd, const struct stat* st) {
+	if (st->st_size < (off_t)sizeof(struct android_ids_cache_header) || st->st_size > UINT32_MAX)
+		return NULL;
+	const struct android_ids_cache_header* header = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED)
+		return NULL;
+
+	uint64_t size = st->st_size;
+	const char* base = (const char*)header;
+	if (header->magic != ANDROID_IDS_CACHE_MAGIC || header->version != ANDROID_IDS_CACHE_VERSION
+			|| header->file_size != size
+			|| header->buckets == 0 || (header->buckets & (header->buckets - 1)) != 0
+			|| !is_in_file_android(header->entries_offset, (uint64_t)header->count * sizeof(struct android_ids_cache_entry), size)
+			|| !is_in_file_android(header->id_index_offset, (uint64_t)header->buckets * 4, size)
+			|| !is_in_file_android(header->name_index_offset, (uint64_t)header->buckets * 4, size)
+			|| !is_in_file_android(header->strings_offset, header->strings_size, size)
+			|| header->strings_size == 0 || base[header->strings_offset + header->strings_size - 1] != '\0')
+		goto fail;
+
+	struct android_ids_cache* cache = malloc(sizeof(*cache));
+	if (cache == NULL)
+		goto fail;
+	cache->header = header;
+	cache->entries = (const struct android_ids_cache_entry*)(base + header->entries_offset);
+	cache->id_index = (const uint32_t*)(base + header->id_index_offset);
+	cache->name_index = (const uint32_t*)(base + header->name_index_offset);
+	cache->strings = base + header->strings_offset;
+	cache->dev = st->st_dev;
+	cache->ino = st->st_ino;
+	cache->mtime = st->st_mtim;
+	cache->size = st->st_size;
+	return cache;
+
+fail:
+	munmap((void*)header, st->st_size);
+	return NULL;
 }
 
-struct group * get_group_android(const char* name, gid_t gid) {
-	static struct group res;
+static int is_same_file_android(const struct android_ids_cache* cache, const struct stat* st) {
+	return cache->dev == st->st_dev && cache->ino == st->st_ino && cache->size == st->st_size
+		&& cache->mtime.tv_sec == st->st_mtim.tv_sec && cache->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
 
-	res.gr_name = (char *)name;
-	res.gr_passwd = NULL;
-	res.gr_gid = gid;
-	res.gr_mem = *(char **[2]){(char **)name, NULL};
+static const struct android_ids_cache* get_ids_cache_android(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	long next = __atomic_load_n(&ids_cache_next_check_android, __ATOMIC_RELAXED);
+	if (now.tv_sec < next
+			|| !__atomic_compare_exchange_n(&ids_cache_next_check_android, &next, now.tv_sec + 1,
+				0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return __atomic_load_n(&ids_cache_android, __ATOMIC_ACQUIRE);
+
+	// This thread won the recheck.
+	struct android_ids_cache* cache = __atomic_load_n(&ids_cache_android, __ATOMIC_ACQUIRE);
+	struct stat st;
+	int fd = open(ANDROID_IDS_CACHE_PATH, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) != 0)
+		cache = NULL;
+	else if (cache == NULL || !is_same_file_android(cache, &st))
+		cache = map_ids_cache_android(fd, &st);
+	if (fd != -1)
+		close(fd);
+	__atomic_store_n(&ids_cache_android, cache, __ATOMIC_RELEASE);
+	return cache;
+}
 
-	return &res;
+// Chains are walked at most count steps, a corrupt file cannot loop.
+static const char* find_cached_name_android(uint32_t kind, id_t id) {
+	const struct android_ids_cache* cache = get_ids_cache_android();
+	if (cache == NULL)
+		return NULL;
+
+	uint32_t count = cache->header->count;
+	uint32_t n = cache->id_index[android_ids_cache_id_hash(kind, id) & (cache->header->buckets - 1)];
+	for (uint32_t steps = 0; n != 0 && n <= count && steps < count; steps++) {
+		const struct android_ids_cache_entry* entry = &cache->entries[n - 1];
+		if (entry->id == id && entry->kind == kind && entry->name < cache->header->strings_size)
+			return cache->strings + entry->name;
+		n = entry->next_by_id;
+	}
+	return NULL;
 }
 
-struct passwd * getpwuid_android(uid_t uid) {
-	char* name_res = malloc(64);
-
-	if (is_oem_id_android(uid))
-		sprintf(name_res, "oem_%u", uid);
-	else {
-		if (!is_valid_id_android(uid, 0))
-			return NULL;
-		get_name_by_uid_android(uid, name_res);
-		if (strlen(name_res) == 0)
-			return NULL;
+static int find_cached_id_android(uint32_t kind, const char* name, id_t* id) {
+	const struct android_ids_cache* cache = get_ids_cache_android();
+	if (cache == NULL)
+		return 0;
+
+	uint32_t count = cache->header->count;
+	uint32_t n = cache->name_index[android_ids_cache_name_hash(kind, name) & (cache->header->buckets - 1)];
+	for (uint32_t steps = 0; n != 0 && n <= count && steps < count; steps++) {
+		const struct android_ids_cache_entry* entry = &cache->entries[n - 1];
+		if (entry->kind == kind && entry->name < cache->header->strings_size
+				&& strcmp(cache->strings + entry->name, name) == 0) {
+			*id = entry->id;
+			return 1;
+		}
+		n = entry->next_by_name;
 	}
+	return 0;
+}
 
-	return get_passwd_android(name_res, uid);
+// Fill in the result around a name that is already in the caller's buffer.
+static void fill_passwd_android(struct passwd* pwd, char* name, uid_t uid) {
+	pwd->pw_name = name;
+	pwd->pw_passwd = (char *)"*";
+	pwd->pw_uid = uid;
+	pwd->pw_gid = uid;
+	pwd->pw_gecos = (char *)"";
+	pwd->pw_dir = (char *)APP_HOME_DIR;
+	pwd->pw_shell = (char *)(APP_PREFIX_DIR "/bin/login");
 }
 
-struct group * getgrgid_android(gid_t gid) {
-	char* name_res = malloc(64);
-
-	if (is_oem_id_android(gid))
-		sprintf(name_res, "oem_%u", gid);
-	else {
-		if (!is_valid_id_android(gid, 1))
-			return NULL;
-        	get_name_by_gid_android(gid, name_res);
-		if (strlen(name_res) == 0)
-			return NULL;
-	}
+static void fill_group_android(struct group* grp, char** members, char* name, gid_t gid) {
+	members[0] = name;
+	members[1] = NULL;
+	grp->gr_name = name;
+	grp->gr_passwd = NULL;
+	grp->gr_gid = gid;
+	grp->gr_mem = members;
+}
 
-	return get_group_android(name_res, gid);
+// Reserves the two member pointers of a group at the aligned start of buf.
+static char** reserve_members_android(char** pbuf, size_t* pbuflen) {
+	size_t pad = -(uintptr_t)*pbuf & (__alignof__(char*) - 1);
+	size_t need = pad + 2 * sizeof(char*);
+
+	if (*pbuflen < need)
+		return NULL;
+	char** members = (char**)(*pbuf + pad);
+	*pbuf += need;
+	*pbuflen -= need;
+	return members;
 }
 
-struct passwd * getpwnam_android(const char* name) {
-	uid_t uid;
+static int copy_name_android(const char* name, char* buf, size_t buflen) {
+	size_t len = strlen(name);
+
+	if (len >= buflen)
+		return ERANGE;
+	memcpy(buf, name, len + 1);
+	return 0;
+}
+
+static uid_t uid_from_name_android(const char* name, int is_group) {
 	struct android_id_info* info;
+	id_t id;
+
+	if (find_cached_id_android(is_group ? ANDROID_IDS_CACHE_GROUP : ANDROID_IDS_CACHE_USER, name, &id))
+		return id;
 
-	uid = app_id_from_name_android(name, 0);
-	if (uid != 0)
-		return get_passwd_android(name, uid);
+	id = app_id_from_name_android(name, is_group);
+	if (id != 0)
+		return id;
 
-	uid = oem_id_from_name_android(name);
-	if (uid != 0)
-		return get_passwd_android(name, uid);
+	id = oem_id_from_name_android(name);
+	if (id != 0)
+		return id;
 
 	info = find_android_id_info_by_name(name);
 	if (info != NULL)
-		return get_passwd_android(name, info->aid);
+		return info->aid;
 
-	return NULL;
+	return (uid_t)-1;
+}
+
+// Reentrant lookups with the getpwuid_r() convention: 0 with *result set
+// (or NULL if there is no such id), ERANGE if buf is too small.
+int getpwuid_android_r(uid_t uid, struct passwd* pwd, char* buf, size_t buflen, struct passwd** result) {
+	int len;
+
+	*result = NULL;
+	const char* cached = find_cached_name_android(ANDROID_IDS_CACHE_USER, uid);
+	if (cached != NULL) {
+		if (copy_name_android(cached, buf, buflen) != 0)
+			return ERANGE;
+	} else {
+		if (is_oem_id_android(uid))
+			len = format_id_name_android(buf, buflen, LITERAL_ANDROID("oem_"), uid);
+		else {
+			if (!is_valid_id_android(uid, 0))
+				return 0;
+			len = get_name_by_uid_android(uid, buf, buflen);
+			if (len == 0)
+				return 0;
+		}
+		if ((size_t)len >= buflen)
+			return ERANGE;
+	}
+
+	fill_passwd_android(pwd, buf, uid);
+	*result = pwd;
+	return 0;
+}
+
+int getgrgid_android_r(gid_t gid, struct group* grp, char* buf, size_t buflen, struct group** result) {
+	int len;
+
+	*result = NULL;
+	const char* cached = find_cached_name_android(ANDROID_IDS_CACHE_GROUP, gid);
+	if (cached == NULL && !is_oem_id_android(gid) && !is_valid_id_android(gid, 1))
+		return 0;
+	char** members = reserve_members_android(&buf, &buflen);
+	if (members == NULL)
+		return ERANGE;
+
+	if (cached != NULL) {
+		if (copy_name_android(cached, buf, buflen) != 0)
+			return ERANGE;
+	} else {
+		if (is_oem_id_android(gid))
+			len = format_id_name_android(buf, buflen, LITERAL_ANDROID("oem_"), gid);
+		else {
+			len = get_name_by_gid_android(gid, buf, buflen);
+			if (len == 0)
+				return 0;
+		}
+		if ((size_t)len >= buflen)
+			return ERANGE;
+	}
+
+	fill_group_android(grp, members, buf, gid);
+	*result = grp;
+	return 0;
+}
+
+int getpwnam_android_r(const char* name, struct passwd* pwd, char* buf, size_t buflen, struct passwd** result) {
+	*result = NULL;
+	uid_t uid = uid_from_name_android(name, 0);
+	if (uid == (uid_t)-1)
+		return 0;
+	if (copy_name_android(name, buf, buflen) != 0)
+		return ERANGE;
+
+	fill_passwd_android(pwd, buf, uid);
+	*result = pwd;
+	return 0;
+}
+
+int getgrnam_android_r(const char* name, struct group* grp, char* buf, size_t buflen, struct group** result) {
+	*result = NULL;
+	gid_t gid = uid_from_name_android(name, 1);
+	if (gid == (gid_t)-1)
+		return 0;
+	char** members = reserve_members_android(&buf, &buflen);
+	if (members == NULL || copy_name_android(name, buf, buflen) != 0)
+		return ERANGE;
+
+	fill_group_android(grp, members, buf, gid);
+	*result = grp;
+	return 0;
+}
+
+// The non-reentrant versions keep their result per thread.
+static __thread struct {
+	struct passwd pwd;
+	struct group grp;
+	char pwd_buf[ANDROID_NAME_BUF_SIZE];
+	char grp_buf[ANDROID_NAME_BUF_SIZE];
+} android_pwgr;
+
+struct passwd * getpwuid_android(uid_t uid) {
+	struct passwd* result;
+	getpwuid_android_r(uid, &android_pwgr.pwd, android_pwgr.pwd_buf, sizeof(android_pwgr.pwd_buf), &result);
+	return result;
+}
+
+struct group * getgrgid_android(gid_t gid) {
+	struct group* result;
+	getgrgid_android_r(gid, &android_pwgr.grp, android_pwgr.grp_buf, sizeof(android_pwgr.grp_buf), &result);
+	return result;
+}
+
+struct passwd * getpwnam_android(const char* name) {
+	struct passwd* result;
+	getpwnam_android_r(name, &android_pwgr.pwd, android_pwgr.pwd_buf, sizeof(android_pwgr.pwd_buf), &result);
+	return result;
 }
 
 struct group * getgrnam_android(const char* name) {
-	gid_t gid;
-	struct android_id_info* info;
+	struct group* result;
+	getgrnam_android_r(name, &android_pwgr.grp, android_pwgr.grp_buf, sizeof(android_pwgr.grp_buf), &result);
+	return result;
+}
 
-	gid = app_id_from_name_android(name, 1);
-	if (gid != 0)
-		return get_group_android(name, gid);
+// Enumeration for getpwent/getgrent: the system ids, the OEM ranges and
+// the app ranges of the calling user, one id at a time. ent->next counts
+// positions across all of them.
+struct android_ent_range {
+	id_t start;
+	id_t end;
+};
+
+static const struct android_ent_range android_oem_ranges[] = {
+	{ AID_OEM_RESERVED_START, AID_OEM_RESERVED_END },
+	{ AID_OEM_RESERVED_2_START, AID_OEM_RESERVED_2_END },
+};
+
+static const struct android_ent_range android_user_pw_ranges[] = {
+	{ AID_APP_START, AID_APP_END },
+};
+
+static const struct android_ent_range android_user_gr_ranges[] = {
+	{ AID_APP_START, AID_APP_END },
+	{ AID_CACHE_GID_START, AID_CACHE_GID_END },
+	{ AID_EXT_GID_START, AID_EXT_GID_END },
+	{ AID_EXT_CACHE_GID_START, AID_EXT_CACHE_GID_END },
+};
+
+#define ANDROID_ENT_RANGES(r) r, sizeof(r) / sizeof(r[0])
+
+// Maps position n onto ranges, or subtracts their size and returns 0.
+static int id_in_ranges_android(unsigned* n, const struct android_ent_range* ranges, size_t count, id_t base, id_t* id) {
+	for (size_t i = 0; i < count; i++) {
+		unsigned size = ranges[i].end - ranges[i].start + 1;
+		if (*n < size) {
+			*id = base + ranges[i].start + *n;
+			return 1;
+		}
+		*n -= size;
+	}
+	return 0;
+}
 
-	gid = oem_id_from_name_android(name);
-	if (gid != 0)
-		return get_group_android(name, gid);
+// The id at position n, 0 past the end.
+static int id_at_android(unsigned n, int is_group, id_t* id) {
+	if (n < android_id_count) {
+		*id = android_ids[n].aid;
+		return 1;
+	}
+	n -= android_id_count;
+	if (id_in_ranges_android(&n, ANDROID_ENT_RANGES(android_oem_ranges), 0, id))
+		return 1;
 
-	info = find_android_id_info_by_name(name);
-	if (info != NULL)
-		return get_group_android(name, info->aid);
+	id_t base = getuid() / AID_USER_OFFSET * AID_USER_OFFSET;
+	if (is_group)
+		return id_in_ranges_android(&n, ANDROID_ENT_RANGES(android_user_gr_ranges), base, id);
+	return id_in_ranges_android(&n, ANDROID_ENT_RANGES(android_user_pw_ranges), base, id);
+}
 
-	return NULL;
+void android_ent_reset(struct android_ent* ent) {
+	ent->next = 0;
+}
+
+// Same convention as getpwent_r(): ENOENT at the end, ERANGE (without
+// moving on) if buf is too small.
+int getpwent_android_r(struct android_ent* ent, struct passwd* pwd, char* buf, size_t buflen, struct passwd** result) {
+	id_t id;
+
+	*result = NULL;
+	while (id_at_android(ent->next, 0, &id)) {
+		int err = getpwuid_android_r(id, pwd, buf, buflen, result);
+		if (err != 0)
+			return err;
+		ent->next++;
+		if (*result != NULL)
+			return 0;
+	}
+	return ENOENT;
+}
+
+int getgrent_android_r(struct android_ent* ent, struct group* grp, char* buf, size_t buflen, struct group** result) {
+	id_t id;
+
+	*result = NULL;
+	while (id_at_android(ent->next, 1, &id)) {
+		int err = getgrgid_android_r(id, grp, buf, buflen, result);
+		if (err != 0)
+			return err;
+		ent->next++;
+		if (*result != NULL)
+			return 0;
+	}
+	return ENOENT;
+}
+
+// Adds the groups of an Android user to a getgrouplist() result, the way
+// the NSS initgroups_dyn functions do. Every synthetic group has the user
+// of the same name as its only member. Returns the new start.
+long int initgroups_android(const char* user, gid_t group, long int start,
+		long int* size, gid_t** groupsp, long int limit) {
+	struct group grp;
+	struct group* result;
+	char buf[ANDROID_NAME_BUF_SIZE];
+
+	if (getgrnam_android_r(user, &grp, buf, sizeof(buf), &result) != 0 || result == NULL)
+		return start;
+	if (grp.gr_gid == group)
+		return start;
+	for (long int i = 0; i < start; i++)
+		if ((*groupsp)[i] == grp.gr_gid)
+			return start;
+
+	if (start == *size) {
+		if (limit > 0 && *size == limit)
+			return start;
+		long int newsize = (limit <= 0) ? 2 * *size : (2 * *size < limit ? 2 * *size : limit);
+		gid_t* newgroups = realloc(*groupsp, newsize * sizeof(**groupsp));
+		if (newgroups == NULL)
+			return start;
+		*groupsp = newgroups;
+		*size = newsize;
+	}
+	(*groupsp)[start++] = grp.gr_gid;
+	return start;
 }
@@ -1,19 +1,31 @@
 #ifndef _ANDROID_PASSWD_GROUP_H
 #define _ANDROID_PASSWD_GROUP_H
 
+#include <sys/types.h>
 #include <pwd.h>
 #include <grp.h>
 
+// Position of getpwent/getgrent in the Android ids.
+struct android_ent {
+	unsigned next;
+};
+
 struct android_id_info * find_android_id_info_by_id(unsigned id);
 struct android_id_info * find_android_id_info_by_name(const char* name);
 int is_oem_id_android(id_t id);
 int is_valid_id_android(id_t id, int is_group);
 id_t oem_id_from_name_android(const char* name);
 id_t app_id_from_name_android(const char* name, int is_group);
-void get_name_by_uid_android(uid_t uid, char *name_u);
-void get_name_by_gid_android(gid_t gid, char *name_g);
-struct passwd * get_passwd_android(const char* name, uid_t uid);
-struct group * get_group_android(const char* name, gid_t gid);
+int get_name_by_uid_android(uid_t uid, char* name_u, size_t size);
+int get_name_by_gid_android(gid_t gid, char* name_g, size_t size);
+int getpwuid_android_r(uid_t uid, struct passwd* pwd, char* buf, size_t buflen, struct passwd** result);
+int getgrgid_android_r(gid_t gid, struct group* grp, char* buf, size_t buflen, struct group** result);
+int getpwnam_android_r(const char* name, struct passwd* pwd, char* buf, size_t buflen, struct passwd** result);
+int getgrnam_android_r(const char* name, struct group* grp, char* buf, size_t buflen, struct group** result);
+void android_ent_reset(struct android_ent* ent);
+int getpwent_android_r(struct android_ent* ent, struct passwd* pwd, char* buf, size_t buflen, struct passwd** result);
+int getgrent_android_r(struct android_ent* ent, struct group* grp, char* buf, size_t buflen, struct group** result);
+long int initgroups_android(const char* user, gid_t group, long int start, long int* size, gid_t** groupsp, long int limit);
 struct passwd * getpwuid_android(uid_t uid);
 struct group * getgrgid_android(gid_t gid);
 struct passwd * getpwnam_android(const char* name);
@@ -0,0 +1,109 @@
+/* Start-up cost of loading libraries by soname, with ld.so.cache and
+   with ld.so --inhibit-cache, which leaves only the search path. Each
+   run execs a fresh process that dlopens the libraries and exits.
+
+   usage: dl_startup [iterations] [soname...]  */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* default_sonames[] = {
+	"libm.so.6", "libresolv.so.2", "libutil.so.1", "libanl.so.1", "libz.so.1", "libpcre2-8.so.0",
+};
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare(const void* a, const void* b) {
+	long long x = *(const long long*)a, y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+// The main program comes first, its PT_INTERP names the dynamic linker.
+static int find_interp(struct dl_phdr_info* info, size_t size, void* data) {
+	for (int i = 0; i < info->dlpi_phnum; i++)
+		if (info->dlpi_phdr[i].p_type == PT_INTERP) {
+			*(const char**)data = (const char*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+			break;
+		}
+	return 1;
+}
+
+static void run(const char* label, const char* interp, const char* self, bool inhibit,
+		char** sonames, int count, int iterations, long long* samples) {
+	char* args[count + 5];
+	int n = 0;
+	args[n++] = (char*)interp;
+	if (inhibit)
+		args[n++] = "--inhibit-cache";
+	args[n++] = (char*)self;
+	args[n++] = "child";
+	for (int i = 0; i < count; i++)
+		args[n++] = sonames[i];
+	args[n] = NULL;
+
+	int failed = 0;
+	for (int i = 0; i < iterations; i++) {
+		long long start = now_ns();
+		pid_t pid = fork();
+		if (pid == 0) {
+			execv(interp, args);
+			_exit(127);
+		}
+		int status;
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+		samples[i] = now_ns() - start;
+	}
+
+	qsort(samples, iterations, sizeof(samples[0]), compare);
+	printf("%-14s p50 %8.1f us  p90 %8.1f us%s\n", label, samples[iterations / 2] / 1e3,
+	       samples[iterations * 9 / 10] / 1e3, failed ? "   (some libraries not found)" : "");
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && strcmp(argv[1], "child") == 0) {
+		int status = 0;
+		for (int i = 2; i < argc; i++)
+			if (dlopen(argv[i], RTLD_NOW) == NULL)
+				status = 1;
+		return status;
+	}
+
+	int iterations = argc > 1 ? atoi(argv[1]) : 200;
+	char** sonames = argc > 2 ? argv + 2 : (char**)default_sonames;
+	int count = argc > 2 ? argc - 2 : (int)(sizeof(default_sonames) / sizeof(default_sonames[0]));
+	long long* samples = malloc(sizeof(samples[0]) * (iterations > 0 ? iterations : 1));
+	const char* interp = NULL;
+	// Under the explicit ld.so, /proc/self/exe would name ld.so itself.
+	char self[4096];
+	ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (self_len < 0) {
+		perror("/proc/self/exe");
+		return 1;
+	}
+	self[self_len] = '\0';
+
+	dl_iterate_phdr(find_interp, &interp);
+	if (interp == NULL || samples == NULL || iterations < 1) {
+		fprintf(stderr, "%s: no dynamic linker found\n", argv[0]);
+		return 1;
+	}
+
+	run("ld.so.cache", interp, self, false, sonames, count, iterations, samples);
+	run("search path", interp, self, true, sonames, count, iterations, samples);
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/* How long epoll_pwait2 really sleeps on an idle epoll set for timeouts
+   from 10 us to 10 ms, next to epoll_wait with the timeout rounded up to
+   whole milliseconds, which is what callers got before sub-millisecond
+   timeouts were emulated. Goes through syscall(), where the override
+   dispatches to the emulation when the kernel lacks epoll_pwait2.
+
+   usage: epoll_pwait2_accuracy [iterations]  */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_epoll_pwait2
+#define SYS_epoll_pwait2 441
+#endif
+
+/* struct __kernel_timespec, 64-bit fields on every architecture.  */
+struct kernel_timespec {
+	int64_t tv_sec;
+	int64_t tv_nsec;
+};
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare(const void* a, const void* b) {
+	long long x = *(const long long*)a, y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+static void report(const char* label, long long timeout_ns, long long* samples, int count) {
+	long long sum = 0;
+	for (int i = 0; i < count; i++)
+		sum += samples[i];
+	qsort(samples, count, sizeof(samples[0]), compare);
+	printf("%8.0f us  %-10s mean %9.1f us  p50 %9.1f us  p99 %9.1f us\n", timeout_ns / 1e3, label,
+	       sum / 1e3 / count, samples[count / 2] / 1e3, samples[count * 99 / 100] / 1e3);
+}
+
+int main(int argc, char** argv) {
+	static const long long timeouts_ns[] = { 10000, 50000, 100000, 250000, 500000, 1000000, 2500000, 10000000 };
+	int count = argc > 1 ? atoi(argv[1]) : 200;
+	long long* samples = malloc(sizeof(samples[0]) * count);
+	struct epoll_event ev;
+
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0 || samples == NULL || count < 1) {
+		perror("epoll_create1");
+		return 1;
+	}
+
+	for (size_t t = 0; t < sizeof(timeouts_ns) / sizeof(timeouts_ns[0]); t++) {
+		long long timeout_ns = timeouts_ns[t];
+		struct kernel_timespec ts = { timeout_ns / 1000000000, timeout_ns % 1000000000 };
+
+		for (int i = 0; i < count; i++) {
+			long long start = now_ns();
+			if (syscall(SYS_epoll_pwait2, epfd, &ev, 1, &ts, NULL, 0) < 0) {
+				perror("epoll_pwait2");
+				return 1;
+			}
+			samples[i] = now_ns() - start;
+		}
+		report("pwait2", timeout_ns, samples, count);
+
+		int timeout_ms = (timeout_ns + 999999) / 1000000;
+		for (int i = 0; i < count; i++) {
+			long long start = now_ns();
+			epoll_wait(epfd, &ev, 1, timeout_ms);
+			samples[i] = now_ns() - start;
+		}
+		report("wait (ms)", timeout_ns, samples, count);
+	}
+
+	close(epfd);
+	free(samples);
+	return 0;
+}
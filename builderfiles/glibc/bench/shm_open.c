@@ -0,0 +1,120 @@
+/* shm_open against a plain file in _PATH_TMP, the usual workaround on
+   Android: latency of open/map/close, and producer to consumer throughput
+   of a child process reading what the parent writes.  */
+
+#include <fcntl.h>
+#include <paths.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIZE (4 << 20)
+#define OPENS 2000
+#define ROUNDS 64
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_shm(const char* name, int oflag) {
+	return shm_open(name, oflag, 0600);
+}
+
+static void unlink_shm(const char* name) {
+	shm_unlink(name);
+}
+
+static int open_file(const char* name, int oflag) {
+	char path[256];
+	snprintf(path, sizeof(path), _PATH_TMP "%s", name);
+	return open(path, oflag | O_CLOEXEC, 0600);
+}
+
+static void unlink_file(const char* name) {
+	char path[256];
+	snprintf(path, sizeof(path), _PATH_TMP "%s", name);
+	unlink(path);
+}
+
+static void bench(const char* label, int (*opener)(const char*, int), void (*remover)(const char*)) {
+	char name[64];
+	snprintf(name, sizeof(name), "bench-shm-%d", getpid());
+	int fd = opener(name, O_RDWR | O_CREAT | O_EXCL);
+	if (fd < 0 || ftruncate(fd, SIZE) != 0) {
+		perror(label);
+		exit(1);
+	}
+	close(fd);
+
+	double start = now();
+	for (int i = 0; i < OPENS; i++) {
+		fd = opener(name, O_RDWR);
+		void* p = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (fd < 0 || p == MAP_FAILED) {
+			perror(label);
+			exit(1);
+		}
+		munmap(p, SIZE);
+		close(fd);
+	}
+	double open_us = (now() - start) * 1e6 / OPENS;
+
+	// The child maps the object by name and sums every round the parent
+	// wrote; the pipe only carries the round trip.
+	int to_child[2], to_parent[2];
+	if (pipe(to_child) != 0 || pipe(to_parent) != 0) {
+		perror("pipe");
+		exit(1);
+	}
+	fd = opener(name, O_RDWR);
+	unsigned char* p = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	pid_t pid = fork();
+	if (pid == 0) {
+		int cfd = opener(name, O_RDONLY);
+		unsigned char* c = mmap(NULL, SIZE, PROT_READ, MAP_SHARED, cfd, 0);
+		unsigned long sum = 0;
+		char token;
+		if (c == MAP_FAILED)
+			_exit(1);
+		for (int r = 0; r < ROUNDS; r++) {
+			if (read(to_child[0], &token, 1) != 1)
+				_exit(1);
+			for (size_t i = 0; i < SIZE; i += 64)
+				sum += c[i];
+			if (write(to_parent[1], &token, 1) != 1)
+				_exit(1);
+		}
+		_exit(sum == 0);
+	}
+	start = now();
+	for (int r = 0; r < ROUNDS; r++) {
+		char token = 0;
+		memset(p, r + 1, SIZE);
+		if (write(to_child[1], &token, 1) != 1 || read(to_parent[0], &token, 1) != 1) {
+			perror(label);
+			exit(1);
+		}
+	}
+	double elapsed = now() - start;
+	int status;
+	waitpid(pid, &status, 0);
+	munmap(p, SIZE);
+	close(fd);
+	remover(name);
+
+	printf("%-8s open+mmap+close %8.2f us   producer->consumer %8.1f MiB/s%s\n",
+	       label, open_us, (double)SIZE * ROUNDS / elapsed / (1 << 20),
+	       WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "" : "   (child failed)");
+}
+
+int main(void) {
+	bench("shm_open", open_shm, unlink_shm);
+	bench("file", open_file, unlink_file);
+	return 0;
+}
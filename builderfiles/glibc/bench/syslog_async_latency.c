@@ -0,0 +1,55 @@
+/* Latency of a single syslog() call as the caller sees it, synchronous
+   and with LOG_ASYNC (the writer thread sends to logd), in percentiles.
+
+   usage: syslog_async_latency [messages]  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <time.h>
+
+#ifndef LOG_ASYNC
+#define LOG_ASYNC 0x40
+#endif
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare(const void* a, const void* b) {
+	long long x = *(const long long*)a, y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+static void run(const char* label, int options, long long* samples, int count) {
+	openlog("syslog_async_latency", options | LOG_NDELAY, LOG_USER);
+	for (int i = 0; i < count; i++) {
+		long long start = now_ns();
+		syslog(LOG_DEBUG, "latency sample %d of %d", i, count);
+		samples[i] = now_ns() - start;
+	}
+	// Flushes what the writer thread still holds.
+	closelog();
+
+	qsort(samples, count, sizeof(samples[0]), compare);
+	printf("%-6s p50 %7.2f us  p90 %7.2f us  p99 %7.2f us  p99.9 %7.2f us  max %8.2f us\n", label,
+	       samples[count / 2] / 1e3, samples[count * 90 / 100] / 1e3,
+	       samples[count * 99 / 100] / 1e3, samples[count * 999 / 1000] / 1e3,
+	       samples[count - 1] / 1e3);
+}
+
+int main(int argc, char** argv) {
+	int count = argc > 1 ? atoi(argv[1]) : 100000;
+	long long* samples = malloc(sizeof(samples[0]) * count);
+	if (samples == NULL || count < 1) {
+		fprintf(stderr, "usage: %s [messages]\n", argv[0]);
+		return 1;
+	}
+
+	run("sync", 0, samples, count);
+	run("async", LOG_ASYNC, samples, count);
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,77 @@
+/* syslog throughput with several threads sharing the log socket, once
+   undisturbed and once with another thread calling closelog/openlog in
+   a loop, which is what used to race with the writers.
+
+   usage: syslog_threads [threads] [messages per thread]  */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <time.h>
+
+static int messages = 20000;
+static atomic_bool done;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* writer(void* arg) {
+	long id = (long)arg;
+	for (int i = 0; i < messages; i++)
+		syslog(LOG_DEBUG, "bench thread %ld message %d", id, i);
+	return NULL;
+}
+
+static void* churn(void* arg) {
+	unsigned long* reopens = arg;
+	while (!atomic_load(&done)) {
+		closelog();
+		openlog("syslog_threads", LOG_NDELAY, LOG_USER);
+		(*reopens)++;
+	}
+	return NULL;
+}
+
+static void run(int threads, bool with_churn) {
+	pthread_t tids[threads], churner;
+	unsigned long reopens = 0;
+
+	openlog("syslog_threads", LOG_NDELAY, LOG_USER);
+	atomic_store(&done, false);
+	if (with_churn)
+		pthread_create(&churner, NULL, churn, &reopens);
+	double start = now();
+	for (long i = 0; i < threads; i++)
+		pthread_create(&tids[i], NULL, writer, (void*)i);
+	for (int i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+	double elapsed = now() - start;
+	atomic_store(&done, true);
+	if (with_churn)
+		pthread_join(churner, NULL);
+	closelog();
+
+	printf("%2d threads%-14s %10.0f msg/s", threads, with_churn ? " + reopening" : "",
+	       threads * (double)messages / elapsed);
+	if (with_churn)
+		printf("   %lu reopens", reopens);
+	printf("\n");
+}
+
+int main(int argc, char** argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+	if (argc > 2)
+		messages = atoi(argv[2]);
+
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		run(threads, false);
+		run(threads, true);
+	}
+	return 0;
+}
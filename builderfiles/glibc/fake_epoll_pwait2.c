@@ -1,20 +1,83 @@
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
 #include <stddef.h>
 #include <sys/types.h>
 #include <sys/epoll.h>
+#include <sys/poll.h>
 #include <sysdep-cancel.h>
 #include <sys/syscall.h>
+#include <time.h>
 
 #define MSEC_PER_SEC 1000L
 #define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+
+/* - Timeouts below a millisecond
+   epoll_pwait only takes milliseconds, so a timeout that is not a whole
+   number of them would have to be rounded up, and event loops asking for
+   a few microseconds would oversleep by up to a millisecond every time.
+   An epoll descriptor is itself pollable, readable while events are
+   ready, so such timeouts wait in ppoll, which takes nanoseconds and the
+   signal mask, and then collect the events with a zero timeout.  The
+   epoll set is never touched, other waiters on it see nothing of this,
+   and a cancellation inside ppoll leaves nothing behind.  When another
+   waiter took the events first, ppoll waits again for the time left.
+*/
+static int
+fake_epoll_pwait2_ppoll (int epfd, struct epoll_event *events, int maxevents,
+			 const struct __timespec64 *timeout, const sigset_t *sigmask) {
+	struct __timespec64 now, deadline;
+
+	__clock_gettime64 (CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout->tv_sec;
+	deadline.tv_nsec += timeout->tv_nsec;
+	if (deadline.tv_nsec >= NSEC_PER_SEC) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= NSEC_PER_SEC;
+	}
+
+	struct __timespec64 left = *timeout;
+	for (;;) {
+		struct pollfd pfd = { .fd = epfd, .events = POLLIN };
+		int res = __ppoll64 (&pfd, 1, &left, sigmask);
+		if (res <= 0)
+			return res;
+		/* Ready, or not an epoll descriptor: epoll_pwait says which.  */
+		res = INLINE_SYSCALL_CALL (epoll_pwait, epfd, events, maxevents, 0, NULL, 0);
+		if (res != 0)
+			return res;
+
+		__clock_gettime64 (CLOCK_MONOTONIC, &now);
+		left.tv_sec = deadline.tv_sec - now.tv_sec;
+		left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+		if (left.tv_nsec < 0) {
+			left.tv_sec--;
+			left.tv_nsec += NSEC_PER_SEC;
+		}
+		if (left.tv_sec < 0)
+			return 0;
+	}
+}
 
 static __attribute__((unused)) int
 fake_epoll_pwait2 (int epfd, struct epoll_event *events, int maxevents,
 		   const struct __timespec64 *timeout, const sigset_t *sigmask, size_t sigsetsize) {
-	long timeout_long = timeout->tv_sec * MSEC_PER_SEC;
-	if (timeout->tv_nsec > 0) {
-		timeout_long += timeout->tv_nsec / NSEC_PER_MSEC;
-		if (timeout->tv_nsec % NSEC_PER_MSEC > 0)
-			timeout_long += 1;
-	}
-	return SYSCALL_CANCEL (epoll_pwait, epfd, events, maxevents, timeout_long, sigmask, sigsetsize);
+	if (timeout == NULL)
+		return SYSCALL_CANCEL (epoll_pwait, epfd, events, maxevents, -1, sigmask, sigsetsize);
+	if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= NSEC_PER_SEC)
+		return INLINE_SYSCALL_ERROR_RETURN_VALUE (EINVAL);
+
+	/* Longer than epoll_pwait can wait is as good as forever.  */
+	long timeout_long = -1;
+	if (timeout->tv_sec < INT_MAX / MSEC_PER_SEC - 1)
+		timeout_long = timeout->tv_sec * MSEC_PER_SEC + timeout->tv_nsec / NSEC_PER_MSEC;
+	if (timeout->tv_nsec % NSEC_PER_MSEC == 0 || timeout_long == -1)
+		return SYSCALL_CANCEL (epoll_pwait, epfd, events, maxevents, timeout_long, sigmask, sigsetsize);
+
+	/* What epoll_pwait would refuse before waiting; ppoll only takes
+	   the kernel's sigset size.  */
+	if (maxevents <= 0 || (sigmask != NULL && sigsetsize != _NSIG / 8))
+		return INLINE_SYSCALL_ERROR_RETURN_VALUE (EINVAL);
+	return fake_epoll_pwait2_ppoll (epfd, events, maxevents, timeout, sigmask);
 }
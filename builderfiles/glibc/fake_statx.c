@@ -0,0 +1,68 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sysdep.h>
+
+/* - statx on top of fstatat
+   Used where the kernel or its seccomp filter refuses statx.  The stat
+   buffer is converted straight into the caller's statx, and of the
+   fields statx lets the caller ask for only the requested ones are
+   filled in, the others stay zero and out of stx_mask.  dev, rdev and
+   blksize are always filled, as the kernel does.  fstatat has nothing
+   for btime, mnt_id or the attributes, so those are never reported.
+
+   The sync flags only matter for network filesystems, fstatat behaves
+   like AT_STATX_SYNC_AS_STAT, which the kernel is allowed to do for the
+   other two as well.
+*/
+#define FAKE_STATX_FLAGS (AT_EMPTY_PATH | AT_NO_AUTOMOUNT | AT_SYMLINK_NOFOLLOW)
+
+static __attribute__((unused)) int
+fake_statx (int fd, const char *path, int flags, unsigned int mask, struct statx *buf) {
+	if ((flags & ~(FAKE_STATX_FLAGS | AT_STATX_SYNC_TYPE)) != 0
+	    || (flags & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE
+	    || (mask & STATX__RESERVED) != 0)
+		return INLINE_SYSCALL_ERROR_RETURN_VALUE (EINVAL);
+
+	struct __stat64_t64 st;
+	if (__fstatat64_time64 (fd, path, &st, flags & FAKE_STATX_FLAGS) != 0)
+		return -1;
+
+	memset (buf, 0, sizeof (*buf));
+	mask &= STATX_BASIC_STATS;
+	buf->stx_mask = mask;
+	buf->stx_blksize = st.st_blksize;
+	buf->stx_dev_major = __gnu_dev_major (st.st_dev);
+	buf->stx_dev_minor = __gnu_dev_minor (st.st_dev);
+	buf->stx_rdev_major = __gnu_dev_major (st.st_rdev);
+	buf->stx_rdev_minor = __gnu_dev_minor (st.st_rdev);
+	if (mask & (STATX_TYPE | STATX_MODE))
+		buf->stx_mode = st.st_mode;
+	if (mask & STATX_NLINK)
+		buf->stx_nlink = st.st_nlink;
+	if (mask & STATX_UID)
+		buf->stx_uid = st.st_uid;
+	if (mask & STATX_GID)
+		buf->stx_gid = st.st_gid;
+	if (mask & STATX_INO)
+		buf->stx_ino = st.st_ino;
+	if (mask & STATX_SIZE)
+		buf->stx_size = st.st_size;
+	if (mask & STATX_BLOCKS)
+		buf->stx_blocks = st.st_blocks;
+	if (mask & STATX_ATIME) {
+		buf->stx_atime.tv_sec = st.st_atim.tv_sec;
+		buf->stx_atime.tv_nsec = st.st_atim.tv_nsec;
+	}
+	if (mask & STATX_MTIME) {
+		buf->stx_mtime.tv_sec = st.st_mtim.tv_sec;
+		buf->stx_mtime.tv_nsec = st.st_mtim.tv_nsec;
+	}
+	if (mask & STATX_CTIME) {
+		buf->stx_ctime.tv_sec = st.st_ctim.tv_sec;
+		buf->stx_ctime.tv_nsec = st.st_ctim.tv_nsec;
+	}
+	return 0;
+}
@@ -2,7 +2,8 @@
 #define _FAKE_SYSCALL_BASE
 
 #include <arch-syscall.h>
-#include <disabled-syscall.h>
+
+/* Declarations the handlers in fakesyscall.json need.  */
 
 // close_range
 // fchownat
@@ -31,10 +32,19 @@
 // shmget
 #include <sys/shm.h>
 
-// statx_generic
-#include "io/statx_generic.c"
+// fake_statx
+#include "fake_statx.c"
 
 // fake_epoll_pwait2
 #include "fake_epoll_pwait2.c"
 
+typedef long int (*fake_syscall_handler) (long int, long int, long int,
+					  long int, long int, long int);
+
+/* The handlers and fake_syscall_table, generated by gen-fakesyscall.sh.  */
+#include <disabled-syscall.h>
+
+// syscall_probe_is_native
+#include "syscall-probe.c"
+
 #endif //_FAKE_SYSCALL_BASE
@@ -3,7 +3,6 @@
 
 #include <arch-syscall.h>
 #include <disabled-syscall.h>
-#undef DISABLED_SYSCALL_WITH_FAKESYSCALL
 
 #ifndef _UNISTD_H
 extern long int syscall (long int __sysno, ...) __THROW;
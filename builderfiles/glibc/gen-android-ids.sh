@@ -57,11 +57,105 @@ echo '    unsigned aid;' >> $TOTAL_FILE
 echo '};' >> $TOTAL_FILE
 echo '' >> $TOTAL_FILE
 echo 'static struct android_id_info android_ids[] = {' >> $TOTAL_FILE
-cat $READ_FILE | awk '{printf "    { \"" $2 "\", " $2 ", },\n"}' | sed -e 's/"AID_\(.*\)"/"\L\1"/' >> $TOTAL_FILE
+# sorted by aid for the binary search in find_android_id_info_by_id()
+sort -n -k3 $READ_FILE | awk '{printf "    { \"" $2 "\", " $2 ", },\n"}' | sed -e 's/"AID_\(.*\)"/"\L\1"/' >> $TOTAL_FILE
 echo '};' >> $TOTAL_FILE
 echo '' >> $TOTAL_FILE
 echo '#define android_id_count (sizeof(android_ids) / sizeof(android_ids[0]))' >> $TOTAL_FILE
 echo '' >> $TOTAL_FILE
+
+# Minimal perfect hash of the names (hash and displace): the hash with
+# seed 0 picks a bucket, android_name_seeds[bucket] is either the seed
+# that puts all names of the bucket in free slots, or -(slot + 1) for a
+# bucket with a single name. android_name_slots[slot] is the index in
+# android_ids. android_name_hash() below must match hash() here.
+echo '// Perfect hash of the names, see gen-android-ids.sh.' >> $TOTAL_FILE
+sort -n -k3 $READ_FILE | awk '{print $2}' | sed -e 's/^AID_\(.*\)/\L\1/' | awk '
+	function hash(s, seed,    h, i, m) {
+		h = 0
+		m = 31 + 2 * seed
+		for (i = 1; i <= length(s); i++)
+			h = (h * m + ord[substr(s, i, 1)]) % 65521
+		return h
+	}
+	function print_array(type, name, values,    i, line) {
+		print "static const " type " " name "[] = {"
+		line = ""
+		for (i = 0; i < n; i++) {
+			line = line " " values[i] ","
+			if (i % 12 == 11 || i == n - 1) {
+				print "   " line
+				line = ""
+			}
+		}
+		print "};"
+	}
+	BEGIN {
+		for (i = 32; i < 127; i++)
+			ord[sprintf("%c", i)] = i
+	}
+	{ names[n++] = $1 }
+	END {
+		for (i = 0; i < n; i++) {
+			b = hash(names[i], 0) % n
+			bucket[b] = bucket[b] " " i
+			size[b]++
+			seeds[i] = 0
+			slots[i] = 0
+		}
+		# Largest buckets first, they are the hardest to place.
+		for (sz = n; sz >= 2; sz--) {
+			for (b = 0; b < n; b++) {
+				if (size[b] != sz)
+					continue
+				split(bucket[b], keys, " ")
+				for (d = 1; ; d++) {
+					if (d > 30000) {
+						print "gen-android-ids.sh: no perfect hash found" > "/dev/stderr"
+						exit 1
+					}
+					split("", taken)
+					ok = 1
+					for (k = 1; k <= sz; k++) {
+						s = hash(names[keys[k]], d) % n
+						if ((s in used) || (s in taken)) {
+							ok = 0
+							break
+						}
+						taken[s] = keys[k]
+					}
+					if (ok)
+						break
+				}
+				seeds[b] = d
+				for (s in taken) {
+					used[s] = 1
+					slots[s] = taken[s]
+				}
+			}
+		}
+		free = 0
+		for (b = 0; b < n; b++) {
+			if (size[b] != 1)
+				continue
+			while (free in used)
+				free++
+			used[free] = 1
+			slots[free] = bucket[b] + 0
+			seeds[b] = -(free + 1)
+		}
+		print_array("short", "android_name_seeds", seeds)
+		print_array("unsigned short", "android_name_slots", slots)
+	}' >> $TOTAL_FILE || exit 1
+echo '' >> $TOTAL_FILE
+echo 'static inline unsigned android_name_hash(const char *name, unsigned seed) {' >> $TOTAL_FILE
+echo '    unsigned h = 0; // h * m + 255 stays below 2^32' >> $TOTAL_FILE
+echo '    unsigned m = 31 + 2 * seed;' >> $TOTAL_FILE
+echo '    for (; *name != 0; name++)' >> $TOTAL_FILE
+echo '        h = (h * m + (unsigned char)*name) % 65521;' >> $TOTAL_FILE
+echo '    return h;' >> $TOTAL_FILE
+echo '}' >> $TOTAL_FILE
+echo '' >> $TOTAL_FILE
 echo '// default paths for the application' >> $TOTAL_FILE
 echo "#define APP_HOME_DIR \"${APP_BASE_DIR}/home\"" >> $TOTAL_FILE
 echo "#define APP_PREFIX_DIR \"${APP_BASE_DIR}/usr\"" >> $TOTAL_FILE
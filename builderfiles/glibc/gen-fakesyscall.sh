@@ -0,0 +1,90 @@
+#!/usr/bin/bash
+
+# Generates disabled-syscall.h for one architecture from fakesyscall.json.
+#
+# fakesyscall.json maps a syscall name (or number) to what syscall() does
+# instead of entering the kernel: a C expression over the arguments a0..a5,
+# or "ENOSYS". Syscalls that are not listed stay native. The __NR_ macros of
+# listed syscalls are moved from arch-syscall.h into the generated header,
+# so glibc takes its fallback paths for them, and syscall() dispatches
+# through a table indexed by syscall number (see fakesyscall-base.h). A
+# second table holds the names, for SYSCALL_STATS (see syscall-stats.h).
+#
+# Usage: gen-fakesyscall.sh fakesyscall.json arch-syscall.h disabled-syscall.h
+
+FAKESYSCALL_JSON="$1"
+ARCH_SYSCALL_H="$2"
+DISABLED_SYSCALL_H="$3"
+
+declare -A handler_of_expr
+handlers=()
+entries=()
+
+echo '/* Generated by gen-fakesyscall.sh from fakesyscall.json.  */' > $DISABLED_SYSCALL_H
+echo '#ifndef _DISABLED_SYSCALL_H' >> $DISABLED_SYSCALL_H
+echo '#define _DISABLED_SYSCALL_H' >> $DISABLED_SYSCALL_H
+
+IFS=$'\n'
+for name in $(jq -r 'keys_unsorted | .[]' $FAKESYSCALL_JSON); do
+    if [[ ${name} =~ ^[0-9]+$ ]]; then
+        index=${name}
+    elif grep -q "^#define __NR_${name} " $ARCH_SYSCALL_H; then
+        grep "^#define __NR_${name} " $ARCH_SYSCALL_H >> $DISABLED_SYSCALL_H
+        sed -i "/^#define __NR_${name} /d" $ARCH_SYSCALL_H
+        index="__NR_${name}"
+    else
+        echo "Syscall ${name} not found in arch-syscall.h" >&2
+        continue
+    fi
+
+    expr=$(jq -r --arg name "${name}" '.[$name]' $FAKESYSCALL_JSON)
+    handler=${handler_of_expr[${expr}]}
+    if [ -z "${handler}" ]; then
+        if [ "${expr}" = "ENOSYS" ]; then
+            handler="fake_syscall_enosys"
+            expr="INLINE_SYSCALL_ERROR_RETURN_VALUE (ENOSYS)"
+            handler_of_expr["ENOSYS"]=${handler}
+        else
+            handler="fake_syscall_${name}"
+            handler_of_expr[${expr}]=${handler}
+        fi
+        handlers+=("${handler}:${expr}")
+    fi
+    entries+=("${index}:${handler}:${name}")
+done
+unset IFS
+
+echo '#endif /* _DISABLED_SYSCALL_H */' >> $DISABLED_SYSCALL_H
+
+{
+    echo
+    echo '/* Only syscall() itself, through fakesyscall-base.h, needs the handlers.  */'
+    echo '#if defined _FAKE_SYSCALL_BASE && !defined _FAKE_SYSCALL_TABLE'
+    echo '#define _FAKE_SYSCALL_TABLE'
+    for h in "${handlers[@]}"; do
+        echo
+        echo 'static long int'
+        echo "${h%%:*} (long int a0, long int a1, long int a2,"
+        echo '     long int a3, long int a4, long int a5)'
+        echo '{'
+        echo "  return ${h#*:};"
+        echo '}'
+    done
+    echo
+    echo 'static const fake_syscall_handler fake_syscall_table[] ='
+    echo '{'
+    for e in "${entries[@]}"; do
+        e=${e%:*}
+        echo "  [${e%%:*}] = ${e#*:},"
+    done
+    echo '};'
+    echo
+    echo '/* For the counts of SYSCALL_STATS, see syscall-stats.h.  */'
+    echo 'static const char *const fake_syscall_names[] ='
+    echo '{'
+    for e in "${entries[@]}"; do
+        echo "  [${e%%:*}] = \"${e##*:}\","
+    done
+    echo '};'
+    echo '#endif /* _FAKE_SYSCALL_TABLE */'
+} >> $DISABLED_SYSCALL_H
@@ -0,0 +1,202 @@
+/* logring - print the circular log file written by syslog with
+ * SYSLOG_SINK=ring (see syslog-ring.h).
+ *
+ * Usage: logring [-f] [-t tag] [-p priority] [file]
+ *   -f           keep waiting for new lines, like tail -f
+ *   -t tag       only lines with this tag
+ *   -p priority  only lines at or above this priority (V D I W E F or 2-7)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "syslog-ring.h"
+
+#ifndef LOG_RING_PATH
+#define LOG_RING_PATH "/var/log/syslog.ring"
+#endif
+
+// How long an uncommitted entry may block us before its writer is
+// assumed dead (killed between reserving the space and the commit).
+#define STALL_TIMEOUT_MS 1000
+
+static const char priority_letters[] = "??VDIWEF";
+
+static const struct log_ring_header* header;
+static const char* data;
+
+static uint64_t load_head(void) {
+	return __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+}
+
+static const struct log_ring_entry* entry_at(uint64_t pos) {
+	return (const struct log_ring_entry*)(data + pos % header->size);
+}
+
+// An entry is usable if it was committed for exactly this position.
+static bool is_entry(uint64_t pos) {
+	const struct log_ring_entry* entry = entry_at(pos);
+	uint32_t len = entry->len;
+	return __atomic_load_n(&entry->commit, __ATOMIC_ACQUIRE) == LOG_RING_COMMIT(pos)
+		&& len >= 8 && len % 8 == 0 && len <= header->size;
+}
+
+// Finds the first entry boundary at or after pos. Used at start-up and
+// whenever writers lapped us.
+static uint64_t sync_position(uint64_t pos, uint64_t head) {
+	pos = LOG_RING_ALIGN(pos);
+	while (pos < head && !is_entry(pos))
+		pos += 8;
+	return pos;
+}
+
+// Skips the uncommitted entry at pos. The writer stores len right after
+// reserving, so trust it if it leads to the next entry (or to head);
+// otherwise scan for the next entry boundary.
+static uint64_t skip_stalled(uint64_t pos, uint64_t head) {
+	uint32_t len = __atomic_load_n(&entry_at(pos)->len, __ATOMIC_RELAXED);
+	if (len >= 8 && len % 8 == 0 && len <= header->size && pos + len <= head
+			&& (pos + len == head || is_entry(pos + len)))
+		return pos + len;
+	return sync_position(pos + 8, head);
+}
+
+static uint64_t monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int parse_priority(const char* arg) {
+	const char* letter = strchr(priority_letters + 2, arg[0]);
+	if (letter != NULL && arg[0] != '\0')
+		return letter - priority_letters;
+	return atoi(arg);
+}
+
+static void print_entry(const struct log_ring_entry* entry) {
+	time_t sec = entry->tv_sec;
+	struct tm tm;
+	char time_buf[32];
+	localtime_r(&sec, &tm);
+	strftime(time_buf, sizeof(time_buf), "%m-%d %H:%M:%S", &tm);
+
+	const char* tag = entry->payload;
+	const char* msg = tag + entry->tag_len + 1;
+	int msg_len = entry->msg_len;
+	if (msg_len > 0 && msg[msg_len - 1] == '\n')
+		msg_len--;
+	char letter = entry->priority < sizeof(priority_letters) - 1 ? priority_letters[entry->priority] : '?';
+
+	printf("%s.%03u %5u %5u %c %s: %.*s\n", time_buf, entry->tv_nsec / 1000000,
+			entry->pid, entry->tid, letter, tag, msg_len, msg);
+}
+
+int main(int argc, char** argv) {
+	bool follow = false;
+	const char* tag_filter = NULL;
+	int min_priority = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ft:p:")) != -1) {
+		switch (opt) {
+			case 'f':
+				follow = true;
+				break;
+			case 't':
+				tag_filter = optarg;
+				break;
+			case 'p':
+				min_priority = parse_priority(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-f] [-t tag] [-p priority] [file]\n", argv[0]);
+				return 2;
+		}
+	}
+	const char* path = optind < argc ? argv[optind] : LOG_RING_PATH;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) != 0) {
+		perror(path);
+		return 1;
+	}
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED || st.st_size < LOG_RING_DATA_OFFSET) {
+		fprintf(stderr, "%s: cannot map log ring\n", path);
+		return 1;
+	}
+	header = map;
+	data = (const char*)map + LOG_RING_DATA_OFFSET;
+	if (header->magic != LOG_RING_MAGIC || header->version != LOG_RING_VERSION
+			|| header->size + LOG_RING_DATA_OFFSET > (uint64_t)st.st_size) {
+		fprintf(stderr, "%s: not a log ring\n", path);
+		return 1;
+	}
+
+	uint64_t size = header->size;
+	struct log_ring_entry* copy = malloc(size);
+	uint64_t head = load_head();
+	uint64_t pos = sync_position(head > size ? head - size : 0, head);
+	uint64_t stalled_pos = UINT64_MAX, stalled_since = 0;
+
+	for (;;) {
+		while (pos < head) {
+			if (load_head() - pos > size) {
+				// Overwritten while we were behind.
+				head = load_head();
+				pos = sync_position(head - size, head);
+				continue;
+			}
+			if (!is_entry(pos)) {
+				// Still being written, or never will be. Wait a
+				// bounded time, then skip it and go on.
+				if (pos != stalled_pos) {
+					stalled_pos = pos;
+					stalled_since = monotonic_ms();
+				}
+				if (monotonic_ms() - stalled_since < STALL_TIMEOUT_MS) {
+					if (follow)
+						break;
+					usleep(1000);
+					head = load_head();
+					continue;
+				}
+				pos = skip_stalled(pos, head);
+				continue;
+			}
+			const struct log_ring_entry* entry = entry_at(pos);
+			uint32_t len = entry->len;
+			if (pos % size + len > size) {
+				pos += len; // padding before the wrap
+				continue;
+			}
+			memcpy(copy, entry, len);
+			if (load_head() - pos > size)
+				continue; // torn copy, resync above
+			pos += len;
+
+			if (tag_filter != NULL && strcmp(copy->payload, tag_filter) != 0)
+				continue;
+			if (copy->priority < min_priority)
+				continue;
+			print_entry(copy);
+		}
+		if (!follow)
+			break;
+		fflush(stdout);
+		usleep(100000);
+		head = load_head();
+	}
+
+	free(copy);
+	return 0;
+}
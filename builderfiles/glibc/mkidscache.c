@@ -0,0 +1,273 @@
+/* mkidscache - write the passwd/group cache read by the Android lookups
+ * in libc (see android_ids_cache.h). Run at install time, and again
+ * whenever new users show up; libc notices the new file by its mtime.
+ *
+ * Usage: mkidscache [-o file] [id...]
+ *
+ * The cache holds the users and groups present on the device: the
+ * Android system and OEM ids, the owners of running processes, the ids
+ * of the caller and any ids given as arguments. Entries that come from
+ * the passwd and group files are left out, NSS finds those first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include "android_ids_cache.h"
+
+#ifndef ANDROID_IDS_CACHE_PATH
+#define ANDROID_IDS_CACHE_PATH "/var/cache/android-ids.cache"
+#endif
+#ifndef PASSWD_PATH
+#define PASSWD_PATH "/etc/passwd"
+#endif
+#ifndef GROUP_PATH
+#define GROUP_PATH "/etc/group"
+#endif
+
+// Android ids below this are system and OEM ids, the rest are per app.
+#define FIRST_APP_ID 10000
+
+struct id_list {
+	uint32_t* ids;
+	size_t count;
+	size_t size;
+};
+
+struct name_entry {
+	uint32_t id;
+	uint32_t kind;
+	char* name;
+};
+
+static struct id_list candidates;
+static struct id_list file_users, file_groups;
+static struct name_entry* entries;
+static size_t entry_count, entry_size;
+
+static void* xrealloc(void* ptr, size_t size) {
+	ptr = realloc(ptr, size);
+	if (ptr == NULL) {
+		perror("mkidscache");
+		exit(1);
+	}
+	return ptr;
+}
+
+static void add_id(struct id_list* list, uint32_t id) {
+	if (list->count == list->size) {
+		list->size = list->size ? 2 * list->size : 256;
+		list->ids = xrealloc(list->ids, list->size * sizeof(*list->ids));
+	}
+	list->ids[list->count++] = id;
+}
+
+static int compare_ids(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void sort_unique(struct id_list* list) {
+	size_t n = 0;
+	qsort(list->ids, list->count, sizeof(*list->ids), compare_ids);
+	for (size_t i = 0; i < list->count; i++)
+		if (n == 0 || list->ids[n - 1] != list->ids[i])
+			list->ids[n++] = list->ids[i];
+	list->count = n;
+}
+
+static bool has_id(const struct id_list* list, uint32_t id) {
+	return bsearch(&id, list->ids, list->count, sizeof(*list->ids), compare_ids) != NULL;
+}
+
+static void add_entry(uint32_t kind, uint32_t id, const char* name) {
+	if (entry_count == entry_size) {
+		entry_size = entry_size ? 2 * entry_size : 256;
+		entries = xrealloc(entries, entry_size * sizeof(*entries));
+	}
+	entries[entry_count].id = id;
+	entries[entry_count].kind = kind;
+	entries[entry_count].name = strdup(name);
+	entry_count++;
+}
+
+static void read_files(void) {
+	FILE* file = fopen(PASSWD_PATH, "r");
+	if (file != NULL) {
+		struct passwd* pwd;
+		while ((pwd = fgetpwent(file)) != NULL)
+			add_id(&file_users, pwd->pw_uid);
+		fclose(file);
+	}
+	file = fopen(GROUP_PATH, "r");
+	if (file != NULL) {
+		struct group* grp;
+		while ((grp = fgetgrent(file)) != NULL)
+			add_id(&file_groups, grp->gr_gid);
+		fclose(file);
+	}
+	sort_unique(&file_users);
+	sort_unique(&file_groups);
+}
+
+static void collect_candidates(int argc, char** argv) {
+	struct passwd* pwd;
+	struct group* grp;
+
+	setpwent();
+	while ((pwd = getpwent()) != NULL)
+		if (pwd->pw_uid < FIRST_APP_ID)
+			add_id(&candidates, pwd->pw_uid);
+	endpwent();
+	setgrent();
+	while ((grp = getgrent()) != NULL)
+		if (grp->gr_gid < FIRST_APP_ID)
+			add_id(&candidates, grp->gr_gid);
+	endgrent();
+
+	DIR* proc = opendir("/proc");
+	if (proc != NULL) {
+		struct dirent* ent;
+		struct stat st;
+		while ((ent = readdir(proc)) != NULL) {
+			if (ent->d_name[0] < '0' || ent->d_name[0] > '9')
+				continue;
+			if (fstatat(dirfd(proc), ent->d_name, &st, 0) == 0) {
+				add_id(&candidates, st.st_uid);
+				add_id(&candidates, st.st_gid);
+			}
+		}
+		closedir(proc);
+	}
+
+	add_id(&candidates, getuid());
+	add_id(&candidates, getgid());
+	int ngroups = getgroups(0, NULL);
+	if (ngroups > 0) {
+		gid_t* groups = xrealloc(NULL, ngroups * sizeof(*groups));
+		ngroups = getgroups(ngroups, groups);
+		for (int i = 0; i < ngroups; i++)
+			add_id(&candidates, groups[i]);
+		free(groups);
+	}
+
+	for (int i = 0; i < argc; i++)
+		add_id(&candidates, strtoul(argv[i], NULL, 10));
+	sort_unique(&candidates);
+}
+
+static void resolve_candidates(void) {
+	for (size_t i = 0; i < candidates.count; i++) {
+		uint32_t id = candidates.ids[i];
+		struct passwd* pwd = has_id(&file_users, id) ? NULL : getpwuid(id);
+		if (pwd != NULL)
+			add_entry(ANDROID_IDS_CACHE_USER, id, pwd->pw_name);
+		struct group* grp = has_id(&file_groups, id) ? NULL : getgrgid(id);
+		if (grp != NULL)
+			add_entry(ANDROID_IDS_CACHE_GROUP, id, grp->gr_name);
+	}
+}
+
+static int write_cache(const char* path) {
+	struct android_ids_cache_header header = { 0 };
+	uint32_t buckets = 16;
+	while (buckets < entry_count)
+		buckets *= 2;
+
+	size_t strings_size = 1;
+	for (size_t i = 0; i < entry_count; i++)
+		strings_size += strlen(entries[i].name) + 1;
+
+	header.magic = ANDROID_IDS_CACHE_MAGIC;
+	header.version = ANDROID_IDS_CACHE_VERSION;
+	header.count = entry_count;
+	header.buckets = buckets;
+	header.entries_offset = sizeof(header);
+	header.id_index_offset = header.entries_offset + entry_count * sizeof(struct android_ids_cache_entry);
+	header.name_index_offset = header.id_index_offset + buckets * 4;
+	header.strings_offset = header.name_index_offset + buckets * 4;
+	header.strings_size = strings_size;
+	header.file_size = header.strings_offset + strings_size;
+
+	char* data = calloc(1, header.file_size);
+	if (data == NULL) {
+		perror("mkidscache");
+		return 1;
+	}
+	memcpy(data, &header, sizeof(header));
+	struct android_ids_cache_entry* out = (struct android_ids_cache_entry*)(data + header.entries_offset);
+	uint32_t* id_index = (uint32_t*)(data + header.id_index_offset);
+	uint32_t* name_index = (uint32_t*)(data + header.name_index_offset);
+	char* strings = data + header.strings_offset;
+
+	uint32_t name = 1; // offset 0 is the empty string
+	for (size_t i = 0; i < entry_count; i++) {
+		size_t len = strlen(entries[i].name);
+		memcpy(strings + name, entries[i].name, len + 1);
+		out[i].id = entries[i].id;
+		out[i].kind = entries[i].kind;
+		out[i].name = name;
+		name += len + 1;
+
+		uint32_t* bucket = &id_index[android_ids_cache_id_hash(out[i].kind, out[i].id) & (buckets - 1)];
+		out[i].next_by_id = *bucket;
+		*bucket = i + 1;
+		bucket = &name_index[android_ids_cache_name_hash(out[i].kind, entries[i].name) & (buckets - 1)];
+		out[i].next_by_name = *bucket;
+		*bucket = i + 1;
+	}
+
+	// Replace the old file atomically, readers keep their old mapping.
+	size_t path_len = strlen(path);
+	char* tmp_path = xrealloc(NULL, path_len + sizeof(".XXXXXX"));
+	memcpy(tmp_path, path, path_len);
+	memcpy(tmp_path + path_len, ".XXXXXX", sizeof(".XXXXXX"));
+	int fd = mkstemp(tmp_path);
+	if (fd == -1) {
+		perror(tmp_path);
+		free(data);
+		return 1;
+	}
+	int ok = fchmod(fd, 0644) == 0 && write(fd, data, header.file_size) == (ssize_t)header.file_size
+		&& fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(tmp_path, path) != 0) {
+		perror(path);
+		unlink(tmp_path);
+		free(tmp_path);
+		free(data);
+		return 1;
+	}
+	free(tmp_path);
+	free(data);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	const char* path = ANDROID_IDS_CACHE_PATH;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:")) != -1) {
+		switch (opt) {
+			case 'o':
+				path = optarg;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-o file] [id...]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	read_files();
+	collect_candidates(argc - optind, argv + optind);
+	resolve_candidates();
+	return write_cache(path);
+}
@@ -0,0 +1,43 @@
+/* - Memory for generated code
+   Android does not let apps make their data files executable, and JITs
+   that write code and then mprotect() it to PROT_EXEC end up in the slow
+   copying fallback of mprotect.c.  mmap_code() instead maps one memfd
+   twice: the returned view is readable and executable, *writable gets a
+   readable and writable view of the same pages.  No page is ever both
+   writable and executable, and nothing has to be remapped or copied to
+   run the code that was written.
+*/
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sysdep.h>
+#include <unistd.h>
+#include <not-cancel.h>
+
+void *mmap_code(size_t len, void **writable) {
+	int fd = INLINE_SYSCALL_CALL(memfd_create, "code", MFD_CLOEXEC);
+	if (fd < 0)
+		return MAP_FAILED;
+
+	void *code = MAP_FAILED;
+	void *rw = MAP_FAILED;
+	if (__ftruncate64(fd, len) == 0) {
+		rw = __mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if (rw != MAP_FAILED) {
+			code = __mmap(NULL, len, PROT_READ|PROT_EXEC, MAP_SHARED, fd, 0);
+			if (code == MAP_FAILED)
+				__munmap(rw, len);
+		}
+	}
+	__close_nocancel_nostatus(fd);
+	if (code != MAP_FAILED)
+		*writable = rw;
+	return code;
+}
+
+int munmap_code(void *code, void *writable, size_t len) {
+	int res = __munmap(code, len);
+	if (__munmap(writable, len) != 0)
+		res = -1;
+	return res;
+}
@@ -13,90 +13,356 @@
 #include <sys/syscall.h>
 #include <string.h>
 #include <fcntl.h>
-#include <stdio.h>
 #include <not-cancel.h>
 
 #ifdef SHARED
-# define GLOBAL_READ_SIZE 1024
+# include <stdlib.h>
+# include <stdint.h>
+# include <libc-lock.h>
+# include <atomic.h>
+# include <libc-pointer-arith.h>
+# include "syscall-stats.h"
 
-/* - String To Unsigned Long Int
-   There are two chairs - one is called "strtoul", the other "stuli"...
+# define MAPS_READ_SIZE 4096
+
+/* - Scanning /proc/self/maps
+   Lines start with "start-end " in hex and are sorted by start.  The
+   scanner reads into a stack buffer and only looks at that first field,
+   skipping the rest of each line, so it allocates nothing and stops as
+   soon as it has passed addr.
 */
-static unsigned long int __stuli(char *value) {
-	unsigned long int val, res = 0;
-	int len = strlen(value);
-
-	for (int i=0; i<len; i++) {
-		val = value[len-1-i]-'0';
-		if (val == 0)
-			continue;
-		else if (val > 9)
-			val = value[len-1-i]-'W';
-		for (int j=0; j<i; j++)
-			val *= 16;
-		res += val;
+struct maps_scanner {
+	int fd;
+	char buf[MAPS_READ_SIZE];
+	char *pos;
+	char *end;
+};
+
+static int __maps_getc(struct maps_scanner *sc) {
+	if (sc->pos == sc->end) {
+		ssize_t n = __read_nocancel(sc->fd, sc->buf, sizeof(sc->buf));
+		if (n <= 0)
+			return -1;
+		sc->pos = sc->buf;
+		sc->end = sc->buf + n;
 	}
+	return (unsigned char)*sc->pos++;
+}
 
-	return res;
+static int __hex_value(int c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
 }
 
-static int __is_mmaped(void *addr) {
-	char buff[GLOBAL_READ_SIZE];
-	char *buff2 = NULL;
-	char *cont = NULL;
-	int res = 0;
-	int strlc, strlb;
-	memset(buff, 0, sizeof(buff));
-	int map = __open_nocancel("/proc/self/maps", O_RDONLY|O_CLOEXEC);
-	if (map >= 0) {
-		while (__read_nocancel(map, buff, GLOBAL_READ_SIZE) > 0) {
-			strlc = cont ? strlen(cont) : 0;
-			if (strlc > 0) {
-				free(buff2);
-				buff2 = malloc(sizeof(char)*strlc);
-				memcpy(buff2, cont, strlc);
-			}
-			free(cont);
-			cont = calloc(strlc+strlen(buff), sizeof(char));
-			strlb = buff2 ? strlen(buff2): 0;
-			if (strlb > 0)
-				memcpy(cont, buff2, strlb);
-			__strncat(cont, buff, GLOBAL_READ_SIZE);
-			memset(buff, 0, sizeof(buff));
+/* Reads the range of the next mapping, 0 at the end of the file.  */
+static int __maps_next(struct maps_scanner *sc, uintptr_t *start, uintptr_t *end) {
+	uintptr_t value[2] = { 0, 0 };
+	int field = 0, c, digit;
+
+	while ((c = __maps_getc(sc)) != -1) {
+		if ((digit = __hex_value(c)) >= 0)
+			value[field] = value[field] << 4 | digit;
+		else if (c == '-' && field == 0)
+			field = 1;
+		else
+			break;
+	}
+	if (c == -1)
+		return 0;
+	while (c != '\n' && c != -1) {
+		char *nl = memchr(sc->pos, '\n', sc->end - sc->pos);
+		if (nl != NULL) {
+			sc->pos = nl + 1;
+			break;
 		}
-		char *saveptr;
-		while ((buff2 = strtok_r(cont, "\n", &cont)))
-			if (__stuli(strtok_r(buff2, "-", &saveptr)) == (unsigned long int)addr) {
+		sc->pos = sc->end;
+		c = __maps_getc(sc);
+	}
+	*start = value[0];
+	*end = value[1];
+	return 1;
+}
+
+static int __maps_open(struct maps_scanner *sc) {
+	sc->fd = __open_nocancel("/proc/self/maps", O_RDONLY|O_CLOEXEC);
+	sc->pos = sc->end = sc->buf;
+	return sc->fd >= 0;
+}
+
+/* - Mapping index
+   With MPROTECT_MAPS_INDEX=1 in the environment the ranges of the last
+   scan are kept in a sorted array and both answers come from it: addr is
+   the start of a known range, inside one, or in a gap.  Before it is
+   trusted the answer is checked with msync, which fails with ENOMEM on
+   unmapped pages: the range must still start where the index says (its
+   first page mapped, the page below not), addr and the page below it must
+   be mapped when inside a range, addr unmapped in a gap.  When a check fails, or the page below a
+   range is mapped so that only a scan can tell where the boundary is, the
+   index is rebuilt.  A mapping placed with MAP_FIXED exactly at an
+   interior addr by someone else, or an mprotect that bypasses libc, is not
+   noticed; mprotect through libc records the split, the replacements done
+   here drop the index.  The array comes from mmap, this runs under malloc as
+   well.
+*/
+struct maps_range {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+static int maps_index_mode; /* 0 unknown, 1 off, 2 on */
+static struct maps_range *maps_index;
+static size_t maps_index_count, maps_index_size;
+__libc_lock_define_initialized(static, maps_index_lock)
+
+static int __maps_index_enabled(void) {
+# if !IS_IN (libc)
+	/* The copy in ld.so (_dl_protect_relro, execstack) has no getenv and
+	   runs a handful of times, the plain scan is enough there.  */
+	return 0;
+# else
+	int mode = atomic_load_relaxed(&maps_index_mode);
+	if (mode == 0) {
+		const char *env = getenv("MPROTECT_MAPS_INDEX");
+		mode = (env != NULL && env[0] == '1') ? 2 : 1;
+		atomic_store_relaxed(&maps_index_mode, mode);
+	}
+	return mode == 2;
+# endif
+}
+
+static const struct maps_range *__maps_index_find(uintptr_t addr) {
+	size_t low = 0, high = maps_index_count;
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (maps_index[mid].end <= addr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low < maps_index_count && maps_index[low].start <= addr)
+		return &maps_index[low];
+	return NULL;
+}
+
+static int __maps_index_reserve(void) {
+	if (maps_index_count == maps_index_size) {
+		size_t size = maps_index_size ? 2 * maps_index_size : 1024;
+		struct maps_range *index = __mmap(NULL, size * sizeof(*index), PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (index == MAP_FAILED)
+			return 0;
+		if (maps_index != NULL) {
+			memcpy(index, maps_index, maps_index_count * sizeof(*index));
+			__munmap(maps_index, maps_index_size * sizeof(*index));
+		}
+		maps_index = index;
+		maps_index_size = size;
+	}
+	return 1;
+}
+
+static int __maps_index_add(uintptr_t start, uintptr_t end) {
+	if (!__maps_index_reserve())
+		return 0;
+	maps_index[maps_index_count].start = start;
+	maps_index[maps_index_count].end = end;
+	maps_index_count++;
+	return 1;
+}
+
+static int __maps_mapped(uintptr_t addr) {
+	return INTERNAL_SYSCALL_CALL(msync, (void *)addr, 1, MS_ASYNC) == 0;
+}
+
+/* Whether a mapping provably starts at start.  */
+static int __maps_starts_at(uintptr_t start) {
+	uintptr_t page = __getpagesize();
+	return __maps_mapped(start) && (start < page || !__maps_mapped(start - page));
+}
+
+/* 1 or 0 from the index, -1 when it may be stale.  */
+static int __maps_index_lookup(uintptr_t addr) {
+	if (maps_index_count == 0)
+		return -1;
+	const struct maps_range *range = __maps_index_find(addr);
+	if (range == NULL)
+		return __maps_mapped(addr) ? -1 : 0;
+	if (!__maps_starts_at(range->start))
+		return -1;
+	if (range->start == addr)
+		return 1;
+	/* Inside: addr and the page below must both still be mapped.  */
+	return __maps_mapped(addr) && __maps_mapped(addr - __getpagesize()) ? 0 : -1;
+}
+
+/* mprotect on part of a mapping splits it.  The new boundaries are
+   recorded, a split that the kernel merged again is caught by the check of
+   the page below.  */
+static void __maps_index_split(uintptr_t addr) {
+	const struct maps_range *range = __maps_index_find(addr);
+	if (range == NULL || range->start == addr)
+		return;
+	size_t i = range - maps_index;
+	if (!__maps_index_reserve()) {
+		maps_index_count = 0;
+		return;
+	}
+	memmove(&maps_index[i + 1], &maps_index[i], (maps_index_count - i) * sizeof(*maps_index));
+	maps_index_count++;
+	maps_index[i].end = addr;
+	maps_index[i + 1].start = addr;
+}
+
+static void __maps_index_protected(uintptr_t addr, size_t len) {
+	if (!__maps_index_enabled())
+		return;
+	__libc_lock_lock(maps_index_lock);
+	__maps_index_split(addr);
+	__maps_index_split(ALIGN_UP(addr + len, __getpagesize()));
+	__libc_lock_unlock(maps_index_lock);
+}
+
+static void __maps_index_forget(void) {
+	if (!__maps_index_enabled())
+		return;
+	__libc_lock_lock(maps_index_lock);
+	maps_index_count = 0;
+	__libc_lock_unlock(maps_index_lock);
+}
+
+static int __is_mmaped_indexed(uintptr_t addr) {
+	struct maps_scanner sc;
+	uintptr_t start, end;
+	int res;
+
+	__libc_lock_lock(maps_index_lock);
+	res = __maps_index_lookup(addr);
+	if (res < 0) {
+		res = 0;
+		if (!__maps_open(&sc))
+			goto out;
+		maps_index_count = 0;
+		while (__maps_next(&sc, &start, &end)) {
+			if (start == addr)
 				res = 1;
+			if (!__maps_index_add(start, end)) {
+				maps_index_count = 0;
 				break;
+			}
 		}
+		__close_nocancel_nostatus(sc.fd);
 	}
-	__close_nocancel_nostatus(map);
-	free(buff2);
-	free(cont);
+out:
+	__libc_lock_unlock(maps_index_lock);
 	return res;
 }
+
+static int __is_mmaped(void *addr) {
+	struct maps_scanner sc;
+	uintptr_t start, end;
+	int res = 0;
+
+	if (__maps_index_enabled())
+		return __is_mmaped_indexed((uintptr_t)addr);
+	if (!__maps_open(&sc))
+		return 0;
+	while (__maps_next(&sc, &start, &end) && start <= (uintptr_t)addr)
+		if (start == (uintptr_t)addr) {
+			res = 1;
+			break;
+		}
+	__close_nocancel_nostatus(sc.fd);
+	return res;
+}
+/* - Replacing pages that may not be executed
+   File mappings in the app data directory may not be made executable.
+   Their contents are copied into a memfd, which is mapped MAP_PRIVATE over
+   the same range with the requested protection: the pages stay private
+   and copy-on-write across fork(), as they were, and SELinux allows
+   executing a private file mapping.  The whole range is copied, so code
+   containing NUL bytes survives.  Requests that include PROT_WRITE, stacks
+   and kernels without memfd_create (before 3.17) get private anonymous
+   pages moved into place with mremap instead.  Only mmap_code() maps a
+   memfd shared, as two views of the same pages.
+*/
+static int __remap_memfd(void *addr, size_t size, int prot) {
+	int fd = INLINE_SYSCALL_CALL(memfd_create, "mprotect", MFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = __write_nocancel(fd, (char *)addr + done, size - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	void *res = MAP_FAILED;
+	if (done == size)
+		res = __mmap(addr, size, prot, MAP_PRIVATE|MAP_FIXED, fd, 0);
+	__close_nocancel_nostatus(fd);
+	return res == MAP_FAILED ? -1 : 0;
+}
+
+static int __remap_anonymous(void *addr, size_t size, int flags) {
+	void *copy = __mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|flags, -1, 0);
+	if (copy == MAP_FAILED)
+		return -1;
+	memcpy(copy, addr, size);
+	if (__mremap(copy, size, size, MREMAP_MAYMOVE|MREMAP_FIXED, addr) == MAP_FAILED) {
+		__munmap(copy, size);
+		return -1;
+	}
+	return 0;
+}
+
+/* The pages at addr may not be executed: replace them, unless they are a
+   file mapping, which the kernel was right to refuse.  */
+static int __mprotect_replace(void *addr, size_t len, int prot, unsigned int *site) {
+	if (__is_mmaped(addr)) {
+		*site = SYSCALL_STATS_MPROTECT_REFUSED;
+		__set_errno(EACCES);
+		return -1;
+	}
+	size_t size = ALIGN_UP(len, __getpagesize());
+	/* Nothing is lost by dropping write access here, the final
+	   protection is set below either way.  */
+	INTERNAL_SYSCALL_CALL(mprotect, addr, size, PROT_READ);
+	/* The replacement starts a new mapping at addr.  */
+	__maps_index_forget();
+	*site = SYSCALL_STATS_MPROTECT_MEMFD;
+	if (!(prot & (PROT_WRITE|PROT_GROWSDOWN|PROT_GROWSUP)) && __remap_memfd(addr, size, prot) == 0)
+		return 0;
+	*site = SYSCALL_STATS_MPROTECT_ANONYMOUS;
+	if (__remap_anonymous(addr, size, prot & PROT_GROWSDOWN ? MAP_GROWSDOWN : 0) != 0)
+		return -1;
+	return INLINE_SYSCALL_CALL(mprotect, addr, len, prot);
+}
 #endif
 
 int __mprotect(void *addr, size_t len, int prot) {
 	int res = INLINE_SYSCALL_CALL(mprotect, addr, len, prot);
 #ifdef SHARED
-	if (res == -1 && errno == EACCES && prot & PROT_EXEC && !__is_mmaped(addr)) {
-		size_t saddr = strlen(addr)+1;
-		void *caddr;
-		int mmap_flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED;
-		if (prot & PROT_GROWSDOWN)
-			mmap_flags |= MAP_GROWSDOWN;
-		if (saddr > 1) {
-			caddr = malloc(saddr);
-			memcpy(caddr, addr, saddr);
-		}
-		addr = mmap(addr, len, PROT_READ|PROT_WRITE|PROT_EXEC, mmap_flags, -1, 0);
-		if (saddr > 1) {
-			memcpy(addr, caddr, saddr);
-			free(caddr);
+	if (res == 0)
+		__maps_index_protected((uintptr_t)addr, len);
+	else if (errno == EACCES && prot & PROT_EXEC) {
+		unsigned int site;
+# if IS_IN (libc)
+		/* The counters live in libc, ld.so has its own __mprotect.  */
+		uint64_t start = SYSCALL_STATS_ENABLED() ? __syscall_stats_begin() : 0;
+# endif
+		res = __mprotect_replace(addr, len, prot, &site);
+# if IS_IN (libc)
+		if (SYSCALL_STATS_ENABLED()) {
+			int saved_errno = errno;
+			__syscall_stats_end(site, start, __builtin_return_address(0));
+			__set_errno(saved_errno);
 		}
-		return INLINE_SYSCALL_CALL(mprotect, addr, len, prot);
+# endif
 	}
 #endif
 	return res;
@@ -0,0 +1,133 @@
+#include <sysvipc/shmem-android.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <shlib-compat.h>
+
+/* Open shared memory object NAME.
+
+   Android has no /dev/shm, so named segments are created with the same
+   memfd/ashmem backend as System V shared memory. The name is registered
+   as a symlink in _PATH_TMP pointing to the segment id, other processes
+   fetch the descriptor from the owner over its abstract socket. Every
+   process then maps the very same pages, there is no file in between.
+
+   The owner checks MODE (less the umask) against the peer credentials
+   of every other opener, and hands out a read-only descriptor for
+   O_RDONLY; with the ashmem fallback, which cannot be reopened
+   read-only, O_RDONLY opens fail with EACCES.
+
+   Unlike a /dev/shm file the object lives only as long as the process
+   that created it: once that process exits the name is gone, shm_open
+   fails with ENOENT or, with O_CREAT, creates a new empty object.
+   Descriptors and mappings other processes already hold stay valid.  */
+
+int __shm_open(const char* name, int oflag, mode_t mode) {
+	bool writable = (oflag & O_ACCMODE) == O_RDWR;
+
+	while (name[0] == '/')
+		name++;
+	size_t namelen = strlen(name);
+	if (namelen == 0 || strchr(name, '/') != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (namelen >= NAME_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	ashv_check_pid();
+
+	if (ashv_start_listening_thread() != 0)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	char symlink_path[PATH_MAX];
+	char path_buffer[64];
+	snprintf(symlink_path, sizeof(symlink_path), ASHV_NAME_SYMLINK_PATH, name);
+	int shmid, idx = -1, fd;
+	while (true) {
+		// Same protocol as shmget: a live owner answers for the id
+		// behind the symlink, a dead one gets its entry taken over.
+		int path_length = readlink(symlink_path, path_buffer, sizeof(path_buffer) - 1);
+		if (path_length != -1) {
+			path_buffer[path_length] = '\0';
+			shmid = atoi(path_buffer);
+			fd = -1;
+			if (shmid != 0 && (idx = ashv_find_local_index(shmid)) != -1) {
+				if (!ashv_may_access(&shmem[idx], geteuid(), getegid(), writable)) {
+					pthread_mutex_unlock(&mutex);
+					errno = EACCES;
+					return -1;
+				}
+				fd = 0;
+			} else if (shmid != 0) {
+				// The owner checks our credentials and answers with a
+				// descriptor of the requested access mode.
+				fd = ashv_request_remote(shmid, writable ? ASHV_OP_OPEN_RDWR : ASHV_OP_OPEN_RDONLY, NULL);
+				if (fd == -1 && errno == EACCES) {
+					pthread_mutex_unlock(&mutex);
+					return -1;
+				}
+			}
+			if (fd != -1) {
+				if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) {
+					if (idx == -1)
+						close(fd);
+					pthread_mutex_unlock(&mutex);
+					errno = EEXIST;
+					return -1;
+				}
+				if (idx != -1)
+					fd = ashv_open_descriptor(shmem[idx].descriptor, writable);
+				pthread_mutex_unlock(&mutex);
+				if (fd != -1 && writable && (oflag & O_TRUNC) && ftruncate(fd, 0) != 0) {
+					close(fd);
+					return -1;
+				}
+				return fd;
+			}
+			unlink(symlink_path);
+		}
+
+		if (!(oflag & O_CREAT)) {
+			pthread_mutex_unlock(&mutex);
+			errno = ENOENT;
+			return -1;
+		}
+
+		shmid = ashv_new_shmid();
+		snprintf(path_buffer, sizeof(path_buffer), "%d", shmid);
+		if (symlink(path_buffer, symlink_path) == 0)
+			break;
+		if (errno != EEXIST) {
+			pthread_mutex_unlock(&mutex);
+			return -1;
+		}
+	}
+
+	char buf[ASHMEM_NAME_LEN];
+	snprintf(buf, sizeof(buf), ANDROID_SHMEM_SOCKNAME "-%s", ashv_local_socket_id, name);
+	// Created with size 0, callers ftruncate it like a /dev/shm file.
+	idx = ashv_add_segment(shmid, android_shmem_create_region(buf, 0), 0, IPC_PRIVATE);
+	if (shmem[idx].descriptor < 0) {
+		DBG("%s: android_shmem_create_region() failed for %s: %s\n", __PRETTY_FUNCTION__, name, strerror(errno));
+		shmem_amount--;
+		unlink(symlink_path);
+		pthread_mutex_unlock(&mutex);
+		return -1;
+	}
+	mode_t mask = umask(0);
+	umask(mask);
+	shmem[idx].mode = mode & 0777 & ~mask;
+	fchmod(shmem[idx].descriptor, shmem[idx].mode);
+	fd = ashv_open_descriptor(shmem[idx].descriptor, writable);
+	pthread_mutex_unlock(&mutex);
+
+	return fd;
+}
+
+versioned_symbol(libc, __shm_open, shm_open, GLIBC_2_34);
+#if OTHER_SHLIB_COMPAT(librt, GLIBC_2_2, GLIBC_2_34)
+compat_symbol(libc, __shm_open, shm_open, GLIBC_2_2);
+#endif
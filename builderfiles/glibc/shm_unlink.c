@@ -0,0 +1,65 @@
+#include <sysvipc/shmem-android.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <shlib-compat.h>
+
+/* Remove shared memory object NAME from the shm_open registry.
+
+   Descriptors and mappings that are already open stay valid, like
+   with an unlinked /dev/shm file. The owner drops its reference once
+   nothing of it is mapped locally; another process asks the owner to
+   do so, which only the owner's user (or root) may.  */
+
+int __shm_unlink(const char* name) {
+	while (name[0] == '/')
+		name++;
+	if (name[0] == '\0' || strchr(name, '/') != NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (strlen(name) >= NAME_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	ashv_check_pid();
+
+	char symlink_path[PATH_MAX];
+	char path_buffer[64];
+	snprintf(symlink_path, sizeof(symlink_path), ASHV_NAME_SYMLINK_PATH, name);
+
+	pthread_mutex_lock(&mutex);
+	int path_length = readlink(symlink_path, path_buffer, sizeof(path_buffer) - 1);
+	if (path_length == -1) {
+		pthread_mutex_unlock(&mutex);
+		return -1;
+	}
+	path_buffer[path_length] = '\0';
+
+	int shmid = atoi(path_buffer);
+	int idx = ashv_find_local_index(shmid);
+	if (idx == -1 && shmid != 0
+	    && ashv_request_remote(shmid, ASHV_OP_UNLINK, NULL) == -1 && errno == EACCES) {
+		// A dead owner leaves nothing to free, only a refusal counts.
+		pthread_mutex_unlock(&mutex);
+		return -1;
+	}
+	if (unlink(symlink_path) != 0) {
+		pthread_mutex_unlock(&mutex);
+		return -1;
+	}
+	if (idx != -1) {
+		if (shmem[idx].addr)
+			shmem[idx].markedForDeletion = true;
+		else
+			android_shmem_delete(idx);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return 0;
+}
+
+versioned_symbol(libc, __shm_unlink, shm_unlink, GLIBC_2_34);
+#if OTHER_SHLIB_COMPAT(librt, GLIBC_2_2, GLIBC_2_34)
+compat_symbol(libc, __shm_unlink, shm_unlink, GLIBC_2_2);
+#endif
@@ -4,6 +4,8 @@
  * - shmctl.c
  * - shmdt.c
  * - shmget.c
+ * - shm_open.c
+ * - shm_unlink.c
  *
  * The code was taken from the libandroid-shmem repo:
  * <https://github.com/termux/libandroid-shmem>
@@ -13,6 +15,9 @@
  */
 
 #include <shmem-android.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sysdep.h>
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 shmem_t* shmem = NULL;
@@ -21,6 +26,10 @@ int ashv_local_socket_id = 0;
 int ashv_pid_setup = 0;
 pthread_t ashv_listening_thread_id = 0;
 
+// Counter wrapping around at 15 bits, shared by shmget and shm_open
+// so that both kinds of segments get distinct ids.
+static size_t shmem_counter = 0;
+
 static int ancil_send_fd(int sock, int fd) {
 	char nothing = '!';
 	struct iovec nothing_ptr = { .iov_base = &nothing, .iov_len = 1 };
@@ -82,7 +91,14 @@ static int ancil_recv_fd(int sock) {
 static int ashmem_get_size_region(int fd) {
 	//int ret = __ashmem_is_ashmem(fd, 1);
 	//if (ret < 0) return ret;
-	return TEMP_FAILURE_RETRY(ioctl(fd, ASHMEM_GET_SIZE, NULL));
+	int ret = TEMP_FAILURE_RETRY(ioctl(fd, ASHMEM_GET_SIZE, NULL));
+	if (ret < 0) {
+		// Not an ashmem region (memfd), ask the file itself.
+		struct stat st;
+		if (fstat(fd, &st) != 0) return -1;
+		ret = st.st_size;
+	}
+	return ret;
 }
 
 /*
@@ -114,6 +130,24 @@ error:
 	return ret;
 }
 
+/*
+ * Creates the backing region for a segment. memfd is preferred because
+ * it can be resized with ftruncate (needed by shm_open users), ashmem is
+ * the fallback for kernels without memfd_create.
+ */
+int android_shmem_create_region(char const* name, size_t size) {
+	int fd = INLINE_SYSCALL_CALL(memfd_create, name, MFD_CLOEXEC);
+	if (fd >= 0) {
+		if (size > 0 && ftruncate(fd, size) != 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+	DBG("%s: memfd_create() failed: %s, falling back to ashmem\n", __PRETTY_FUNCTION__, strerror(errno));
+	return ashmem_create_region(name, size);
+}
+
 void ashv_check_pid(void) {
 	pid_t mypid = getpid();
 	if (ashv_pid_setup == 0) {
@@ -139,6 +173,11 @@ int ashv_shmid_from_counter(unsigned int counter) {
 	return ashv_local_socket_id * 0x10000 + counter;
 }
 
+int ashv_new_shmid(void) {
+	shmem_counter = (shmem_counter + 1) & 0x7fff;
+	return ashv_shmid_from_counter(shmem_counter);
+}
+
 int ashv_socket_id_from_shmid(int shmid) {
 	return shmid / 0x10000;
 }
@@ -150,6 +189,83 @@ int ashv_find_local_index(int shmid) {
 	return -1;
 }
 
+/*
+ * Permission check of the shm_open mode bits, like the kernel does for a
+ * file: owner, then group, then other; root may do anything.
+ */
+int ashv_may_access(const shmem_t* segment, uid_t uid, gid_t gid, bool writable) {
+	mode_t want = writable ? 06 : 04;
+	if (uid == 0)
+		return 1;
+	if (uid == segment->uid)
+		return ((segment->mode >> 6) & want) == want;
+	if (gid == segment->gid)
+		return ((segment->mode >> 3) & want) == want;
+	return (segment->mode & want) == want;
+}
+
+/*
+ * Returns a new descriptor for the segment behind DESCRIPTOR, read-write
+ * or read-only. A read-only one is a fresh open of the memfd, so neither
+ * write(2) nor a PROT_WRITE mapping works on it; an ashmem region cannot
+ * be reopened that way and read-only opens of it fail with EACCES.
+ */
+int ashv_open_descriptor(int descriptor, bool writable) {
+	if (writable)
+		return fcntl(descriptor, F_DUPFD_CLOEXEC, 0);
+
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", descriptor);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		errno = EACCES;
+		return -1;
+	}
+	struct stat a, b;
+	if (fstat(fd, &a) != 0 || fstat(descriptor, &b) != 0 || a.st_ino != b.st_ino || a.st_dev != b.st_dev) {
+		// /dev/ashmem reopened is a new, unrelated region.
+		close(fd);
+		errno = EACCES;
+		return -1;
+	}
+	return fd;
+}
+
+// Serves one extended request from PEER, called with the mutex held.
+static void ashv_serve_request(int sock, const struct ashv_request* request, const struct ucred* peer) {
+	struct ashv_reply reply = { .status = 0, .key = IPC_PRIVATE };
+	int fd = -1;
+	int idx = ashv_find_local_index(request->shmid);
+
+	if (idx == -1) {
+		reply.status = ENOENT;
+	} else if (request->op == ASHV_OP_UNLINK) {
+		// Like unlinking from a sticky /dev/shm: owner or root only.
+		if (peer->uid != 0 && peer->uid != shmem[idx].uid) {
+			reply.status = EACCES;
+		} else if (shmem[idx].addr) {
+			shmem[idx].markedForDeletion = true;
+		} else {
+			android_shmem_delete(idx);
+		}
+	} else {
+		bool writable = request->op == ASHV_OP_OPEN_RDWR;
+		reply.key = shmem[idx].key;
+		if (!ashv_may_access(&shmem[idx], peer->uid, peer->gid, writable))
+			reply.status = EACCES;
+		else if ((fd = ashv_open_descriptor(shmem[idx].descriptor, writable)) < 0)
+			reply.status = errno;
+	}
+
+	if (write(sock, &reply, sizeof(reply)) != sizeof(reply)) {
+		DBG("%s: ERROR: write failed: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+	} else if (fd >= 0 && ancil_send_fd(sock, fd) != 0) {
+		DBG("%s: ERROR: ancil_send_fd() failed: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+	}
+	if (fd >= 0)
+		close(fd);
+}
+
 void* ashv_thread_function(void* arg) {
 	int sock = *(int*)arg;
 	free(arg);
@@ -158,23 +274,36 @@ void* ashv_thread_function(void* arg) {
 	int sendsock;
 	DBG("%s: thread started\n", __PRETTY_FUNCTION__);
 	while ((sendsock = accept(sock, (struct sockaddr *)&addr, &len)) != -1) {
-		int shmid;
-		if (recv(sendsock, &shmid, sizeof(shmid), 0) != sizeof(shmid)) {
-			DBG("%s: ERROR: recv() returned not %zu bytes\n", __PRETTY_FUNCTION__, sizeof(shmid));
+		struct ashv_request request;
+		ssize_t n = recv(sendsock, &request, sizeof(request), 0);
+		if (n != sizeof(request) && n != sizeof(request.shmid)) {
+			DBG("%s: ERROR: recv() returned %zd bytes\n", __PRETTY_FUNCTION__, n);
+			close(sendsock);
+			continue;
+		}
+		struct ucred peer;
+		socklen_t peer_len = sizeof(peer);
+		if (getsockopt(sendsock, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) != 0) {
+			DBG("%s: ERROR: SO_PEERCRED failed: %s\n", __PRETTY_FUNCTION__, strerror(errno));
 			close(sendsock);
 			continue;
 		}
 		pthread_mutex_lock(&mutex);
-		int idx = ashv_find_local_index(shmid);
-		if (idx != -1) {
-			if (write(sendsock, &shmem[idx].key, sizeof(key_t)) != sizeof(key_t)) {
-				DBG("%s: ERROR: write failed: %s\n", __PRETTY_FUNCTION__, strerror(errno));
-			}
-			if (ancil_send_fd(sendsock, shmem[idx].descriptor) != 0) {
-				DBG("%s: ERROR: ancil_send_fd() failed: %s\n", __PRETTY_FUNCTION__, strerror(errno));
-			}
+		if (n == sizeof(request)) {
+			ashv_serve_request(sendsock, &request, &peer);
 		} else {
-			DBG("%s: ERROR: cannot find shmid 0x%x\n", __PRETTY_FUNCTION__, shmid);
+			// Original protocol: read-write open, key then descriptor.
+			int idx = ashv_find_local_index(request.shmid);
+			if (idx != -1 && ashv_may_access(&shmem[idx], peer.uid, peer.gid, true)) {
+				if (write(sendsock, &shmem[idx].key, sizeof(key_t)) != sizeof(key_t)) {
+					DBG("%s: ERROR: write failed: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+				}
+				if (ancil_send_fd(sendsock, shmem[idx].descriptor) != 0) {
+					DBG("%s: ERROR: ancil_send_fd() failed: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+				}
+			} else {
+				DBG("%s: ERROR: cannot serve shmid 0x%x\n", __PRETTY_FUNCTION__, request.shmid);
+			}
 		}
 		pthread_mutex_unlock(&mutex);
 		close(sendsock);
@@ -184,20 +313,88 @@ void* ashv_thread_function(void* arg) {
 	return NULL;
 }
 
+/*
+ * Binds the abstract socket other processes use to fetch our segments
+ * and starts the thread serving it. Does nothing if already running.
+ */
+int ashv_start_listening_thread(void) {
+	if (ashv_listening_thread_id)
+		return 0;
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (!sock) {
+		DBG ("%s: cannot create UNIX socket: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+		errno = EINVAL;
+		return -1;
+	}
+	int i;
+	for (i = 0; i < 4096; i++) {
+		struct sockaddr_un addr;
+		int len;
+		memset (&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		ashv_local_socket_id = (getpid() + i) & 0xffff;
+		sprintf(&addr.sun_path[1], ANDROID_SHMEM_SOCKNAME, ashv_local_socket_id);
+		len = sizeof(addr.sun_family) + strlen(&addr.sun_path[1]) + 1;
+		if (bind(sock, (struct sockaddr *)&addr, len) != 0) continue;
+		DBG("%s: bound UNIX socket %s in pid=%d\n", __PRETTY_FUNCTION__, addr.sun_path + 1, getpid());
+		break;
+	}
+	if (i == 4096) {
+		DBG("%s: cannot bind UNIX socket, bailing out\n", __PRETTY_FUNCTION__);
+		ashv_local_socket_id = 0;
+		errno = ENOMEM;
+		return -1;
+	}
+	if (listen(sock, 4) != 0) {
+		DBG("%s: listen failed\n", __PRETTY_FUNCTION__);
+		errno = ENOMEM;
+		return -1;
+	}
+	int* socket_arg = malloc(sizeof(int));
+	*socket_arg = sock;
+	pthread_create(&ashv_listening_thread_id, NULL, &ashv_thread_function, socket_arg);
+	return 0;
+}
+
+// Appends a segment to the local table, returns its index.
+int ashv_add_segment(int shmid, int descriptor, size_t size, key_t key) {
+	int idx = shmem_amount;
+	shmem_amount++;
+	shmem = realloc(shmem, shmem_amount * sizeof(shmem_t));
+	shmem[idx].id = shmid;
+	shmem[idx].descriptor = descriptor;
+	shmem[idx].size = size;
+	shmem[idx].addr = NULL;
+	shmem[idx].markedForDeletion = false;
+	shmem[idx].key = key;
+	// System V segments ignore the shmget mode, anyone may attach.
+	shmem[idx].mode = 0666;
+	shmem[idx].uid = geteuid();
+	shmem[idx].gid = getegid();
+	return idx;
+}
+
 void android_shmem_delete(int idx) {
 	if (shmem[idx].descriptor) close(shmem[idx].descriptor);
 	shmem_amount--;
 	memmove(&shmem[idx], &shmem[idx+1], (shmem_amount - idx) * sizeof(shmem_t));
 }
 
-int ashv_read_remote_segment(int shmid) {
+/*
+ * Sends REQUEST for SHMID to the process owning it. Returns the received
+ * descriptor for opens and 0 for ASHV_OP_UNLINK; -1 on failure with errno
+ * set: the owner's answer (EACCES, ENOENT, ...), or ECONNREFUSED and
+ * friends when nobody owns the id anymore.
+ */
+int ashv_request_remote(int shmid, int op, key_t* key) {
 	struct sockaddr_un addr;
 	memset(&addr, 0, sizeof(addr));
 	addr.sun_family = AF_UNIX;
 	sprintf(&addr.sun_path[1], ANDROID_SHMEM_SOCKNAME, ashv_socket_id_from_shmid(shmid));
 	int addrlen = sizeof(addr.sun_family) + strlen(&addr.sun_path[1]) + 1;
 
-	int recvsock = socket(AF_UNIX, SOCK_STREAM, 0);
+	int recvsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 	if (recvsock == -1) {
 		DBG ("%s: cannot create UNIX socket: %s\n", __PRETTY_FUNCTION__, strerror(errno));
 		return -1;
@@ -208,41 +405,57 @@ int ashv_read_remote_segment(int shmid) {
 		return -1;
 	}
 
-	if (send(recvsock, &shmid, sizeof(shmid), 0) != sizeof(shmid)) {
+	struct ashv_request request = { .shmid = shmid, .op = op };
+	if (send(recvsock, &request, sizeof(request), 0) != sizeof(request)) {
 		DBG ("%s: send() failed on socket %s: %s\n", __PRETTY_FUNCTION__, addr.sun_path + 1, strerror(errno));
 		close(recvsock);
 		return -1;
 	}
 
-	key_t key;
-	if (read(recvsock, &key, sizeof(key_t)) != sizeof(key_t)) {
+	struct ashv_reply reply;
+	if (read(recvsock, &reply, sizeof(reply)) != sizeof(reply)) {
 		DBG("%s: ERROR: failed read\n", __PRETTY_FUNCTION__);
 		close(recvsock);
+		errno = ECONNRESET;
+		return -1;
+	}
+	if (reply.status != 0) {
+		close(recvsock);
+		errno = reply.status;
 		return -1;
 	}
+	if (key)
+		*key = reply.key;
+	if (op == ASHV_OP_UNLINK) {
+		close(recvsock);
+		return 0;
+	}
 
 	int descriptor = ancil_recv_fd(recvsock);
 	if (descriptor < 0) {
 		DBG("%s: ERROR: ancil_recv_fd() failed on socket %s: %s\n", __PRETTY_FUNCTION__, addr.sun_path + 1, strerror(errno));
 		close(recvsock);
+		errno = ECONNRESET;
 		return -1;
 	}
 	close(recvsock);
+	return descriptor;
+}
 
+int ashv_read_remote_segment(int shmid) {
+	key_t key;
+	int descriptor = ashv_request_remote(shmid, ASHV_OP_OPEN_RDWR, &key);
+	if (descriptor < 0)
+		return -1;
+
+	// A zero size is legal for shm_open segments that were not
+	// ftruncate'd yet, only a failed query is an error.
 	int size = ashmem_get_size_region(descriptor);
-	if (size == 0 || size == -1) {
-		DBG ("%s: ERROR: ashmem_get_size_region() returned %d on socket %s: %s\n", __PRETTY_FUNCTION__, size, addr.sun_path + 1, strerror(errno));
+	if (size == -1) {
+		DBG ("%s: ERROR: ashmem_get_size_region() returned %d: %s\n", __PRETTY_FUNCTION__, size, strerror(errno));
+		close(descriptor);
 		return -1;
 	}
 
-	int idx = shmem_amount;
-	shmem_amount ++;
-	shmem = realloc(shmem, shmem_amount * sizeof(shmem_t));
-	shmem[idx].id = shmid;
-	shmem[idx].descriptor = descriptor;
-	shmem[idx].size = size;
-	shmem[idx].addr = NULL;
-	shmem[idx].markedForDeletion = false;
-	shmem[idx].key = key;
-	return idx;
+	return ashv_add_segment(shmid, descriptor, size, key);
 }
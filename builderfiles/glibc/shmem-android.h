@@ -28,6 +28,7 @@
 #define ASHMEM_SET_NAME _IOW(__ASHMEMIOC, 1, char[ASHMEM_NAME_LEN])
 
 #define ASHV_KEY_SYMLINK_PATH _PATH_TMP "ashv_key_%d"
+#define ASHV_NAME_SYMLINK_PATH _PATH_TMP "ashv_name_%s"
 #define ANDROID_SHMEM_SOCKNAME "/dev/shm/%08x"
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 
@@ -38,8 +39,32 @@ typedef struct {
 	size_t size;
 	bool markedForDeletion;
 	key_t key;
+	// Access control for other processes, checked by the owner against
+	// the peer credentials before it hands out the descriptor.
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
 } shmem_t;
 
+// Requests on the per-process socket. A bare int shmid is the original
+// request and still answered with key and descriptor; the extended form
+// below is answered with an ashv_reply first.
+enum {
+	ASHV_OP_OPEN_RDWR,
+	ASHV_OP_OPEN_RDONLY,
+	ASHV_OP_UNLINK,
+};
+
+struct ashv_request {
+	int shmid;
+	int op;
+};
+
+struct ashv_reply {
+	int status;	// 0 or an errno value
+	key_t key;	// a descriptor follows for successful opens
+};
+
 extern pthread_mutex_t mutex;
 extern shmem_t* shmem;
 extern size_t shmem_amount;
@@ -61,6 +86,15 @@ extern pthread_t ashv_listening_thread_id;
 extern int ashmem_create_region(char const* name, size_t size) __THROW;
 libc_hidden_proto(ashmem_create_region)
 
+extern int android_shmem_create_region(char const* name, size_t size) __THROW;
+libc_hidden_proto(android_shmem_create_region)
+
+extern int ashv_start_listening_thread(void) __THROW;
+libc_hidden_proto(ashv_start_listening_thread)
+
+extern int ashv_new_shmid(void) __THROW;
+libc_hidden_proto(ashv_new_shmid)
+
 extern void ashv_check_pid(void) __THROW;
 libc_hidden_proto(ashv_check_pid)
 
@@ -82,4 +116,16 @@ libc_hidden_proto(android_shmem_delete)
 extern int ashv_read_remote_segment(int shmid) __THROW;
 libc_hidden_proto(ashv_read_remote_segment)
 
+extern int ashv_add_segment(int shmid, int descriptor, size_t size, key_t key) __THROW;
+libc_hidden_proto(ashv_add_segment)
+
+extern int ashv_may_access(const shmem_t* segment, uid_t uid, gid_t gid, bool writable) __THROW;
+libc_hidden_proto(ashv_may_access)
+
+extern int ashv_open_descriptor(int descriptor, bool writable) __THROW;
+libc_hidden_proto(ashv_open_descriptor)
+
+extern int ashv_request_remote(int shmid, int op, key_t* key) __THROW;
+libc_hidden_proto(ashv_request_remote)
+
 #endif /* __SHMEM_ANDROID */
@@ -10,44 +10,8 @@ int shmget(key_t key, size_t size, int flags) {
 
 	ashv_check_pid();
 
-	// Counter wrapping around at 15 bits.
-	static size_t shmem_counter = 0;
-
-	if (!ashv_listening_thread_id) {
-		int sock = socket(AF_UNIX, SOCK_STREAM, 0);
-		if (!sock) {
-			DBG ("%s: cannot create UNIX socket: %s\n", __PRETTY_FUNCTION__, strerror(errno));
-			errno = EINVAL;
-			return -1;
-		}
-		int i;
-		for (i = 0; i < 4096; i++) {
-			struct sockaddr_un addr;
-			int len;
-			memset (&addr, 0, sizeof(addr));
-			addr.sun_family = AF_UNIX;
-			ashv_local_socket_id = (getpid() + i) & 0xffff;
-			sprintf(&addr.sun_path[1], ANDROID_SHMEM_SOCKNAME, ashv_local_socket_id);
-			len = sizeof(addr.sun_family) + strlen(&addr.sun_path[1]) + 1;
-			if (bind(sock, (struct sockaddr *)&addr, len) != 0) continue;
-			DBG("%s: bound UNIX socket %s in pid=%d\n", __PRETTY_FUNCTION__, addr.sun_path + 1, getpid());
-			break;
-		}
-		if (i == 4096) {
-			DBG("%s: cannot bind UNIX socket, bailing out\n", __PRETTY_FUNCTION__);
-			ashv_local_socket_id = 0;
-			errno = ENOMEM;
-			return -1;
-		}
-		if (listen(sock, 4) != 0) {
-			DBG("%s: listen failed\n", __PRETTY_FUNCTION__);
-			errno = ENOMEM;
-			return -1;
-		}
-		int* socket_arg = malloc(sizeof(int));
-		*socket_arg = sock;
-		pthread_create(&ashv_listening_thread_id, NULL, &ashv_thread_function, socket_arg);
-	}
+	if (ashv_start_listening_thread() != 0)
+		return -1;
 
 	int shmid = -1;
 
@@ -87,8 +51,7 @@ int shmget(key_t key, size_t size, int flags) {
 			// Take ownership.
 			// TODO: HAndle error (out of resouces, no infinite loop)
 			if (shmid == -1) {
-				shmem_counter = (shmem_counter + 1) & 0x7fff;
-				shmid = ashv_shmid_from_counter(shmem_counter);
+				shmid = ashv_new_shmid();
 				sprintf(num_buffer, "%d", shmid);
 			}
 			if (symlink(num_buffer, symlink_path) == 0) break;
@@ -96,24 +59,14 @@ int shmget(key_t key, size_t size, int flags) {
 	}
 
 
-	int idx = shmem_amount;
 	char buf[256];
-	sprintf(buf, ANDROID_SHMEM_SOCKNAME "-%d", ashv_local_socket_id, idx);
+	sprintf(buf, ANDROID_SHMEM_SOCKNAME "-%d", ashv_local_socket_id, (int) shmem_amount);
 
-	shmem_amount++;
-	if (shmid == -1) {
-		shmem_counter = (shmem_counter + 1) & 0x7fff;
-		shmid = ashv_shmid_from_counter(shmem_counter);
-	}
+	if (shmid == -1)
+		shmid = ashv_new_shmid();
 
-	shmem = realloc(shmem, shmem_amount * sizeof(shmem_t));
 	size = ROUND_UP(size, getpagesize());
-	shmem[idx].size = size;
-	shmem[idx].descriptor = ashmem_create_region(buf, size);
-	shmem[idx].addr = NULL;
-	shmem[idx].id = shmid;
-	shmem[idx].markedForDeletion = false;
-	shmem[idx].key = key;
+	int idx = ashv_add_segment(shmid, android_shmem_create_region(buf, size), size, key);
 
 	if (shmem[idx].descriptor < 0) {
 		DBG("%s: ashmem_create_region() failed for size %zu: %s\n", __PRETTY_FUNCTION__, size, strerror(errno));
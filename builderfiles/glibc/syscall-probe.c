@@ -0,0 +1,298 @@
+/* - Probing emulated syscalls
+   Some syscalls in fakesyscall.json are emulated only because many
+   devices lack them or block them with seccomp. On devices that allow
+   them, syscall() takes the native path instead. Whether they work is
+   probed once per boot, each in a child process, since a seccomp filter
+   may answer with SIGSYS and kill the caller. The child is cloned
+   without an exit signal, so the application never sees a SIGCHLD or a
+   child it did not start.
+
+   The result is kept in a small file in _PATH_VARRUN together with the
+   boot id. Every process maps that file the first time it dispatches one
+   of these syscalls, and only the first process after a reboot probes.
+   Processes of another uid, or under another stack of seccomp filters
+   (Seccomp and Seccomp_filters in /proc/self/status), may be allowed
+   less, so the file name carries all three and each such context
+   probes for itself.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <atomic.h>
+#include <clone_internal.h>
+#include <libc-lock.h>
+#include <not-cancel.h>
+
+#define SYSCALL_PROBE_PATH _PATH_VARRUN "syscall-probe"
+#define SYSCALL_PROBE_MAGIC 0x50435953 /* "SYCP" */
+#define SYSCALL_PROBE_VERSION 2
+#define SYSCALL_PROBE_BOOT_ID_SIZE 40
+/* SYSCALL_PROBE_PATH-<uid>-<seccomp>-<filters>.<pid> */
+#define SYSCALL_PROBE_PATH_MAX (sizeof (SYSCALL_PROBE_PATH) + 4 * 11)
+
+/* What decides which syscalls a process may use.  */
+struct syscall_probe_context {
+	uint32_t uid;
+	uint32_t seccomp;	/* 0 none, 1 strict, 2 filter */
+	uint32_t filters;	/* number of filters installed */
+};
+
+struct syscall_probe_file {
+	uint32_t magic;
+	uint32_t version;
+	char boot_id[SYSCALL_PROBE_BOOT_ID_SIZE];
+	struct syscall_probe_context context;
+	uint32_t native; /* bit i: syscall_probes[i] works */
+};
+
+struct syscall_probe {
+	long int number;
+	/* -1 with errno set on failure, harmless either way.  */
+	long int (*probe) (void);
+};
+
+#ifdef __NR_clone3
+static long int
+probe_clone3 (void) {
+	/* A size below CLONE_ARGS_SIZE_VER0 fails with EINVAL.  */
+	return syscallS (__NR_clone3, NULL, 0);
+}
+#endif
+
+#ifdef __NR_statx
+static long int
+probe_statx (void) {
+	struct statx buf;
+	return syscallS (__NR_statx, AT_FDCWD, "/", 0, STATX_TYPE, &buf);
+}
+#endif
+
+#ifdef __NR_epoll_pwait2
+static long int
+probe_epoll_pwait2 (void) {
+	return syscallS (__NR_epoll_pwait2, -1, NULL, 0, NULL, NULL, 0);
+}
+#endif
+
+#ifdef __NR_faccessat2
+static long int
+probe_faccessat2 (void) {
+	return syscallS (__NR_faccessat2, AT_FDCWD, "/", F_OK, 0);
+}
+#endif
+
+static const struct syscall_probe syscall_probes[] = {
+#ifdef __NR_clone3
+	{ __NR_clone3, probe_clone3 },
+#endif
+#ifdef __NR_statx
+	{ __NR_statx, probe_statx },
+#endif
+#ifdef __NR_epoll_pwait2
+	{ __NR_epoll_pwait2, probe_epoll_pwait2 },
+#endif
+#ifdef __NR_faccessat2
+	{ __NR_faccessat2, probe_faccessat2 },
+#endif
+};
+
+#define SYSCALL_PROBE_COUNT (sizeof (syscall_probes) / sizeof (syscall_probes[0]))
+
+static int syscall_probe_state; /* 0 not loaded, 1 loaded */
+static uint32_t syscall_probe_native;
+__libc_lock_define_initialized (static, syscall_probe_lock)
+
+/* Runs in the child, the exit status is the answer.  */
+static int
+syscall_probe_child (void *arg) {
+	const struct syscall_probe *probe = arg;
+	if (probe->probe () == -1 && (errno == ENOSYS || errno == EPERM))
+		return 1;
+	return 0;
+}
+
+static int
+syscall_probe_run (const struct syscall_probe *probe) {
+	static char stack[16384] __attribute__ ((aligned (16)));
+	struct clone_args args = {
+		.exit_signal = 0,
+		.stack = (uintptr_t) stack,
+		.stack_size = sizeof (stack),
+	};
+	int status;
+
+	pid_t pid = __clone_internal (&args, syscall_probe_child, (void *) probe);
+	if (pid == -1)
+		return 0;
+	while (__waitpid (pid, &status, __WCLONE) == -1)
+		if (errno != EINTR)
+			return 0;
+	/* Killed (SIGSYS) or failed: keep emulating.  */
+	return WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+static void
+syscall_probe_boot_id (char *boot_id) {
+	memset (boot_id, 0, SYSCALL_PROBE_BOOT_ID_SIZE);
+	int fd = __open_nocancel ("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		__read_nocancel (fd, boot_id, SYSCALL_PROBE_BOOT_ID_SIZE - 1);
+		__close_nocancel_nostatus (fd);
+	}
+}
+
+/* Reads the decimal number after FIELD in /proc/self/status, 0 if the
+   kernel does not report it.  */
+static uint32_t
+syscall_probe_status_field (const char *status, const char *field) {
+	const char *p = strstr (status, field);
+	uint32_t value = 0;
+	if (p == NULL)
+		return 0;
+	for (p += strlen (field); *p == '\t' || *p == ' '; p++)
+		;
+	for (; *p >= '0' && *p <= '9'; p++)
+		value = value * 10 + (*p - '0');
+	return value;
+}
+
+static void
+syscall_probe_context (struct syscall_probe_context *context) {
+	char status[4096];
+	size_t len = 0;
+	ssize_t n;
+
+	memset (context, 0, sizeof (*context));
+	context->uid = __getuid ();
+	int fd = __open_nocancel ("/proc/self/status", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	while (len < sizeof (status) - 1
+	       && (n = __read_nocancel (fd, status + len, sizeof (status) - 1 - len)) > 0)
+		len += n;
+	__close_nocancel_nostatus (fd);
+	status[len] = '\0';
+	context->seccomp = syscall_probe_status_field (status, "\nSeccomp:");
+	context->filters = syscall_probe_status_field (status, "\nSeccomp_filters:");
+}
+
+static char *
+syscall_probe_append_uint (char *p, uint32_t value) {
+	char digits[10];
+	int n = 0;
+	do
+		digits[n++] = '0' + value % 10;
+	while ((value /= 10) != 0);
+	while (n > 0)
+		*p++ = digits[--n];
+	return p;
+}
+
+/* Builds the file name for CONTEXT.  */
+static void
+syscall_probe_path (char *path, const struct syscall_probe_context *context) {
+	char *p = path + sizeof (SYSCALL_PROBE_PATH) - 1;
+	memcpy (path, SYSCALL_PROBE_PATH, sizeof (SYSCALL_PROBE_PATH) - 1);
+	*p++ = '-';
+	p = syscall_probe_append_uint (p, context->uid);
+	*p++ = '-';
+	p = syscall_probe_append_uint (p, context->seccomp);
+	*p++ = '-';
+	p = syscall_probe_append_uint (p, context->filters);
+	*p = '\0';
+}
+
+static int
+syscall_probe_map (const char *path, const char *boot_id,
+		   const struct syscall_probe_context *context, uint32_t *native) {
+	int fd = __open_nocancel (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	const struct syscall_probe_file *file = __mmap (NULL, sizeof (*file), PROT_READ, MAP_SHARED, fd, 0);
+	struct __stat64_t64 st;
+	int ok = file != MAP_FAILED && __fstat64_time64 (fd, &st) == 0 && st.st_size >= (off_t) sizeof (*file);
+	__close_nocancel_nostatus (fd);
+	if (file == MAP_FAILED)
+		return 0;
+	ok = ok && file->magic == SYSCALL_PROBE_MAGIC && file->version == SYSCALL_PROBE_VERSION
+		&& memcmp (file->boot_id, boot_id, SYSCALL_PROBE_BOOT_ID_SIZE) == 0
+		&& memcmp (&file->context, context, sizeof (*context)) == 0;
+	if (ok)
+		*native = file->native;
+	__munmap ((void *) file, sizeof (*file));
+	return ok;
+}
+
+/* Written to a per-process name and renamed, readers see either the old
+   or the new file.  */
+static void
+syscall_probe_save (const char *path, const char *boot_id,
+		    const struct syscall_probe_context *context, uint32_t native) {
+	struct syscall_probe_file file = {
+		.magic = SYSCALL_PROBE_MAGIC,
+		.version = SYSCALL_PROBE_VERSION,
+		.context = *context,
+		.native = native,
+	};
+	char tmp_path[SYSCALL_PROBE_PATH_MAX];
+	size_t len = strlen (path);
+
+	memcpy (file.boot_id, boot_id, SYSCALL_PROBE_BOOT_ID_SIZE);
+	memcpy (tmp_path, path, len);
+	tmp_path[len] = '.';
+	*syscall_probe_append_uint (tmp_path + len + 1, __getpid ()) = '\0';
+
+	int fd = __open_nocancel (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	int ok = __write_nocancel (fd, &file, sizeof (file)) == sizeof (file);
+	__close_nocancel_nostatus (fd);
+	if (!ok || rename (tmp_path, path) != 0)
+		unlink (tmp_path);
+}
+
+static uint32_t
+syscall_probe_load (void) {
+	char boot_id[SYSCALL_PROBE_BOOT_ID_SIZE];
+	char path[SYSCALL_PROBE_PATH_MAX];
+	struct syscall_probe_context context;
+	uint32_t native = 0;
+
+	__libc_lock_lock (syscall_probe_lock);
+	if (atomic_load_relaxed (&syscall_probe_state) == 0) {
+		syscall_probe_boot_id (boot_id);
+		syscall_probe_context (&context);
+		syscall_probe_path (path, &context);
+		if (!syscall_probe_map (path, boot_id, &context, &native)) {
+			for (size_t i = 0; i < SYSCALL_PROBE_COUNT; i++)
+				if (syscall_probe_run (&syscall_probes[i]))
+					native |= 1U << i;
+			syscall_probe_save (path, boot_id, &context, native);
+		}
+		syscall_probe_native = native;
+		atomic_store_release (&syscall_probe_state, 1);
+	}
+	__libc_lock_unlock (syscall_probe_lock);
+	return syscall_probe_native;
+}
+
+/* Whether an emulated syscall works natively on this device.  */
+static int
+syscall_probe_is_native (long int number) {
+	for (size_t i = 0; i < SYSCALL_PROBE_COUNT; i++)
+		if (syscall_probes[i].number == number) {
+			uint32_t native = atomic_load_acquire (&syscall_probe_state) != 0
+				? syscall_probe_native : syscall_probe_load ();
+			return (native >> i) & 1;
+		}
+	return 0;
+}
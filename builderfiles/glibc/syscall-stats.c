@@ -0,0 +1,430 @@
+/* - Counting emulated syscalls
+   The counters behind syscall-stats.h.  Included by syscall.c, which has
+   fake_syscall_table and the names of its entries.  Each thread counts
+   into its own block, so recording a call takes no lock and no atomic;
+   the dump adds the blocks up without stopping anybody, and a count that
+   is one behind in a snapshot does not matter.  Blocks of threads that
+   have exited stay in the list, their calls still count, and are handed
+   to the next thread that needs one: a thread key destructor marks them
+   free, so a program that keeps starting threads reuses a few blocks
+   instead of mapping one per thread.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <atomic.h>
+#include <libc-lock.h>
+#include <not-cancel.h>
+#include <register-atfork.h>
+#include <pthreadP.h>
+#include "syscall-stats.h"
+
+#define SYSCALL_STATS_SITES \
+	(SYSCALL_STATS_SYSCALL + sizeof (fake_syscall_table) / sizeof (fake_syscall_table[0]))
+/* Bucket i holds calls that took from 2^i to 2^(i+1) ns.  */
+#define SYSCALL_STATS_BUCKETS 32
+#define SYSCALL_STATS_CALLERS 64
+#define SYSCALL_STATS_DIR_SIZE 256
+
+struct syscall_stats_site {
+	uint64_t count;
+	uint64_t ns;
+	uint32_t hist[SYSCALL_STATS_BUCKETS];
+};
+
+struct syscall_stats_caller {
+	uintptr_t pc;
+	uint32_t site; /* site + 1, 0 is a free slot */
+	uint32_t count;
+};
+
+/* Mapped with room for every site, but only the pages of sites that were
+   used are ever touched.  */
+struct syscall_stats_thread {
+	struct syscall_stats_thread *next;
+	int in_use; /* 0 once its thread has exited */
+	uint32_t dropped_callers;
+	struct syscall_stats_caller callers[SYSCALL_STATS_CALLERS];
+	struct syscall_stats_site sites[SYSCALL_STATS_SITES];
+};
+
+int __syscall_stats_mode = SYSCALL_STATS_UNKNOWN;
+static struct syscall_stats_thread *syscall_stats_threads;
+static __thread struct syscall_stats_thread *syscall_stats_self;
+static pthread_key_t syscall_stats_key;
+static int syscall_stats_key_ok;
+static char syscall_stats_dir[SYSCALL_STATS_DIR_SIZE];
+static int syscall_stats_dumping;
+__libc_lock_define_initialized (static, syscall_stats_lock)
+
+static const char *const syscall_stats_mode_names[] = {
+	[SYSCALL_STATS_COUNT] = "count",
+	[SYSCALL_STATS_LATENCY] = "latency",
+};
+
+static uint64_t
+syscall_stats_now (void) {
+	struct __timespec64 ts;
+	__clock_gettime64 (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char *
+syscall_stats_site_name (unsigned int site) {
+	switch (site) {
+	case SYSCALL_STATS_MPROTECT_MEMFD:
+		return "mprotect-memfd";
+	case SYSCALL_STATS_MPROTECT_ANONYMOUS:
+		return "mprotect-anonymous";
+	case SYSCALL_STATS_MPROTECT_REFUSED:
+		return "mprotect-refused";
+	}
+	return fake_syscall_names[site - SYSCALL_STATS_SYSCALL];
+}
+
+/* - Writing the dump
+   One record per line, fields separated by spaces:
+     syscall-stats 1 <pid> <mode> <program>
+     site <name> <count> <ns> [<bucket 0>,<bucket 1>,...]
+     caller <name> <pc> <count>
+     dropped <callers that did not fit>
+     map <line of /proc/self/maps>
+   Only executable mappings are listed, syscallstats uses them to turn
+   caller addresses into file offsets.  Runs in a signal handler as well,
+   so it formats numbers itself and only uses open, read and write.
+*/
+struct syscall_stats_out {
+	int fd;
+	size_t len;
+	char buf[1024];
+};
+
+static void
+syscall_stats_flush (struct syscall_stats_out *out) {
+	if (out->len > 0)
+		__write_nocancel (out->fd, out->buf, out->len);
+	out->len = 0;
+}
+
+static void
+syscall_stats_put (struct syscall_stats_out *out, const char *s) {
+	for (; *s != '\0'; s++) {
+		if (out->len == sizeof (out->buf))
+			syscall_stats_flush (out);
+		out->buf[out->len++] = *s;
+	}
+}
+
+static void
+syscall_stats_put_uint (struct syscall_stats_out *out, const char *prefix,
+			uint64_t value, unsigned int base) {
+	char digits[24];
+	char *p = digits + sizeof (digits);
+	*--p = '\0';
+	do
+		*--p = "0123456789abcdef"[value % base];
+	while ((value /= base) != 0);
+	syscall_stats_put (out, prefix);
+	if (base == 16)
+		syscall_stats_put (out, "0x");
+	syscall_stats_put (out, p);
+}
+
+static void
+syscall_stats_dump_maps (struct syscall_stats_out *out) {
+	char buf[512], line[512];
+	size_t len = 0;
+	ssize_t n;
+
+	int fd = __open_nocancel ("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	while ((n = __read_nocancel (fd, buf, sizeof (buf))) > 0)
+		for (ssize_t i = 0; i < n; i++) {
+			if (buf[i] != '\n') {
+				if (len < sizeof (line) - 1)
+					line[len++] = buf[i];
+				continue;
+			}
+			line[len] = '\0';
+			len = 0;
+			/* "start-end perms ...", perms is "r-xp" for code.  */
+			const char *perms = strchr (line, ' ');
+			if (perms != NULL && strlen (perms) > 4 && perms[3] == 'x') {
+				syscall_stats_put (out, "map ");
+				syscall_stats_put (out, line);
+				syscall_stats_put (out, "\n");
+			}
+		}
+	__close_nocancel_nostatus (fd);
+}
+
+static void
+syscall_stats_dump_sites (struct syscall_stats_out *out, int mode) {
+	struct syscall_stats_thread *threads = atomic_load_acquire (&syscall_stats_threads);
+
+	for (unsigned int site = 0; site < SYSCALL_STATS_SITES; site++) {
+		struct syscall_stats_site sum = { 0 };
+		for (struct syscall_stats_thread *t = threads; t != NULL; t = t->next) {
+			sum.count += t->sites[site].count;
+			sum.ns += t->sites[site].ns;
+			if (mode == SYSCALL_STATS_LATENCY)
+				for (int i = 0; i < SYSCALL_STATS_BUCKETS; i++)
+					sum.hist[i] += t->sites[site].hist[i];
+		}
+		if (sum.count == 0)
+			continue;
+		syscall_stats_put (out, "site ");
+		syscall_stats_put (out, syscall_stats_site_name (site));
+		syscall_stats_put_uint (out, " ", sum.count, 10);
+		syscall_stats_put_uint (out, " ", sum.ns, 10);
+		if (mode == SYSCALL_STATS_LATENCY) {
+			int last = SYSCALL_STATS_BUCKETS - 1;
+			while (last > 0 && sum.hist[last] == 0)
+				last--;
+			for (int i = 0; i <= last; i++)
+				syscall_stats_put_uint (out, i == 0 ? " " : ",", sum.hist[i], 10);
+		}
+		syscall_stats_put (out, "\n");
+	}
+
+	uint64_t dropped = 0;
+	for (struct syscall_stats_thread *t = threads; t != NULL; t = t->next) {
+		for (int i = 0; i < SYSCALL_STATS_CALLERS; i++) {
+			const struct syscall_stats_caller *c = &t->callers[i];
+			if (c->site == 0 || c->count == 0)
+				continue;
+			syscall_stats_put (out, "caller ");
+			syscall_stats_put (out, syscall_stats_site_name (c->site - 1));
+			syscall_stats_put_uint (out, " ", c->pc, 16);
+			syscall_stats_put_uint (out, " ", c->count, 10);
+			syscall_stats_put (out, "\n");
+		}
+		dropped += t->dropped_callers;
+	}
+	if (dropped != 0) {
+		syscall_stats_put_uint (out, "dropped ", dropped, 10);
+		syscall_stats_put (out, "\n");
+	}
+}
+
+/* Written to a temporary name and renamed, so a reader never sees half a
+   dump.  A dump that starts while another one is running is skipped.  */
+static void
+syscall_stats_dump (void) {
+	int mode = atomic_load_relaxed (&__syscall_stats_mode);
+	if ((mode != SYSCALL_STATS_COUNT && mode != SYSCALL_STATS_LATENCY)
+	    || atomic_exchange_acquire (&syscall_stats_dumping, 1) != 0)
+		return;
+
+	int saved_errno = errno;
+	struct syscall_stats_out out = { .len = 0 };
+	char path[SYSCALL_STATS_DIR_SIZE + 32], tmp_path[SYSCALL_STATS_DIR_SIZE + 40];
+	pid_t pid = __getpid ();
+
+	out.fd = -1;
+	syscall_stats_put (&out, syscall_stats_dir);
+	syscall_stats_put_uint (&out, "syscall-stats.", pid, 10);
+	memcpy (path, out.buf, out.len);
+	path[out.len] = '\0';
+	syscall_stats_put (&out, ".tmp");
+	memcpy (tmp_path, out.buf, out.len);
+	tmp_path[out.len] = '\0';
+	out.len = 0;
+
+	out.fd = __open_nocancel (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out.fd >= 0) {
+		syscall_stats_put_uint (&out, "syscall-stats 1 ", pid, 10);
+		syscall_stats_put (&out, " ");
+		syscall_stats_put (&out, syscall_stats_mode_names[mode]);
+		syscall_stats_put (&out, " ");
+		syscall_stats_put (&out, program_invocation_short_name);
+		syscall_stats_put (&out, "\n");
+		syscall_stats_dump_sites (&out, mode);
+		syscall_stats_dump_maps (&out);
+		syscall_stats_flush (&out);
+		__close_nocancel_nostatus (out.fd);
+		if (rename (tmp_path, path) != 0)
+			unlink (tmp_path);
+	}
+
+	__set_errno (saved_errno);
+	atomic_store_release (&syscall_stats_dumping, 0);
+}
+
+static void
+syscall_stats_dump_at_exit (void *arg) {
+	syscall_stats_dump ();
+}
+
+static void
+syscall_stats_signal (int sig) {
+	syscall_stats_dump ();
+}
+
+/* Only the forking thread lives on in the child, and what was counted
+   before the fork belongs to the parent.  */
+static void
+syscall_stats_fork_child (void) {
+	struct syscall_stats_thread *t = syscall_stats_threads;
+	while (t != NULL) {
+		struct syscall_stats_thread *next = t->next;
+		__munmap (t, sizeof (*t));
+		t = next;
+	}
+	syscall_stats_threads = NULL;
+	syscall_stats_self = NULL;
+	syscall_stats_dumping = 0;
+	/* The block it pointed to is gone, nothing to release at exit.  */
+	if (syscall_stats_key_ok)
+		__pthread_setspecific (syscall_stats_key, NULL);
+}
+
+/* The thread key destructor: the block goes back for the next thread.  */
+static void
+syscall_stats_thread_exit (void *arg) {
+	struct syscall_stats_thread *self = arg;
+	syscall_stats_self = NULL;
+	atomic_store_release (&self->in_use, 0);
+}
+
+/* SYSCALL_STATS=latency adds the histograms, any other value but 0 only
+   counts.  The handler for SYSCALL_STATS_SIGNAL is installed here, on the
+   first emulated call, so a signal that is ignored by default (SIGURG,
+   SIGWINCH) is the safe choice for processes that may get it earlier.  */
+static int
+syscall_stats_init (void) {
+	__libc_lock_lock (syscall_stats_lock);
+	int mode = __syscall_stats_mode;
+	if (mode == SYSCALL_STATS_UNKNOWN) {
+		const char *env = getenv ("SYSCALL_STATS");
+		if (env == NULL || env[0] == '\0' || strcmp (env, "0") == 0)
+			mode = SYSCALL_STATS_OFF;
+		else if (strcmp (env, "latency") == 0)
+			mode = SYSCALL_STATS_LATENCY;
+		else
+			mode = SYSCALL_STATS_COUNT;
+
+		if (mode != SYSCALL_STATS_OFF) {
+			env = getenv ("SYSCALL_STATS_DIR");
+			if (env == NULL || env[0] == '\0' || strlen (env) > SYSCALL_STATS_DIR_SIZE - 2)
+				env = _PATH_TMP;
+			size_t len = strlen (env);
+			memcpy (syscall_stats_dir, env, len);
+			if (syscall_stats_dir[len - 1] != '/')
+				syscall_stats_dir[len++] = '/';
+			syscall_stats_dir[len] = '\0';
+
+			__register_atfork (NULL, NULL, syscall_stats_fork_child, NULL);
+			__cxa_atexit (syscall_stats_dump_at_exit, NULL, NULL);
+			syscall_stats_key_ok = __pthread_key_create (&syscall_stats_key,
+								     syscall_stats_thread_exit) == 0;
+
+			env = getenv ("SYSCALL_STATS_SIGNAL");
+			int sig = env != NULL ? atoi (env) : 0;
+			if (sig > 0 && sig < _NSIG) {
+				struct sigaction sa = { .sa_handler = syscall_stats_signal, .sa_flags = SA_RESTART };
+				__sigaction (sig, &sa, NULL);
+			}
+		}
+		atomic_store_relaxed (&__syscall_stats_mode, mode);
+	}
+	__libc_lock_unlock (syscall_stats_lock);
+	return mode;
+}
+
+static struct syscall_stats_thread *
+syscall_stats_thread (void) {
+	struct syscall_stats_thread *self = syscall_stats_self;
+	if (self != NULL)
+		return self;
+
+	/* A block whose thread has exited, if there is one.  Without the
+	   key nothing is ever freed, don't bother looking.  */
+	if (syscall_stats_key_ok)
+		for (self = atomic_load_acquire (&syscall_stats_threads); self != NULL; self = self->next) {
+			int expected = 0;
+			if (atomic_load_relaxed (&self->in_use) == 0
+			    && atomic_compare_exchange_weak_acquire (&self->in_use, &expected, 1))
+				break;
+		}
+	if (self == NULL) {
+		self = __mmap (NULL, sizeof (*self), PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (self == MAP_FAILED)
+			return NULL;
+		self->in_use = 1;
+		self->next = atomic_load_relaxed (&syscall_stats_threads);
+		while (!atomic_compare_exchange_weak_release (&syscall_stats_threads, &self->next, self))
+			;
+	}
+	if (syscall_stats_key_ok)
+		__pthread_setspecific (syscall_stats_key, self);
+	syscall_stats_self = self;
+	return self;
+}
+
+static void
+syscall_stats_add_caller (struct syscall_stats_thread *self, unsigned int site, uintptr_t pc) {
+	unsigned int i = ((pc >> 2) ^ site * 2654435761u) % SYSCALL_STATS_CALLERS;
+	for (int n = 0; n < SYSCALL_STATS_CALLERS; n++, i = (i + 1) % SYSCALL_STATS_CALLERS) {
+		struct syscall_stats_caller *c = &self->callers[i];
+		if (c->site == 0) {
+			c->pc = pc;
+			c->site = site + 1;
+		}
+		if (c->site == site + 1 && c->pc == pc) {
+			c->count++;
+			return;
+		}
+	}
+	self->dropped_callers++;
+}
+
+uint64_t
+__syscall_stats_begin (void) {
+	int mode = atomic_load_relaxed (&__syscall_stats_mode);
+	if (mode == SYSCALL_STATS_UNKNOWN)
+		mode = syscall_stats_init ();
+	return mode == SYSCALL_STATS_LATENCY ? syscall_stats_now () : 0;
+}
+
+void
+__syscall_stats_end (unsigned int site, uint64_t start, const void *caller) {
+	int mode = atomic_load_relaxed (&__syscall_stats_mode);
+	if (mode != SYSCALL_STATS_COUNT && mode != SYSCALL_STATS_LATENCY)
+		return;
+	struct syscall_stats_thread *self = syscall_stats_thread ();
+	if (self == NULL || site >= SYSCALL_STATS_SITES)
+		return;
+
+	struct syscall_stats_site *s = &self->sites[site];
+	s->count++;
+	if (mode == SYSCALL_STATS_LATENCY) {
+		uint64_t ns = syscall_stats_now () - start;
+		unsigned int bucket = ns > 1 ? 63 - __builtin_clzll (ns) : 0;
+		s->ns += ns;
+		s->hist[bucket < SYSCALL_STATS_BUCKETS ? bucket : SYSCALL_STATS_BUCKETS - 1]++;
+	}
+	syscall_stats_add_caller (self, site, (uintptr_t) caller);
+}
+
+/* Runs a fake handler of syscall() and counts it.  */
+static long int
+syscall_stats_call (long int number, fake_syscall_handler handler,
+		    const void *caller, long int a0, long int a1, long int a2,
+		    long int a3, long int a4, long int a5) {
+	uint64_t start = __syscall_stats_begin ();
+	long int res = handler (a0, a1, a2, a3, a4, a5);
+	int saved_errno = errno;
+	__syscall_stats_end (SYSCALL_STATS_SYSCALL + number, start, caller);
+	__set_errno (saved_errno);
+	return res;
+}
@@ -0,0 +1,45 @@
+/* - Telemetry of emulated syscalls
+   With SYSCALL_STATS set in the environment, every call that syscall()
+   hands to a fake handler and every mprotect(PROT_EXEC) the kernel
+   refused is counted per thread, together with its callers and,
+   with SYSCALL_STATS=latency, a histogram of how long it took.  The
+   counts are written to SYSCALL_STATS_DIR (default _PATH_TMP) as
+   syscall-stats.<pid> at exit, and whenever the signal given in
+   SYSCALL_STATS_SIGNAL arrives.  The syscallstats tool adds up the files
+   of a whole run.
+
+   When disabled, a call site costs one load and one branch that is never
+   taken.
+*/
+
+#ifndef _SYSCALL_STATS_H
+#define _SYSCALL_STATS_H
+
+#include <stdint.h>
+
+#define SYSCALL_STATS_OFF 0
+#define SYSCALL_STATS_COUNT 1
+#define SYSCALL_STATS_LATENCY 2
+#define SYSCALL_STATS_UNKNOWN 3
+
+/* Sites that are not syscall() dispatches, syscall N is site
+   SYSCALL_STATS_SYSCALL + N.  */
+enum {
+	SYSCALL_STATS_MPROTECT_MEMFD,
+	SYSCALL_STATS_MPROTECT_ANONYMOUS,
+	SYSCALL_STATS_MPROTECT_REFUSED,
+	SYSCALL_STATS_SYSCALL
+};
+
+extern int __syscall_stats_mode attribute_hidden;
+
+/* Reads the environment on the first call.  Returns the start time in
+   latency mode, 0 otherwise.  */
+extern uint64_t __syscall_stats_begin (void) attribute_hidden;
+extern void __syscall_stats_end (unsigned int site, uint64_t start,
+				 const void *caller) attribute_hidden;
+
+#define SYSCALL_STATS_ENABLED() \
+	__glibc_unlikely (__syscall_stats_mode != SYSCALL_STATS_OFF)
+
+#endif /* _SYSCALL_STATS_H */
@@ -1,5 +1,6 @@
 #ifndef WITHOUT_FAKESYSCALL
 # include <fakesyscall-base.h>
+# include "syscall-stats.c"
 #else
 # include <unistd.h>
 #endif
@@ -19,13 +20,21 @@ syscall (long int number, ...)
   va_end (args);
 
 #ifndef WITHOUT_FAKESYSCALL
-  switch (number)
+  /* Syscalls without an entry go to the kernel, and so do emulated ones
+     that turned out to work on this device.  */
+  if ((unsigned long int) number
+      < sizeof (fake_syscall_table) / sizeof (fake_syscall_table[0]))
+    {
+      fake_syscall_handler handler = fake_syscall_table[number];
+      if (handler != NULL && !syscall_probe_is_native (number))
+	{
+	  if (SYSCALL_STATS_ENABLED ())
+	    return syscall_stats_call (number, handler,
+				       __builtin_return_address (0),
+				       a0, a1, a2, a3, a4, a5);
+	  return handler (a0, a1, a2, a3, a4, a5);
+	}
+    }
 #endif
-  {
-#ifndef WITHOUT_FAKESYSCALL
-    DISABLED_SYSCALL_WITH_FAKESYSCALL
-    default:
-#endif
-      return syscallS (number, a0, a1, a2, a3, a4, a5);
-  }
+  return syscallS (number, a0, a1, a2, a3, a4, a5);
 }
@@ -0,0 +1,274 @@
+/* syscallstats - add up the dumps written by libc with SYSCALL_STATS set
+ * (see syscall-stats.h) and print which emulated syscalls were used, how
+ * often, how long they took and from where.
+ *
+ * Usage: syscallstats [-n callers] [file|dir...]
+ *   -n callers  how many of the busiest callers to list (default 20)
+ *
+ * Directories are searched for syscall-stats.<pid> files, the default is
+ * the directory libc writes to. Callers are shown as file+offset, so the
+ * same call site adds up across processes and can be fed to addr2line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifndef SYSCALL_STATS_DIR
+#define SYSCALL_STATS_DIR "/tmp"
+#endif
+
+#define BUCKETS 32
+
+struct site_total {
+	char* name;
+	uint64_t count;
+	uint64_t ns;
+	uint64_t hist[BUCKETS];
+	unsigned processes;
+};
+
+struct caller_total {
+	char* site;
+	char* where;
+	uint64_t count;
+};
+
+struct map {
+	uintptr_t start, end, offset;
+	char* path;
+};
+
+static struct site_total* sites;
+static size_t site_count, site_size;
+static struct caller_total* callers;
+static size_t caller_count, caller_size;
+static bool latency;
+static unsigned files;
+
+static void* xrealloc(void* ptr, size_t size) {
+	ptr = realloc(ptr, size);
+	if (ptr == NULL) {
+		perror("syscallstats");
+		exit(1);
+	}
+	return ptr;
+}
+
+static struct site_total* find_site(const char* name) {
+	for (size_t i = 0; i < site_count; i++)
+		if (strcmp(sites[i].name, name) == 0)
+			return &sites[i];
+	if (site_count == site_size) {
+		site_size = site_size ? 2 * site_size : 64;
+		sites = xrealloc(sites, site_size * sizeof(*sites));
+	}
+	struct site_total* site = &sites[site_count++];
+	memset(site, 0, sizeof(*site));
+	site->name = strdup(name);
+	return site;
+}
+
+static void add_caller(const char* site, const char* where, uint64_t count) {
+	for (size_t i = 0; i < caller_count; i++)
+		if (strcmp(callers[i].site, site) == 0 && strcmp(callers[i].where, where) == 0) {
+			callers[i].count += count;
+			return;
+		}
+	if (caller_count == caller_size) {
+		caller_size = caller_size ? 2 * caller_size : 64;
+		callers = xrealloc(callers, caller_size * sizeof(*callers));
+	}
+	callers[caller_count].site = strdup(site);
+	callers[caller_count].where = strdup(where);
+	callers[caller_count].count = count;
+	caller_count++;
+}
+
+// Callers are only resolved once the whole dump, maps included, is read.
+struct pending_caller {
+	char site[64];
+	uintptr_t pc;
+	uint64_t count;
+};
+
+static void read_dump(const char* path) {
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		perror(path);
+		return;
+	}
+
+	char* line = NULL;
+	size_t line_size = 0;
+	struct pending_caller* pending = NULL;
+	size_t pending_count = 0;
+	struct map* maps = NULL;
+	size_t map_count = 0;
+	bool valid = false;
+
+	while (getline(&line, &line_size, file) != -1) {
+		line[strcspn(line, "\n")] = '\0';
+		char name[64], mode[16];
+		uint64_t count, ns;
+		uintptr_t pc;
+		int used;
+
+		if (!valid) {
+			if (sscanf(line, "syscall-stats 1 %*u %15s", mode) != 1)
+				break;
+			valid = true;
+			latency |= strcmp(mode, "latency") == 0;
+		} else if (sscanf(line, "site %63s %" SCNu64 " %" SCNu64 "%n", name, &count, &ns, &used) == 3) {
+			struct site_total* site = find_site(name);
+			site->count += count;
+			site->ns += ns;
+			site->processes++;
+			char* hist = line + used;
+			for (int i = 0; i < BUCKETS && *hist != '\0'; i++)
+				site->hist[i] += strtoull(hist + 1, &hist, 10);
+		} else if (sscanf(line, "caller %63s %" SCNxPTR " %" SCNu64, name, &pc, &count) == 3) {
+			pending = xrealloc(pending, (pending_count + 1) * sizeof(*pending));
+			strcpy(pending[pending_count].site, name);
+			pending[pending_count].pc = pc;
+			pending[pending_count].count = count;
+			pending_count++;
+		} else if (strncmp(line, "map ", 4) == 0) {
+			struct map map;
+			if (sscanf(line, "map %" SCNxPTR "-%" SCNxPTR " %*s %" SCNxPTR " %*s %*s %n",
+					&map.start, &map.end, &map.offset, &used) != 3)
+				continue;
+			map.path = strdup(line + used);
+			maps = xrealloc(maps, (map_count + 1) * sizeof(*maps));
+			maps[map_count++] = map;
+		}
+	}
+	if (valid)
+		files++;
+	else
+		fprintf(stderr, "%s: not a syscall-stats dump\n", path);
+
+	for (size_t i = 0; i < pending_count; i++) {
+		char where[4096];
+		snprintf(where, sizeof(where), "0x%" PRIxPTR, pending[i].pc);
+		for (size_t j = 0; j < map_count; j++)
+			if (pending[i].pc >= maps[j].start && pending[i].pc < maps[j].end) {
+				snprintf(where, sizeof(where), "%s+0x%" PRIxPTR,
+						maps[j].path[0] != '\0' ? maps[j].path : "[anon]",
+						pending[i].pc - maps[j].start + maps[j].offset);
+				break;
+			}
+		add_caller(pending[i].site, where, pending[i].count);
+	}
+
+	for (size_t i = 0; i < map_count; i++)
+		free(maps[i].path);
+	free(maps);
+	free(pending);
+	free(line);
+	fclose(file);
+}
+
+static void read_path(const char* path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		perror(path);
+		return;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		read_dump(path);
+		return;
+	}
+	DIR* dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		return;
+	}
+	struct dirent* ent;
+	while ((ent = readdir(dir)) != NULL) {
+		size_t len = strlen(ent->d_name);
+		if (strncmp(ent->d_name, "syscall-stats.", 14) != 0
+				|| (len > 4 && strcmp(ent->d_name + len - 4, ".tmp") == 0))
+			continue;
+		char file[4096];
+		snprintf(file, sizeof(file), "%s/%s", path, ent->d_name);
+		read_dump(file);
+	}
+	closedir(dir);
+}
+
+// Upper bound of the bucket holding the given fraction of the calls.
+static double percentile_us(const struct site_total* site, double fraction) {
+	uint64_t total = 0, seen = 0;
+	for (int i = 0; i < BUCKETS; i++)
+		total += site->hist[i];
+	for (int i = 0; i < BUCKETS; i++) {
+		seen += site->hist[i];
+		if (seen > 0 && seen >= fraction * total)
+			return (double)(UINT64_C(2) << i) / 1000;
+	}
+	return 0;
+}
+
+static int compare_sites(const void* a, const void* b) {
+	const struct site_total *x = a, *y = b;
+	return (x->count < y->count) - (x->count > y->count);
+}
+
+static int compare_callers(const void* a, const void* b) {
+	const struct caller_total *x = a, *y = b;
+	return (x->count < y->count) - (x->count > y->count);
+}
+
+int main(int argc, char** argv) {
+	size_t max_callers = 20;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n':
+				max_callers = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n callers] [file|dir...]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind == argc)
+		read_path(SYSCALL_STATS_DIR);
+	for (int i = optind; i < argc; i++)
+		read_path(argv[i]);
+	if (files == 0) {
+		fprintf(stderr, "no dumps found\n");
+		return 1;
+	}
+
+	qsort(sites, site_count, sizeof(*sites), compare_sites);
+	printf("%u processes\n\n", files);
+	if (latency)
+		printf("%-24s %12s %6s %12s %10s %10s %10s\n",
+				"SYSCALL", "CALLS", "PROCS", "TOTAL_MS", "AVG_US", "P50_US", "P99_US");
+	else
+		printf("%-24s %12s %6s\n", "SYSCALL", "CALLS", "PROCS");
+	for (size_t i = 0; i < site_count; i++) {
+		const struct site_total* site = &sites[i];
+		printf("%-24s %12" PRIu64 " %6u", site->name, site->count, site->processes);
+		if (latency)
+			printf(" %12.3f %10.3f %10.3f %10.3f", site->ns / 1e6, site->ns / 1e3 / site->count,
+					percentile_us(site, 0.5), percentile_us(site, 0.99));
+		printf("\n");
+	}
+
+	qsort(callers, caller_count, sizeof(*callers), compare_callers);
+	if (caller_count > 0 && max_callers > 0)
+		printf("\n%12s  %-24s %s\n", "CALLS", "SYSCALL", "CALLER");
+	for (size_t i = 0; i < caller_count && i < max_callers; i++)
+		printf("%12" PRIu64 "  %-24s %s\n", callers[i].count, callers[i].site, callers[i].where);
+	return 0;
+}
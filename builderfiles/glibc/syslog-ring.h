@@ -0,0 +1,49 @@
+/* <syslog-ring.h> - layout of the memory-mapped circular log file that
+ * syslog writes to when SYSLOG_SINK=ring, shared with the logring reader.
+ *
+ * The file is a header page followed by the data area. Writers reserve
+ * space with an atomic add on `head` (which only grows) and place the
+ * entry at head modulo size, so appending needs no lock and no syscall.
+ * `commit` is written last; it encodes the position of the entry, which
+ * lets readers tell complete entries from half-written or overwritten
+ * ones and find the first entry boundary after a wrap. `len` is stored
+ * right after the reservation, so readers can step over the entry of a
+ * writer that died before committing.
+ */
+
+#ifndef _SYSLOG_RING_H
+#define _SYSLOG_RING_H
+
+#include <stdint.h>
+
+#define LOG_RING_MAGIC 0x474e5253 // "SRNG"
+#define LOG_RING_VERSION 1
+#define LOG_RING_DATA_OFFSET 4096
+#define LOG_RING_DEFAULT_SIZE (1024 * 1024)
+
+#define LOG_RING_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+#define LOG_RING_COMMIT(pos) ((uint32_t)((pos) >> 3) + 1)
+
+struct log_ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size; // bytes in the data area, multiple of 8
+	uint64_t head; // next free position, never wraps
+};
+
+// An entry whose len reaches past the end of the data area only pads
+// the space its writer could not use; readers skip over it.
+struct log_ring_entry {
+	uint32_t len; // whole entry including padding
+	uint32_t commit;
+	uint32_t tv_sec;
+	uint32_t tv_nsec;
+	uint32_t pid;
+	uint32_t tid;
+	uint8_t priority; // android log priority
+	uint8_t tag_len;
+	uint16_t msg_len;
+	char payload[]; // tag\0msg\0
+};
+
+#endif // _SYSLOG_RING_H
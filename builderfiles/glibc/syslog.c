@@ -17,6 +17,7 @@
 #include <syslog.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/uio.h>
 #include <sys/syscall.h>
@@ -30,6 +31,18 @@
 #include <ctype.h>
 #include <assert.h>
 #include <libio/libioP.h>
+#include <libc-lock.h>
+#include <atomic.h>
+#include <register-atfork.h>
+#include <futex-internal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <tls.h>
+#include "syslog-ring.h"
 
 #define ANDROID_LOG_VERBOSE 2 // not used :/
 #define ANDROID_LOG_DEBUG 3
@@ -41,11 +54,60 @@
 #define LOG_ID_CRASH 4
 #define LOG_ID_MAIN 0
 
+// openlog() option selecting the asynchronous writer (see sys/syslog.h).
+#ifndef LOG_ASYNC
+#define LOG_ASYNC 0x40
+#endif
+
+#define ASYNC_LOG_SLOTS 256 // must be a power of two
+#define ASYNC_LOG_BATCH 32
+#define ASYNC_LOG_TAG_MAX 64
+
+#ifndef _PATH_LOGRING
+#define _PATH_LOGRING "/var/log/syslog.ring"
+#endif
+
+#ifndef _PATH_SYSLOG_RATELIMIT
+#define _PATH_SYSLOG_RATELIMIT "/etc/syslog-ratelimit.conf"
+#endif
+
+#define LOG_RATELIMIT_RULES 16
+#define LOG_RATELIMIT_BUCKETS 64
+
+// Largest datagram logd accepts after its header: priority, tag\0, msg\0.
+#define LOGGER_ENTRY_MAX_PAYLOAD 4068
+
 static const char* syslog_log_tag = NULL;
 static int syslog_priority_mask = 0xff;
 static int syslog_options = 0;
 extern char *__progname;
 
+// Connected socket to logd shared by all threads, -1 until the first
+// message (or openlog with LOG_NDELAY). Writers only load it, the lock
+// is taken to (re)connect or close. A reconnect keeps the descriptor
+// number (dup3 over it), so only closelog ever frees it; writers are
+// counted per epoch and closelog waits for the epoch that could still
+// hold the old descriptor to drain before closing it.
+static int log_socket = -1;
+static unsigned int log_socket_epoch = 0;
+static unsigned int log_socket_users[2];
+static bool log_socket_atfork = false;
+__libc_lock_define_initialized(static, log_socket_lock)
+
+// Where lines go, chosen once from SYSLOG_SINK: "logd" (default, falls
+// back to stderr when logd is unreachable), "ring" (the mmap'd file at
+// _PATH_LOGRING, see syslog-ring.h) or "stderr".
+enum { LOG_SINK_UNKNOWN = -1, LOG_SINK_LOGD, LOG_SINK_RING, LOG_SINK_STDERR };
+static int log_sink = LOG_SINK_UNKNOWN;
+
+static struct {
+	struct log_ring_header* header; // NULL until mapped
+	char* data;
+	uint32_t pid;
+	bool failed;
+} log_ring;
+__libc_lock_define_initialized(static, log_ring_lock)
+
 typedef struct log_time {
 	uint32_t tv_sec;
 	uint32_t tv_nsec;
@@ -84,6 +146,82 @@ void Send(struct BufferOutputStream* buff, const char* data, int len) {
 	buff->avail_ -= len;
 }
 
+// ======================
+// async-safe formatting
+//
+// printf-compatible, but without locks, locale or heap, so it can be used
+// from signal handlers and at crash time as well as by syslog. Decimal
+// numbers are converted two digits at a time from a table, hex, octal and
+// binary by shifting. Floating point is converted exactly with fixed-size
+// big integers (Dragon4 producing the requested number of digits, not the
+// shortest ones, since that is what printf asks for) and ties round to
+// even as in glibc. long double arguments go through double.
+
+#define FORMAT_LEFT 0x01
+#define FORMAT_ZERO 0x02
+#define FORMAT_PLUS 0x04
+#define FORMAT_SPACE 0x08
+#define FORMAT_ALT 0x10
+
+#define FORMAT_MAX_ARGS 32 // %n$ arguments beyond this read as 0
+#define FORMAT_MAX_DIGITS 800 // a double has at most 767 significant digits
+
+// A double scaled by any power of ten needed below fits in 1280 bits.
+#define BIGNUM_WORDS 40
+
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+static const char lower_digits[] = "0123456789abcdef";
+static const char upper_digits[] = "0123456789ABCDEF";
+
+enum format_arg_type {
+	FORMAT_ARG_NONE,
+	FORMAT_ARG_INT,
+	FORMAT_ARG_LONG,
+	FORMAT_ARG_LLONG,
+	FORMAT_ARG_DOUBLE,
+	FORMAT_ARG_LDOUBLE,
+	FORMAT_ARG_PTR,
+};
+
+union format_arg {
+	long long i;
+	double d;
+	long double ld;
+	const void* p;
+};
+
+struct format_args {
+	va_list ap;
+	const union format_arg* values; // %n$ arguments read up front, or NULL
+	int count;
+};
+
+struct format_spec {
+	int flags;
+	int width; // -1: none
+	int prec; // -1: none
+	int width_arg; // for '*': -1 next argument, n > 0 argument n
+	int prec_arg;
+	int arg; // 0: next argument, n > 0: %n$
+	char length; // 'H' hh, 'h', 'l', 'q' ll, 'L', 'j', 'z', 't' or 0
+	char conversion; // '\0' if the format ended early
+};
+
+struct bignum {
+	int len;
+	uint32_t words[BIGNUM_WORDS];
+};
+
 static unsigned parse_decimal(const char* format, int* ppos) {
 	const char* p = format + *ppos;
 	unsigned result = 0;
@@ -102,61 +240,266 @@ static unsigned parse_decimal(const char* format, int* ppos) {
 	return result;
 }
 
-static void format_unsigned(char* buf, size_t buf_size, uint64_t value, int base, bool caps) {
-	char* p = buf;
-	char* end = buf + buf_size - 1;
+// Parses "n$" at format[*ppos], returns 0 (and doesn't move) if it's not there.
+static int parse_position(const char* format, int* ppos) {
+	int nn = *ppos;
+	unsigned n = parse_decimal(format, &nn);
+	if (n == 0 || format[nn] != '$')
+		return 0;
+	*ppos = nn + 1;
+	return (n > INT_MAX) ? INT_MAX : (int)n;
+}
+
+// Parses the conversion following a '%', *ppos is left after it.
+static void parse_format_spec(const char* format, int* ppos, struct format_spec* spec) {
+	int nn = *ppos;
+	char c;
+
+	spec->flags = 0;
+	spec->width = -1;
+	spec->prec = -1;
+	spec->width_arg = 0;
+	spec->prec_arg = 0;
+	spec->length = 0;
+	spec->arg = parse_position(format, &nn);
+
+	/* parse flags */
+	for (;; nn++) {
+		c = format[nn];
+		if (c == '-')
+			spec->flags |= FORMAT_LEFT;
+		else if (c == '0')
+			spec->flags |= FORMAT_ZERO;
+		else if (c == '+')
+			spec->flags |= FORMAT_PLUS;
+		else if (c == ' ')
+			spec->flags |= FORMAT_SPACE;
+		else if (c == '#')
+			spec->flags |= FORMAT_ALT;
+		else if (c != '\'' && c != 'I') // grouping and locale digits: ignored
+			break;
+	}
 
-	// Generate digit string in reverse order.
-	while (value) {
-		unsigned d = value % base;
-		value /= base;
-		if (p != end) {
-			char ch;
-			if (d < 10)
-				ch = '0' + d;
-			else
-				ch = (caps ? 'A' : 'a') + (d - 10);
-			*p++ = ch;
+	/* parse field width */
+	if (c == '*') {
+		nn++;
+		spec->width_arg = parse_position(format, &nn);
+		if (spec->width_arg == 0)
+			spec->width_arg = -1;
+	} else if (c >= '0' && c <= '9') {
+		spec->width = (int)parse_decimal(format, &nn);
+	}
+
+	/* parse precision */
+	if (format[nn] == '.') {
+		nn++;
+		if (format[nn] == '*') {
+			nn++;
+			spec->prec_arg = parse_position(format, &nn);
+			if (spec->prec_arg == 0)
+				spec->prec_arg = -1;
+		} else {
+			spec->prec = (int)parse_decimal(format, &nn);
+		}
+	}
+
+	/* length modifier */
+	c = format[nn];
+	if (c == 'h' || c == 'l') {
+		spec->length = c;
+		if (format[++nn] == c) {
+			spec->length = (c == 'h') ? 'H' : 'q';
+			nn++;
 		}
+	} else if (c == 'L' || c == 'q' || c == 'j' || c == 'z' || c == 'Z' || c == 't') {
+		spec->length = (c == 'Z') ? 'z' : c;
+		nn++;
 	}
 
-	// Special case for 0.
-	if (p == buf)
-		if (p != end)
-			*p++ = '0';
-	*p = '\0';
+	/* conversion specifier */
+	spec->conversion = format[nn];
+	if (spec->conversion != '\0')
+		nn++;
+	*ppos = nn;
+}
 
-	// Reverse digit string in-place.
-	size_t length = p - buf;
-	for (size_t i = 0, j = length - 1; i < j; ++i, --j) {
-		char ch = buf[i];
-		buf[i] = buf[j];
-		buf[j] = ch;
+static enum format_arg_type format_arg_type(const struct format_spec* spec) {
+	switch (spec->conversion) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'b': case 'B':
+			if (spec->length == 'q' || spec->length == 'j' || spec->length == 'L')
+				return FORMAT_ARG_LLONG;
+			if (spec->length == 'l' || spec->length == 'z' || spec->length == 't')
+				return FORMAT_ARG_LONG;
+			return FORMAT_ARG_INT;
+		case 'c':
+			return FORMAT_ARG_INT;
+		case 's': case 'p': case 'n':
+			return FORMAT_ARG_PTR;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			return (spec->length == 'L') ? FORMAT_ARG_LDOUBLE : FORMAT_ARG_DOUBLE;
+		default:
+			return FORMAT_ARG_NONE;
 	}
 }
 
-static void format_integer(char* buf, size_t buf_size, uint64_t value, char conversion) {
-	// Decode the conversion specifier.
-	int is_signed = (conversion == 'd' || conversion == 'i' || conversion == 'o');
-	int base = 10;
-	if (tolower(conversion) == 'x')
-		base = 16;
-	else if (conversion == 'o')
-		base = 8;
-	else if (tolower(conversion) == 'b')
-		base = 2;
-	bool caps = (conversion == 'X');
+static unsigned format_int_size(const struct format_spec* spec) {
+	switch (spec->length) {
+		case 'H':
+			return sizeof(char);
+		case 'h':
+			return sizeof(short);
+		case 'l':
+			return sizeof(long);
+		case 'z':
+			return sizeof(size_t);
+		case 't':
+			return sizeof(ptrdiff_t);
+		case 'q': case 'j': case 'L':
+			return sizeof(long long);
+		default:
+			return sizeof(int);
+	}
+}
 
-	if (is_signed && (int64_t)value < 0) {
-		buf[0] = '-';
-		buf += 1;
-		buf_size -= 1;
-		value = (uint64_t)(-(int64_t)value);
+static union format_arg read_arg(va_list* ap, enum format_arg_type type) {
+	union format_arg arg;
+	arg.i = 0;
+	switch (type) {
+		case FORMAT_ARG_INT:
+			arg.i = va_arg(*ap, int);
+			break;
+		case FORMAT_ARG_LONG:
+			arg.i = va_arg(*ap, long);
+			break;
+		case FORMAT_ARG_LLONG:
+			arg.i = va_arg(*ap, long long);
+			break;
+		case FORMAT_ARG_DOUBLE:
+			arg.d = va_arg(*ap, double);
+			break;
+		case FORMAT_ARG_LDOUBLE:
+			arg.ld = va_arg(*ap, long double);
+			break;
+		case FORMAT_ARG_PTR:
+			arg.p = va_arg(*ap, const void*);
+			break;
+		default:
+			break;
 	}
-	format_unsigned(buf, buf_size, value, base, caps);
+	return arg;
+}
+
+static union format_arg get_arg(struct format_args* args, int pos, enum format_arg_type type) {
+	if (args->values == NULL)
+		return read_arg(&args->ap, type);
+	if (pos < 1 || pos > args->count) {
+		union format_arg none;
+		none.ld = 0;
+		return none;
+	}
+	return args->values[pos - 1];
+}
+
+// If the format uses %n$ arguments, reads them all in order into values
+// and returns how many there are. Returns -1 for ordinary formats.
+// With PRINTF_FORTIFY (_FORTIFY_SOURCE callers) invalid numbering is
+// fatal, as in vfprintf.
+static int read_positional_args(const char* format, va_list* ap, union format_arg* values,
+		unsigned int mode_flags) {
+	enum format_arg_type types[FORMAT_MAX_ARGS];
+	int count = 0;
+	bool first = true;
+
+	if (strchr(format, '$') == NULL)
+		return -1;
+	for (int nn = 0; format[nn] != '\0';) {
+		const char* p = strchrnul(format + nn, '%');
+		if (*p == '\0')
+			break;
+		nn = p - format + 1;
+		struct format_spec spec;
+		parse_format_spec(format, &nn, &spec);
+		if (spec.conversion == '%')
+			continue;
+		if (first) {
+			// Either all conversions are numbered or none is.
+			if (spec.arg == 0)
+				return -1;
+			memset(types, 0, sizeof(types));
+			first = false;
+		} else if (spec.arg == 0 && spec.conversion != '\0'
+				&& (mode_flags & PRINTF_FORTIFY) != 0) {
+			__libc_fatal("*** invalid %N$ use detected ***\n");
+		}
+
+		int positions[3] = { spec.arg, spec.width_arg, spec.prec_arg };
+		for (int i = 0; i < 3; i++) {
+			int pos = positions[i];
+			if (pos <= 0 || pos > FORMAT_MAX_ARGS)
+				continue;
+			types[pos - 1] = (i == 0) ? format_arg_type(&spec) : FORMAT_ARG_INT;
+			if (pos > count)
+				count = pos;
+		}
+		if (spec.conversion == '\0')
+			break;
+	}
+	if (first)
+		return -1;
+
+	// An argument nobody refers to has no known type; stop before it.
+	for (int i = 0; i < count; i++) {
+		if (types[i] == FORMAT_ARG_NONE) {
+			if ((mode_flags & PRINTF_FORTIFY) != 0)
+				__libc_fatal("*** invalid %N$ use detected ***\n");
+			return i;
+		}
+		values[i] = read_arg(ap, types[i]);
+	}
+	return count;
+}
+
+// Writes the digits of value so that they end at end, returns the first one.
+static char* format_unsigned(char* end, uint64_t value, int base, bool caps) {
+	char* p = end;
+
+	if (base != 10) {
+		const char* digits = caps ? upper_digits : lower_digits;
+		int shift = (base == 16) ? 4 : (base == 8) ? 3 : 1;
+		do {
+			*--p = digits[value & (base - 1)];
+			value >>= shift;
+		} while (value != 0);
+		return p;
+	}
+
+	// Stay in 32 bits as soon as possible, 64-bit division is a call on arm.
+	while (value > UINT32_MAX) {
+		unsigned pair = value % 100;
+		value /= 100;
+		p -= 2;
+		memcpy(p, &digit_pairs[pair * 2], 2);
+	}
+	uint32_t small = value;
+	while (small >= 100) {
+		unsigned pair = small % 100;
+		small /= 100;
+		p -= 2;
+		memcpy(p, &digit_pairs[pair * 2], 2);
+	}
+	if (small >= 10) {
+		p -= 2;
+		memcpy(p, &digit_pairs[small * 2], 2);
+	} else {
+		*--p = '0' + small;
+	}
+	return p;
 }
 
 static void SendRepeat(struct BufferOutputStream* buff, char ch, int count) {
+	if (count <= 0)
+		return;
+
 	char pad[8];
 	memset(pad, ch, sizeof(pad));
 
@@ -170,200 +513,652 @@ static void SendRepeat(struct BufferOutputStream* buff, char ch, int count) {
 	}
 }
 
-static void out_vformat(struct BufferOutputStream* buff, const char* format, va_list args) {
-	int nn = 0;
+// Pads a field of len bytes (prefix included) to the width. Zeros go
+// between the prefix (sign, 0x) and the rest.
+static void send_field_start(struct BufferOutputStream* buff, const struct format_spec* spec,
+		const char* prefix, int prefix_len, int len) {
+	if (spec->width <= len) {
+		if (prefix_len > 0)
+			Send(buff, prefix, prefix_len);
+		return;
+	}
 
-	for (;;) {
-		int mm;
-		int padZero = 0;
-		int padLeft = 0;
-		char sign = '\0';
-		int width = -1;
-		int prec = -1;
-		bool alternate = false;
-		size_t bytelen = sizeof(int);
-		int slen;
-		char buffer[64];	// temporary buffer used to format numbers/format errno string
-
-		char c;
+	int pad = spec->width - len;
+	bool zero = (spec->flags & (FORMAT_ZERO | FORMAT_LEFT)) == FORMAT_ZERO;
+	if (!zero && (spec->flags & FORMAT_LEFT) == 0)
+		SendRepeat(buff, ' ', pad);
+	if (prefix_len > 0)
+		Send(buff, prefix, prefix_len);
+	if (zero)
+		SendRepeat(buff, '0', pad);
+}
 
-		/* first, find all characters that are not 0 or '%' */
-		/* then send them to the output directly */
-		mm = nn;
-		do {
-			c = format[mm];
-			if (c == '\0' || c == '%') break;
-			mm++;
-		} while (1);
+static void send_field_end(struct BufferOutputStream* buff, const struct format_spec* spec, int len) {
+	if ((spec->flags & FORMAT_LEFT) != 0 && spec->width > len)
+		SendRepeat(buff, ' ', spec->width - len);
+}
 
-		if (mm > nn) {
-			Send(buff, format + nn, mm - nn);
-			nn = mm;
+static void send_string(struct BufferOutputStream* buff, struct format_spec* spec, const char* str, int len) {
+	spec->flags &= ~FORMAT_ZERO;
+	send_field_start(buff, spec, NULL, 0, len);
+	Send(buff, str, len);
+	send_field_end(buff, spec, len);
+}
+
+static int encode_utf8(uint32_t c, char* out) {
+	if (c < 0x80) {
+		out[0] = c;
+		return 1;
+	} else if (c < 0x800) {
+		out[0] = 0xc0 | (c >> 6);
+		out[1] = 0x80 | (c & 0x3f);
+		return 2;
+	} else if (c < 0x10000) {
+		out[0] = 0xe0 | (c >> 12);
+		out[1] = 0x80 | ((c >> 6) & 0x3f);
+		out[2] = 0x80 | (c & 0x3f);
+		return 3;
+	} else if (c < 0x110000) {
+		out[0] = 0xf0 | (c >> 18);
+		out[1] = 0x80 | ((c >> 12) & 0x3f);
+		out[2] = 0x80 | ((c >> 6) & 0x3f);
+		out[3] = 0x80 | (c & 0x3f);
+		return 4;
+	}
+	out[0] = '?';
+	return 1;
+}
+
+// %ls, always as UTF-8. The precision limits bytes, never splitting a character.
+static void send_wide_string(struct BufferOutputStream* buff, struct format_spec* spec, const wchar_t* str) {
+	char buffer[4];
+	int len = 0;
+	size_t count = 0;
+
+	if (str == NULL)
+		str = L"(null)";
+	for (; str[count] != L'\0'; count++) {
+		int n = encode_utf8(str[count], buffer);
+		if (spec->prec >= 0 && len + n > spec->prec)
+			break;
+		len += n;
+	}
+
+	spec->flags &= ~FORMAT_ZERO;
+	send_field_start(buff, spec, NULL, 0, len);
+	for (size_t i = 0; i < count; i++)
+		Send(buff, buffer, encode_utf8(str[i], buffer));
+	send_field_end(buff, spec, len);
+}
+
+static void format_integer(struct BufferOutputStream* buff, struct format_spec* spec, uint64_t value, bool is_signed) {
+	char c = spec->conversion;
+	char prefix[2];
+	int prefix_len = 0;
+	char digits[72];
+	char* end = digits + sizeof(digits);
+	char* start = end;
+
+	// Truncate (and sign-extend) to the argument's real size.
+	unsigned size = format_int_size(spec);
+	if (size < sizeof(uint64_t)) {
+		int shift = 64 - 8 * size;
+		value <<= shift;
+		value = is_signed ? (uint64_t)((int64_t)value >> shift) : value >> shift;
+	}
+
+	if (is_signed) {
+		if ((int64_t)value < 0) {
+			prefix[prefix_len++] = '-';
+			value = -value;
+		} else if ((spec->flags & FORMAT_PLUS) != 0) {
+			prefix[prefix_len++] = '+';
+		} else if ((spec->flags & FORMAT_SPACE) != 0) {
+			prefix[prefix_len++] = ' ';
 		}
+	}
 
-		/* is this it ? then exit */
-		if (c == '\0') break;
+	int base = 10;
+	if (c == 'x' || c == 'X')
+		base = 16;
+	else if (c == 'o')
+		base = 8;
+	else if (c == 'b' || c == 'B')
+		base = 2;
 
-		/* nope, we are at a '%' modifier */
-		nn++;	// skip it
+	// "%.0d" prints nothing for 0.
+	if (value != 0 || spec->prec != 0)
+		start = format_unsigned(end, value, base, c == 'X');
+	int len = end - start;
+
+	if ((spec->flags & FORMAT_ALT) != 0) {
+		if (base == 8 && spec->prec <= len && (len == 0 || *start != '0')) {
+			*--start = '0';
+			len++;
+		} else if ((base == 16 || base == 2) && value != 0) {
+			prefix[prefix_len++] = '0';
+			prefix[prefix_len++] = c;
+		}
+	}
 
-		/* parse flags */
-		for (;;) {
-			c = format[nn++];
-			if (c == '\0') { /* single trailing '%' ? */
-				c = '%';
-				Send(buff, &c, 1);
-				return;
-			} else if (c == '0') {
-				padZero = 1;
-				continue;
-			} else if (c == '-') {
-				padLeft = 1;
-				continue;
-			} else if (c == ' ' || c == '+') {
-				sign = c;
-				continue;
-			} else if (c == '#') {
-				alternate = true;
-				continue;
-			}
+	// With a precision, the 0 flag is ignored.
+	int zeros = (spec->prec > len) ? spec->prec - len : 0;
+	if (spec->prec >= 0)
+		spec->flags &= ~FORMAT_ZERO;
+
+	int total = prefix_len + zeros + len;
+	send_field_start(buff, spec, prefix, prefix_len, total);
+	SendRepeat(buff, '0', zeros);
+	Send(buff, start, len);
+	send_field_end(buff, spec, total);
+}
+
+static void bignum_set(struct bignum* b, uint64_t value) {
+	b->len = 0;
+	while (value != 0) {
+		b->words[b->len++] = (uint32_t)value;
+		value >>= 32;
+	}
+}
+
+static void bignum_mul_small(struct bignum* b, uint32_t m) {
+	uint64_t carry = 0;
+	for (int i = 0; i < b->len; i++) {
+		carry += (uint64_t)b->words[i] * m;
+		b->words[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+	if (carry != 0 && b->len < BIGNUM_WORDS)
+		b->words[b->len++] = (uint32_t)carry;
+}
+
+static void bignum_mul_pow10(struct bignum* b, int n) {
+	static const uint32_t pow10[] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+	};
+	for (; n >= 9; n -= 9)
+		bignum_mul_small(b, pow10[9]);
+	if (n > 0)
+		bignum_mul_small(b, pow10[n]);
+}
+
+static void bignum_shift_left(struct bignum* b, int bits) {
+	int words = bits / 32;
+	int shift = bits % 32;
+
+	if (b->len == 0)
+		return;
+	for (int i = b->len; i >= 0; i--) {
+		uint32_t high = (i < b->len) ? b->words[i] << shift : 0;
+		uint32_t low = (shift != 0 && i > 0) ? b->words[i - 1] >> (32 - shift) : 0;
+		b->words[i + words] = high | low;
+	}
+	for (int i = 0; i < words; i++)
+		b->words[i] = 0;
+	b->len += words + 1;
+	while (b->len > 0 && b->words[b->len - 1] == 0)
+		b->len--;
+}
+
+static int bignum_compare(const struct bignum* a, const struct bignum* b) {
+	if (a->len != b->len)
+		return (a->len > b->len) ? 1 : -1;
+	for (int i = a->len - 1; i >= 0; i--)
+		if (a->words[i] != b->words[i])
+			return (a->words[i] > b->words[i]) ? 1 : -1;
+	return 0;
+}
+
+// a -= b * q, with a >= b * q.
+static void bignum_mul_sub(struct bignum* a, const struct bignum* b, uint32_t q) {
+	uint64_t carry = 0;
+	uint64_t borrow = 0;
+	for (int i = 0; i < a->len; i++) {
+		uint64_t product = (i < b->len) ? (uint64_t)b->words[i] * q + carry : carry;
+		carry = product >> 32;
+		uint64_t diff = (uint64_t)a->words[i] - (uint32_t)product - borrow;
+		a->words[i] = (uint32_t)diff;
+		borrow = (diff >> 32) & 1;
+	}
+	while (a->len > 0 && a->words[a->len - 1] == 0)
+		a->len--;
+}
+
+// a -= b, with a >= b.
+static void bignum_sub(struct bignum* a, const struct bignum* b) {
+	uint64_t borrow = 0;
+	for (int i = 0; i < a->len; i++) {
+		uint64_t diff = (uint64_t)a->words[i] - ((i < b->len) ? b->words[i] : 0) - borrow;
+		a->words[i] = (uint32_t)diff;
+		borrow = (diff >> 32) & 1;
+	}
+	while (a->len > 0 && a->words[a->len - 1] == 0)
+		a->len--;
+}
+
+// Decimal digits of value > 0, either down to the 10^-prec position
+// (fixed, as for %f) or prec + 1 of them (as for %e), correctly rounded.
+// *exp10 is the position of the first digit. Digits past the returned
+// count are zeros; 0 means the value rounds to zero.
+static int double_to_digits(double value, bool fixed, int prec, char* digits, int* exp10) {
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint64_t mantissa = bits & ((1ULL << 52) - 1);
+	int exponent = (bits >> 52) & 0x7ff;
+	if (exponent == 0)
+		exponent = 1; // subnormal
+	else
+		mantissa |= 1ULL << 52;
+	exponent -= 1075;
+
+	// value = r / s
+	struct bignum r, s, scaled;
+	bignum_set(&r, mantissa);
+	bignum_set(&s, 1);
+	if (exponent > 0)
+		bignum_shift_left(&r, exponent);
+	else
+		bignum_shift_left(&s, -exponent);
+
+	// Estimate k = floor(log10(value)) from the binary exponent, scale
+	// by 10^-k and fix the estimate so that 1 <= r / s < 10.
+	int log2 = exponent + 63 - __builtin_clzll(mantissa);
+	int k = (log2 * 78913) >> 18;
+	if (k >= 0)
+		bignum_mul_pow10(&s, k);
+	else
+		bignum_mul_pow10(&r, -k);
+	while (bignum_compare(&r, &s) < 0) {
+		bignum_mul_small(&r, 10);
+		k--;
+	}
+	scaled = s;
+	bignum_mul_small(&scaled, 10);
+	while (bignum_compare(&r, &scaled) >= 0) {
+		s = scaled;
+		bignum_mul_small(&scaled, 10);
+		k++;
+	}
+
+	int count = fixed ? k + 1 + prec : prec + 1;
+	*exp10 = k;
+	if (count <= 0) {
+		// All requested digits are zero. One position above the first
+		// digit, value rounds up to 1 if it's over half of it.
+		scaled = s;
+		bignum_mul_small(&scaled, 5);
+		if (count < 0 || bignum_compare(&r, &scaled) <= 0)
+			return 0;
+		digits[0] = '1';
+		*exp10 = k + 1;
+		return 1;
+	}
+
+	// Shift both so that the top word of s is in [2^27, 2^28): r < 10 s
+	// then has no more words than s, and the top words give each digit
+	// to within one.
+	int shift = (__builtin_clz(s.words[s.len - 1]) + 28) % 32;
+	bignum_shift_left(&r, shift);
+	bignum_shift_left(&s, shift);
+	uint32_t s_top = s.words[s.len - 1] + 1;
+
+	int n = (count < FORMAT_MAX_DIGITS) ? count : FORMAT_MAX_DIGITS;
+	for (int i = 0; i < n; i++) {
+		if (r.len == 0) {
+			memset(digits + i, '0', n - i);
 			break;
 		}
-
-		/* parse field width */
-		if ((c >= '0' && c <= '9')) {
-			nn--;
-			width = (int)parse_decimal(format, &nn);
-			c = format[nn++];
+		uint32_t d = (r.len < s.len) ? 0 : r.words[s.len - 1] / s_top;
+		if (d != 0)
+			bignum_mul_sub(&r, &s, d);
+		if (bignum_compare(&r, &s) >= 0) {
+			bignum_sub(&r, &s);
+			d++;
 		}
+		digits[i] = '0' + d;
+		bignum_mul_small(&r, 10);
+	}
+	if (n < count)
+		return n; // the rest is exact zeros
+
+	// Round half to even: r / s is now ten times the remainder.
+	scaled = s;
+	bignum_mul_small(&scaled, 5);
+	int cmp = bignum_compare(&r, &scaled);
+	if (cmp > 0 || (cmp == 0 && (digits[n - 1] & 1) != 0)) {
+		int i = n - 1;
+		while (i >= 0 && digits[i] == '9')
+			digits[i--] = '0';
+		if (i >= 0) {
+			digits[i]++;
+		} else {
+			digits[0] = '1';
+			*exp10 = k + 1;
+			if (fixed && n < FORMAT_MAX_DIGITS)
+				digits[n++] = '0';
+		}
+	}
+	return n;
+}
 
-		/* parse precision */
-		if (c == '.') {
-			prec = (int)parse_decimal(format, &nn);
-			c = format[nn++];
+static void format_hex_double(struct BufferOutputStream* buff, struct format_spec* spec,
+		uint64_t bits, char* prefix, int prefix_len) {
+	bool caps = (spec->conversion == 'A');
+	const char* hex = caps ? upper_digits : lower_digits;
+	uint64_t mantissa = bits & ((1ULL << 52) - 1);
+	int exponent = (bits >> 52) & 0x7ff;
+	int lead = 1;
+	if (exponent == 0) {
+		lead = 0;
+		exponent = (mantissa == 0) ? 0 : -1022;
+	} else {
+		exponent -= 1023;
+	}
+
+	int nibbles = 13;
+	if (spec->prec >= 0 && spec->prec < 13) {
+		// Round half to even at the requested nibble.
+		int shift = (13 - spec->prec) * 4;
+		uint64_t rest = mantissa & ((1ULL << shift) - 1);
+		uint64_t half = 1ULL << (shift - 1);
+		mantissa >>= shift;
+		if (rest > half || (rest == half && (mantissa & 1) != 0))
+			mantissa++;
+		nibbles = spec->prec;
+		if (mantissa >> (nibbles * 4) != 0) {
+			mantissa = 0;
+			lead++;
+		}
+	} else if (spec->prec < 0) {
+		while (nibbles > 0 && (mantissa & 0xf) == 0) {
+			mantissa >>= 4;
+			nibbles--;
 		}
+	}
+	int extra_zeros = (spec->prec > 13) ? spec->prec - 13 : 0;
+
+	char body[40];
+	int len = 0;
+	body[len++] = hex[lead];
+	if (nibbles > 0 || extra_zeros > 0 || (spec->flags & FORMAT_ALT) != 0)
+		body[len++] = '.';
+	for (int i = nibbles - 1; i >= 0; i--)
+		body[len++] = hex[(mantissa >> (i * 4)) & 0xf];
+	int digits_len = len;
+
+	char exp_buf[8];
+	char* exp_end = exp_buf + sizeof(exp_buf);
+	char* exp_start = format_unsigned(exp_end, (exponent < 0) ? -exponent : exponent, 10, false);
+	*--exp_start = (exponent < 0) ? '-' : '+';
+	*--exp_start = caps ? 'P' : 'p';
+
+	prefix[prefix_len++] = '0';
+	prefix[prefix_len++] = caps ? 'X' : 'x';
+	int total = prefix_len + digits_len + extra_zeros + (exp_end - exp_start);
+	send_field_start(buff, spec, prefix, prefix_len, total);
+	Send(buff, body, digits_len);
+	SendRepeat(buff, '0', extra_zeros);
+	Send(buff, exp_start, exp_end - exp_start);
+	send_field_end(buff, spec, total);
+}
 
-		/* length modifier */
-		switch (c) {
-			case 'h':
-				bytelen = sizeof(short);
-				if (format[nn] == 'h') {
-					bytelen = sizeof(char);
-					nn += 1;
-				}
-				c = format[nn++];
-				break;
-			case 'l':
-				bytelen = sizeof(long);
-				if (format[nn] == 'l') {
-					bytelen = sizeof(long long);
-					nn += 1;
-				}
-				c = format[nn++];
-				break;
-			case 'z':
-				bytelen = sizeof(size_t);
-				c = format[nn++];
-				break;
-			case 't':
-				bytelen = sizeof(ptrdiff_t);
-				c = format[nn++];
-				break;
-			default:;
+static void format_double(struct BufferOutputStream* buff, struct format_spec* spec, double value) {
+	char c = spec->conversion;
+	char lower = c | 0x20;
+	bool caps = (c != lower);
+	char prefix[4];
+	int prefix_len = 0;
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	if ((bits >> 63) != 0)
+		prefix[prefix_len++] = '-';
+	else if ((spec->flags & FORMAT_PLUS) != 0)
+		prefix[prefix_len++] = '+';
+	else if ((spec->flags & FORMAT_SPACE) != 0)
+		prefix[prefix_len++] = ' ';
+	bits &= ~(1ULL << 63);
+	memcpy(&value, &bits, sizeof(value));
+
+	if ((bits >> 52) == 0x7ff) {
+		const char* str = (bits << 12 != 0) ? (caps ? "NAN" : "nan") : (caps ? "INF" : "inf");
+		spec->flags &= ~FORMAT_ZERO;
+		send_field_start(buff, spec, prefix, prefix_len, prefix_len + 3);
+		Send(buff, str, 3);
+		send_field_end(buff, spec, prefix_len + 3);
+		return;
+	}
+	if (lower == 'a') {
+		format_hex_double(buff, spec, bits, prefix, prefix_len);
+		return;
+	}
+
+	char digits[FORMAT_MAX_DIGITS + 1];
+	int n = 0;
+	int k = 0;
+	int prec = (spec->prec < 0) ? 6 : spec->prec;
+	bool exp_style = (lower == 'e');
+	bool alt = (spec->flags & FORMAT_ALT) != 0;
+
+	if (lower == 'g') {
+		// P significant digits, then %f or %e style depending on the
+		// exponent, trailing zeros removed unless '#'.
+		int p = (prec == 0) ? 1 : prec;
+		if (bits != 0)
+			n = double_to_digits(value, false, p - 1, digits, &k);
+		int x = (n == 0) ? 0 : k;
+		exp_style = !(p > x && x >= -4);
+		prec = exp_style ? p - 1 : p - 1 - x;
+		if (!alt) {
+			while (n > 0 && digits[n - 1] == '0')
+				n--;
+			int shown = exp_style ? n - 1 : n - 1 - x;
+			if (shown < prec)
+				prec = (shown > 0) ? shown : 0;
+		}
+	} else if (bits != 0) {
+		n = double_to_digits(value, !exp_style, prec, digits, &k);
+	}
+	if (n == 0)
+		k = 0;
+
+	bool point = prec > 0 || alt;
+	if (!exp_style) {
+		int int_len = (n > 0 && k >= 0) ? k + 1 : 1;
+		int total = prefix_len + int_len + point + prec;
+		send_field_start(buff, spec, prefix, prefix_len, total);
+		if (n > 0 && k >= 0) {
+			int m = (n < k + 1) ? n : k + 1;
+			Send(buff, digits, m);
+			SendRepeat(buff, '0', k + 1 - m);
+		} else {
+			Send(buff, "0", 1);
 		}
+		if (point)
+			Send(buff, ".", 1);
+		// Digit i of digits is at position -(i - k).
+		int first = k + 1;
+		int lead = (n == 0) ? prec : (first < 0) ? -first : 0;
+		if (lead > prec)
+			lead = prec;
+		SendRepeat(buff, '0', lead);
+		int from = (first < 0) ? 0 : first;
+		int take = (n > from) ? n - from : 0;
+		if (take > prec - lead)
+			take = prec - lead;
+		Send(buff, digits + from, take);
+		SendRepeat(buff, '0', prec - lead - take);
+		send_field_end(buff, spec, total);
+		return;
+	}
 
-		/* conversion specifier */
-		const char* str = buffer;
-		if (c == 's') {
-			/* string */
-			str = va_arg(args, const char*);
-		} else if (c == 'c') {
-			/* character */
-			/* NOTE: char is promoted to int when passed through the stack */
-			buffer[0] = (char)va_arg(args, int);
-			buffer[1] = '\0';
-		} else if (c == 'p') {
-			uint64_t value = (uintptr_t)va_arg(args, void*);
-			buffer[0] = '0';
-			buffer[1] = 'x';
-			format_integer(buffer + 2, sizeof(buffer) - 2, value, 'x');
-		} else if (c == 'm') {
-			{
-				strerror_r(errno, buffer, sizeof(buffer));
+	char exp_buf[8];
+	char* exp_end = exp_buf + sizeof(exp_buf);
+	char* exp_start = format_unsigned(exp_end, (k < 0) ? -k : k, 10, false);
+	if (exp_end - exp_start < 2)
+		*--exp_start = '0';
+	*--exp_start = (k < 0) ? '-' : '+';
+	*--exp_start = caps ? 'E' : 'e';
+
+	int total = prefix_len + 1 + point + prec + (exp_end - exp_start);
+	send_field_start(buff, spec, prefix, prefix_len, total);
+	Send(buff, (n > 0) ? digits : "0", 1);
+	if (point)
+		Send(buff, ".", 1);
+	int take = (n > 1) ? n - 1 : 0;
+	if (take > prec)
+		take = prec;
+	Send(buff, digits + 1, take);
+	SendRepeat(buff, '0', prec - take);
+	Send(buff, exp_start, exp_end - exp_start);
+	send_field_end(buff, spec, total);
+}
+
+// "Unknown error N", built by hand so that %m stays async-signal-safe.
+static const char* unknown_error(char* buffer, size_t size, int errnum) {
+	static const char prefix[] = "Unknown error ";
+	char digits[16];
+	unsigned int value = (errnum < 0) ? -(unsigned int)errnum : (unsigned int)errnum;
+	size_t n = 0;
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+	if (errnum < 0)
+		digits[n++] = '-';
+
+	size_t len = sizeof(prefix) - 1;
+	memcpy(buffer, prefix, len);
+	while (n > 0 && len < size - 1)
+		buffer[len++] = digits[--n];
+	buffer[len] = '\0';
+	return buffer;
+}
+
+static void format_arg(struct BufferOutputStream* buff, struct format_spec* spec,
+		struct format_args* args, int saved_errno) {
+	char buffer[64];	// temporary buffer for characters and the errno string
+	union format_arg arg = get_arg(args, spec->arg, format_arg_type(spec));
+	bool wide = (spec->length == 'l');
+	const char* str;
+
+	switch (spec->conversion) {
+		case 'd': case 'i':
+			format_integer(buff, spec, arg.i, true);
+			break;
+		case 'o': case 'u': case 'x': case 'X': case 'b': case 'B':
+			format_integer(buff, spec, arg.i, false);
+			break;
+		case 'p':
+			if (arg.p == NULL) {
+				send_string(buff, spec, "(nil)", 5);
+				break;
 			}
-		} else if (tolower(c) == 'b' || c == 'd' || c == 'i' || c == 'o' || c == 'u' ||
-							 tolower(c) == 'x') {
-			/* integers - first read value from stack */
-			uint64_t value;
-			int is_signed = (c == 'd' || c == 'i' || c == 'o');
-
-			/* NOTE: int8_t and int16_t are promoted to int when passed
-			 *			 through the stack
-			 */
-			switch (bytelen) {
-				case 1:
-					value = (uint8_t)va_arg(args, int);
-					break;
-				case 2:
-					value = (uint16_t)va_arg(args, int);
-					break;
-				case 4:
-					value = va_arg(args, uint32_t);
-					break;
-				case 8:
-					value = va_arg(args, uint64_t);
-					break;
-				default:
-					return; /* should not happen */
+			spec->conversion = 'x';
+			spec->length = (sizeof(void*) == sizeof(long)) ? 'l' : 'q';
+			spec->flags |= FORMAT_ALT;
+			format_integer(buff, spec, (uintptr_t)arg.p, false);
+			break;
+		case 'c':
+			/* NOTE: char is promoted to int when passed through the stack */
+			if (wide)
+				send_string(buff, spec, buffer, encode_utf8((uint32_t)arg.i, buffer));
+			else {
+				buffer[0] = (char)arg.i;
+				send_string(buff, spec, buffer, 1);
 			}
-
-			/* sign extension, if needed */
-			if (is_signed) {
-				int shift = 64 - 8 * bytelen;
-				value = (uint64_t)(((int64_t)(value << shift)) >> shift);
+			break;
+		case 's':
+			if (wide) {
+				send_wide_string(buff, spec, arg.p);
+				break;
 			}
+			str = (arg.p != NULL) ? arg.p : "(null)";
+			send_string(buff, spec, str, (spec->prec >= 0) ? (int)strnlen(str, spec->prec) : (int)strlen(str));
+			break;
+		case 'm':
+			// The untranslated text straight from glibc's errno table:
+			// strerror_r goes through dcgettext, which locks and may allocate.
+			str = __get_errlist(saved_errno);
+			if (str == NULL)
+				str = __get_errname(saved_errno);
+			if (str == NULL)
+				str = unknown_error(buffer, sizeof(buffer), saved_errno);
+			send_string(buff, spec, str, strlen(str));
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			format_double(buff, spec, (spec->length == 'L') ? (double)arg.ld : arg.d);
+			break;
+		case 'n':
+			// Only ever useful for format string attacks: the argument is
+			// consumed, nothing is stored.
+			break;
+		case '%':
+			Send(buff, "%", 1);
+			break;
+		default:
+			// Unknown conversion: print it as it is.
+			Send(buff, "%", 1);
+			Send(buff, &spec->conversion, 1);
+			break;
+	}
+}
 
-			if (alternate && value != 0 && (tolower(c) == 'x' || c == 'o' || tolower(c) == 'b')) {
-				if (tolower(c) == 'x' || tolower(c) == 'b') {
-					buffer[0] = '0';
-					buffer[1] = c;
-					format_integer(buffer + 2, sizeof(buffer) - 2, value, c);
-				} else {
-					buffer[0] = '0';
-					format_integer(buffer + 1, sizeof(buffer) - 1, value, c);
-				}
-			} else
-				/* format the number properly into our buffer */
-				format_integer(buffer, sizeof(buffer), value, c);
-		} else if (c == '%') {
-			buffer[0] = '%';
-			buffer[1] = '\0';
-		} else
-			__assert("conversion specifier unsupported", __FILE__, __LINE__);
-
-		if (str == NULL)
-			str = "(null)";
+static void out_vformat(struct BufferOutputStream* buff, const char* format, va_list ap,
+		unsigned int mode_flags) {
+	int saved_errno = errno;
+	union format_arg values[FORMAT_MAX_ARGS];
+	struct format_args args;
+	int nn = 0;
 
-		/* if we are here, 'str' points to the content that must be
-		 * outputted. handle padding and alignment now */
+	va_copy(args.ap, ap);
+	args.count = read_positional_args(format, &args.ap, values, mode_flags);
+	args.values = (args.count >= 0) ? values : NULL;
 
-		slen = strlen(str);
+	for (;;) {
+		/* first, find all characters that are not 0 or '%' */
+		/* then send them to the output directly */
+		const char* p = strchrnul(format + nn, '%');
+		int mm = p - format;
+		if (mm > nn) {
+			Send(buff, format + nn, mm - nn);
+			nn = mm;
+		}
 
-		if (sign != '\0' || prec != -1)
-			__assert("sign/precision unsupported", __FILE__, __LINE__);
+		/* is this it ? then exit */
+		if (*p == '\0')
+			break;
 
-		if (slen < width && !padLeft) {
-			char padChar = padZero ? '0' : ' ';
-			SendRepeat(buff, padChar, width - slen);
+		/* nope, we are at a '%' modifier */
+		struct format_spec spec;
+		nn++;	// skip it
+		parse_format_spec(format, &nn, &spec);
+		if (spec.conversion == '\0') {
+			/* incomplete conversion at the end: send it as it is */
+			Send(buff, p, -1);
+			break;
 		}
 
-		Send(buff, str, slen);
-
-		if (slen < width && padLeft) {
-			char padChar = padZero ? '0' : ' ';
-			SendRepeat(buff, padChar, width - slen);
+		if (spec.width_arg != 0) {
+			int width = (int)get_arg(&args, spec.width_arg, FORMAT_ARG_INT).i;
+			if (width < 0) {
+				spec.flags |= FORMAT_LEFT;
+				width = -width;
+			}
+			spec.width = width;
+		}
+		if (spec.prec_arg != 0) {
+			int prec = (int)get_arg(&args, spec.prec_arg, FORMAT_ARG_INT).i;
+			spec.prec = (prec < 0) ? -1 : prec;
 		}
+		// %n stores nothing here, but a fortified caller still must not
+		// pass it in a format an attacker could have written.
+		if (spec.conversion == 'n' && (mode_flags & PRINTF_FORTIFY) != 0
+				&& __readonly_area(format, strlen(format) + 1) < 0)
+			__libc_fatal("*** %n in writable segment detected ***\n");
+		format_arg(buff, &spec, &args, saved_errno);
 	}
+	va_end(args.ap);
 }
 
 static int open_log_socket(void) {
@@ -393,27 +1188,115 @@ static int open_log_socket(void) {
 	return log_fd;
 }
 
-static int write_stderr(const char* tag, const char* msg) {
+static void log_socket_fork_child(void) {
+	// The descriptor is inherited, but the lock may have been held by a
+	// thread that does not exist in the child.
+	__libc_lock_init(log_socket_lock);
+	atomic_store_relaxed(&log_socket_users[0], 0);
+	atomic_store_relaxed(&log_socket_users[1], 0);
+	__libc_lock_init(log_ring_lock);
+	log_ring.pid = getpid();
+}
+
+static void register_log_fork_handler(void) {
+	if (!log_socket_atfork) {
+		__register_atfork(NULL, NULL, log_socket_fork_child, NULL);
+		log_socket_atfork = true;
+	}
+}
+
+// Registers a writer of log_socket, the descriptor loaded after this
+// stays open until log_socket_put with the returned slot.
+static unsigned int log_socket_get(void) {
+	unsigned int slot = atomic_load_acquire(&log_socket_epoch) & 1;
+	atomic_fetch_add_relaxed(&log_socket_users[slot], 1);
+	// Pairs with the barrier in close_log_socket: either closelog sees
+	// this writer, or the writer sees log_socket already reset.
+	atomic_full_barrier();
+	return slot;
+}
+
+static void log_socket_put(unsigned int slot) {
+	atomic_fetch_add_release(&log_socket_users[slot], -1);
+}
+
+// Returns the current log socket, replacing the connection behind it
+// if it is still stale_fd (-1: not connected yet). Another thread may
+// have reconnected in the meantime, its socket is reused then. The new
+// connection is dup3'ed over the stale descriptor, so writers still
+// holding that number reach logd too, never an unrelated file.
+static int connect_log_socket(int stale_fd) {
+	__libc_lock_lock(log_socket_lock);
+	int fd = atomic_load_relaxed(&log_socket);
+	if (fd == stale_fd) {
+		int new_fd = open_log_socket();
+		if (fd == -1) {
+			fd = new_fd;
+			atomic_store_release(&log_socket, fd);
+		} else if (new_fd != -1) {
+			if (dup3(new_fd, fd, O_CLOEXEC) == -1)
+				fd = -1;
+			close(new_fd);
+		}
+		register_log_fork_handler();
+	}
+	__libc_lock_unlock(log_socket_lock);
+	return fd;
+}
+
+static void close_log_socket(void) {
+	__libc_lock_lock(log_socket_lock);
+	int fd = atomic_load_relaxed(&log_socket);
+	atomic_store_release(&log_socket, -1);
+	unsigned int slot = atomic_load_relaxed(&log_socket_epoch) & 1;
+	atomic_store_release(&log_socket_epoch, log_socket_epoch + 1);
+	atomic_full_barrier();
+	__libc_lock_unlock(log_socket_lock);
+
+	if (fd == -1)
+		return;
+	// New writers count in the other slot and load -1 (or a fresh
+	// socket), so this one only drains; a send is short, the socket is
+	// non-blocking. The lock is not held, a writer that reconnects
+	// must not wait for us.
+	while (atomic_load_acquire(&log_socket_users[slot]) != 0) {
+		struct timespec ts = { 0, 100000 };
+		nanosleep(&ts, NULL);
+	}
+	close(fd);
+}
+
+static int write_stderr(const char* tag, size_t tag_len, const char* msg, size_t msg_len) {
 	struct iovec vec[4];
 	vec[0].iov_base = (char*)tag;
-	vec[0].iov_len = strlen(tag);
+	vec[0].iov_len = tag_len;
 	vec[1].iov_base = (char*)": ";
 	vec[1].iov_len = 2;
 	vec[2].iov_base = (char*)msg;
-	vec[2].iov_len = strlen(msg);
+	vec[2].iov_len = msg_len;
 	vec[3].iov_base = (char*)"\n";
 	vec[3].iov_len = 1;
 
 	return TEMP_FAILURE_RETRY(writev(STDERR_FILENO, vec, 4));
 }
 
-int async_safe_write_log(int priority, const char* tag, const char* msg) {
-	int main_log_fd = open_log_socket();
+// Sends one line to logd. Lengths are known by the callers, nothing is
+// rescanned; msg does not need to be NUL terminated.
+static int write_logd(int priority, const char* tag, size_t tag_len, const char* msg, size_t msg_len) {
+	unsigned int slot = log_socket_get();
+	int main_log_fd = atomic_load_acquire(&log_socket);
 	if (main_log_fd == -1)
+		main_log_fd = connect_log_socket(-1);
+	if (main_log_fd == -1) {
+		log_socket_put(slot);
 		// Try stderr instead.
-		return write_stderr(tag, msg);
+		return write_stderr(tag, tag_len, msg, msg_len);
+	}
+
+	if (tag_len + msg_len + 3 > LOGGER_ENTRY_MAX_PAYLOAD)
+		msg_len = (tag_len + 3 < LOGGER_ENTRY_MAX_PAYLOAD) ? LOGGER_ENTRY_MAX_PAYLOAD - tag_len - 3 : 0;
 
-	struct iovec vec[6];
+	struct iovec vec[7];
 	char log_id = (priority == ANDROID_LOG_FATAL) ? LOG_ID_CRASH : LOG_ID_MAIN;
 	vec[0].iov_base = &log_id;
 	vec[0].iov_len = sizeof(log_id);
@@ -431,21 +1314,174 @@ int async_safe_write_log(int priority, const char* tag, const char* msg) {
 	vec[3].iov_base = &priority;
 	vec[3].iov_len = 1;
 	vec[4].iov_base = (char*)tag;
-	vec[4].iov_len = strlen(tag) + 1;
+	vec[4].iov_len = tag_len + 1;
 	vec[5].iov_base = (char*)msg;
-	vec[5].iov_len = strlen(msg) + 1;
+	vec[5].iov_len = msg_len;
+	vec[6].iov_base = (char*)"";
+	vec[6].iov_len = 1;
 
 	int result = TEMP_FAILURE_RETRY(writev(main_log_fd, vec, sizeof(vec) / sizeof(vec[0])));
-	close(main_log_fd);
+	if (result == -1 && (errno == ECONNREFUSED || errno == ENOTCONN || errno == EBADF)) {
+		// logd restarted (or the descriptor was closed behind our back),
+		// reconnect and try once more.
+		main_log_fd = connect_log_socket(main_log_fd);
+		if (main_log_fd != -1)
+			result = TEMP_FAILURE_RETRY(writev(main_log_fd, vec, sizeof(vec) / sizeof(vec[0])));
+	}
+	log_socket_put(slot);
 	return result;
 }
 
+static int get_log_sink(void) {
+	int sink = atomic_load_relaxed(&log_sink);
+	if (sink == LOG_SINK_UNKNOWN) {
+		const char* env = getenv("SYSLOG_SINK");
+		if (env != NULL && strcmp(env, "ring") == 0)
+			sink = LOG_SINK_RING;
+		else if (env != NULL && strcmp(env, "stderr") == 0)
+			sink = LOG_SINK_STDERR;
+		else
+			sink = LOG_SINK_LOGD;
+		atomic_store_relaxed(&log_sink, sink);
+	}
+	return sink;
+}
+
+// Maps the ring file, creating and initialising it if needed. Only the
+// first line of a process gets here; flock keeps two processes from
+// initialising the same new file.
+static struct log_ring_header* map_log_ring(void) {
+	struct log_ring_header* header = atomic_load_acquire(&log_ring.header);
+	if (header != NULL || log_ring.failed)
+		return header;
+
+	__libc_lock_lock(log_ring_lock);
+	header = log_ring.header;
+	if (header == NULL && !log_ring.failed) {
+		int fd = open(_PATH_LOGRING, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (fd != -1 && flock(fd, LOCK_EX) == 0) {
+			struct stat st;
+			if (fstat(fd, &st) == 0 && st.st_size == 0) {
+				// A new file gets SYSLOG_RING_SIZE bytes of data area,
+				// an existing one keeps the size it was created with.
+				const char* env = getenv("SYSLOG_RING_SIZE");
+				unsigned long size = (env != NULL) ? strtoul(env, NULL, 0) : 0;
+				if (size < 64 * 1024)
+					size = LOG_RING_DEFAULT_SIZE;
+				ftruncate(fd, LOG_RING_DATA_OFFSET + size);
+			}
+			if (fstat(fd, &st) == 0 && st.st_size > LOG_RING_DATA_OFFSET) {
+				void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (map != MAP_FAILED) {
+					header = map;
+					if (header->magic == 0) {
+						header->version = LOG_RING_VERSION;
+						header->size = (st.st_size - LOG_RING_DATA_OFFSET) & ~(uint64_t)7;
+						header->head = 0;
+						atomic_store_release(&header->magic, LOG_RING_MAGIC);
+					}
+					if (header->magic != LOG_RING_MAGIC || header->version != LOG_RING_VERSION
+							|| header->size + LOG_RING_DATA_OFFSET > (uint64_t)st.st_size) {
+						munmap(map, st.st_size);
+						header = NULL;
+					}
+				}
+			}
+			flock(fd, LOCK_UN);
+		}
+		if (fd != -1)
+			close(fd);
+		if (header != NULL) {
+			log_ring.data = (char*)header + LOG_RING_DATA_OFFSET;
+			log_ring.pid = getpid();
+			register_log_fork_handler();
+			atomic_store_release(&log_ring.header, header);
+		} else {
+			log_ring.failed = true;
+		}
+	}
+	__libc_lock_unlock(log_ring_lock);
+	return header;
+}
+
+// Appends one line to the ring: an atomic add reserves the space, the
+// entry is copied in and published by its commit word.
+static int write_log_ring(int priority, const char* tag, size_t tag_len, const char* msg, size_t msg_len) {
+	struct log_ring_header* header = map_log_ring();
+	if (header == NULL)
+		return -1;
+
+	uint64_t size = header->size;
+	if (tag_len > UINT8_MAX)
+		tag_len = UINT8_MAX;
+	// Keep single entries well below the ring size.
+	uint64_t max_msg = size / 4 - sizeof(struct log_ring_entry) - tag_len - 2;
+	if (msg_len > max_msg)
+		msg_len = max_msg;
+	if (msg_len > UINT16_MAX)
+		msg_len = UINT16_MAX;
+	uint32_t len = LOG_RING_ALIGN(sizeof(struct log_ring_entry) + tag_len + msg_len + 2);
+
+	struct log_ring_entry* entry;
+	uint64_t pos;
+	for (;;) {
+		pos = atomic_fetch_add_relaxed(&header->head, len);
+		uint64_t off = pos % size;
+		entry = (struct log_ring_entry*)(log_ring.data + off);
+		if (off + len <= size)
+			break;
+		// Would wrap: leave a padding entry and reserve again.
+		entry->len = len;
+		atomic_store_release(&entry->commit, LOG_RING_COMMIT(pos));
+	}
+
+	// len goes first: if we die before the commit, readers use it to
+	// skip the slot we reserved.
+	atomic_store_relaxed(&entry->commit, 0);
+	atomic_store_relaxed(&entry->len, len);
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	entry->tv_sec = ts.tv_sec;
+	entry->tv_nsec = ts.tv_nsec;
+	entry->pid = log_ring.pid;
+	entry->tid = THREAD_GETMEM(THREAD_SELF, tid);
+	entry->priority = priority;
+	entry->tag_len = tag_len;
+	entry->msg_len = msg_len;
+	memcpy(entry->payload, tag, tag_len);
+	entry->payload[tag_len] = '\0';
+	memcpy(entry->payload + tag_len + 1, msg, msg_len);
+	entry->payload[tag_len + 1 + msg_len] = '\0';
+	atomic_store_release(&entry->commit, LOG_RING_COMMIT(pos));
+	return len;
+}
+
+static int write_log(int priority, const char* tag, size_t tag_len, const char* msg, size_t msg_len) {
+	switch (get_log_sink()) {
+		case LOG_SINK_RING: {
+			int result = write_log_ring(priority, tag, tag_len, msg, msg_len);
+			if (result != -1)
+				return result;
+			return write_stderr(tag, tag_len, msg, msg_len);
+		}
+		case LOG_SINK_STDERR:
+			return write_stderr(tag, tag_len, msg, msg_len);
+		default:
+			return write_logd(priority, tag, tag_len, msg, msg_len);
+	}
+}
+
+int async_safe_write_log(int priority, const char* tag, const char* msg) {
+	return write_log(priority, tag, strlen(tag), msg, strlen(msg));
+}
+
 int async_safe_format_log_va_list(int priority, const char* tag, const char* format, va_list args) {
 	//ErrnoRestorer errno_restorer;
 	char buffer[1024];
 	struct BufferOutputStream os = BufferOutput(buffer, sizeof(buffer));
-	out_vformat(&os, format, args);
-	return async_safe_write_log(priority, tag, buffer);
+	out_vformat(&os, format, args, 0);
+	size_t len = (os.total < sizeof(buffer)) ? os.total : sizeof(buffer) - 1;
+	return write_log(priority, tag, strlen(tag), buffer, len);
 }
 
 int async_safe_format_log(int priority, const char* tag, const char* format, ...) {
@@ -456,10 +1492,508 @@ int async_safe_format_log(int priority, const char* tag, const char* format, ...
 	return result;
 }
 
+// ======================
+// asynchronous writer
+//
+// Opt-in with openlog(..., LOG_ASYNC, ...) or SYSLOG_ASYNC in the
+// environment ("oldest" drops the oldest record when the ring is full,
+// anything else drops the new one). Producers copy the formatted line
+// into a bounded lock-free ring (Vyukov's sequence-numbered queue) and
+// return; a single writer thread drains it and hands whole batches to
+// logd with sendmmsg, so a stalled logd only ever blocks that thread.
+
+enum { ASYNC_LOG_UNKNOWN = -1, ASYNC_LOG_OFF, ASYNC_LOG_DROP_NEWEST, ASYNC_LOG_DROP_OLDEST };
+
+struct async_log_record {
+	char log_id;
+	char priority;
+	uint16_t tid;
+	log_time realtime;
+	uint16_t payload_len;
+	char payload[LOGGER_ENTRY_MAX_PAYLOAD]; // tag\0msg\0
+};
+
+struct async_log_slot {
+	size_t seq;
+	struct async_log_record rec;
+};
+
+static struct {
+	int mode;
+	int started;
+	struct async_log_slot* slots;
+	size_t enqueue_pos;
+	size_t dequeue_pos;
+	unsigned int writer_idle;
+	unsigned int writer_busy;
+	unsigned int dropped;
+	unsigned int dropped_reported;
+} async_log = { .mode = ASYNC_LOG_UNKNOWN };
+
+__libc_lock_define_initialized(static, async_log_lock)
+
+static void async_log_reset_ring(void) {
+	for (size_t i = 0; i < ASYNC_LOG_SLOTS; i++)
+		async_log.slots[i].seq = i;
+	async_log.enqueue_pos = 0;
+	async_log.dequeue_pos = 0;
+}
+
+static bool async_log_pop(struct async_log_record* out) {
+	struct async_log_slot* slot;
+	size_t pos = atomic_load_relaxed(&async_log.dequeue_pos);
+	for (;;) {
+		slot = &async_log.slots[pos & (ASYNC_LOG_SLOTS - 1)];
+		size_t seq = atomic_load_acquire(&slot->seq);
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (dif == 0) {
+			if (atomic_compare_exchange_weak_relaxed(&async_log.dequeue_pos, &pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			return false; // empty
+		} else {
+			pos = atomic_load_relaxed(&async_log.dequeue_pos);
+		}
+	}
+	if (out != NULL)
+		memcpy(out, &slot->rec, offsetof(struct async_log_record, payload) + slot->rec.payload_len);
+	atomic_store_release(&slot->seq, pos + ASYNC_LOG_SLOTS);
+	return true;
+}
+
+static void async_log_send(struct async_log_record* recs, int count) {
+	struct mmsghdr msgs[ASYNC_LOG_BATCH];
+	struct iovec vec[ASYNC_LOG_BATCH][5];
+
+	if (get_log_sink() != LOG_SINK_LOGD) {
+		for (int i = 0; i < count; i++) {
+			const char* tag = recs[i].payload;
+			size_t tag_len = strlen(tag);
+			write_log(recs[i].priority, tag, tag_len, tag + tag_len + 1, recs[i].payload_len - tag_len - 2);
+		}
+		return;
+	}
+
+	unsigned int slot = log_socket_get();
+	int fd = atomic_load_acquire(&log_socket);
+	if (fd == -1)
+		fd = connect_log_socket(-1);
+	if (fd == -1) {
+		log_socket_put(slot);
+		for (int i = 0; i < count; i++) {
+			const char* tag = recs[i].payload;
+			size_t tag_len = strlen(tag);
+			write_stderr(tag, tag_len, tag + tag_len + 1, recs[i].payload_len - tag_len - 2);
+		}
+		return;
+	}
+
+	memset(msgs, 0, sizeof(msgs[0]) * count);
+	for (int i = 0; i < count; i++) {
+		vec[i][0].iov_base = &recs[i].log_id;
+		vec[i][0].iov_len = sizeof(recs[i].log_id);
+		vec[i][1].iov_base = &recs[i].tid;
+		vec[i][1].iov_len = sizeof(recs[i].tid);
+		vec[i][2].iov_base = &recs[i].realtime;
+		vec[i][2].iov_len = sizeof(recs[i].realtime);
+		vec[i][3].iov_base = &recs[i].priority;
+		vec[i][3].iov_len = 1;
+		vec[i][4].iov_base = recs[i].payload;
+		vec[i][4].iov_len = recs[i].payload_len;
+		msgs[i].msg_hdr.msg_iov = vec[i];
+		msgs[i].msg_hdr.msg_iovlen = 5;
+	}
+
+	int sent = 0;
+	bool reconnected = false;
+	while (sent < count) {
+		int n = sendmmsg(fd, msgs + sent, count - sent, 0);
+		if (n > 0) {
+			sent += n;
+		} else if (errno == EINTR) {
+			continue;
+		} else if (errno == EAGAIN) {
+			// logd is behind. Only this thread waits for it.
+			struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+			if (poll(&pfd, 1, 100) <= 0)
+				break;
+		} else if (!reconnected && (errno == ECONNREFUSED || errno == ENOTCONN || errno == EBADF)) {
+			reconnected = true;
+			fd = connect_log_socket(fd);
+			if (fd == -1)
+				break;
+		} else {
+			break;
+		}
+	}
+	log_socket_put(slot);
+	// Whatever logd did not take is lost, report it with the others.
+	if (sent < count)
+		atomic_fetch_add_relaxed(&async_log.dropped, count - sent);
+}
+
+static void* async_log_writer(void* arg) {
+	// Only this thread drains the ring, so one static batch is enough.
+	static struct async_log_record batch[ASYNC_LOG_BATCH];
+	(void) arg;
+
+	for (;;) {
+		atomic_store_relaxed(&async_log.writer_busy, 1);
+		atomic_full_barrier();
+		int count = 0;
+		while (count < ASYNC_LOG_BATCH && async_log_pop(&batch[count]))
+			count++;
+		if (count > 0)
+			async_log_send(batch, count);
+
+		unsigned int dropped = atomic_load_relaxed(&async_log.dropped);
+		if (dropped != async_log.dropped_reported) {
+			async_safe_format_log(ANDROID_LOG_WARN, __progname, "%u syslog messages dropped",
+					dropped - async_log.dropped_reported);
+			async_log.dropped_reported = dropped;
+		}
+		atomic_store_release(&async_log.writer_busy, 0);
+		if (count > 0)
+			continue;
+
+		// Announce the sleep before the last emptiness check, producers
+		// clear writer_idle and wake us after publishing.
+		atomic_store_relaxed(&async_log.writer_idle, 1);
+		atomic_full_barrier();
+		if (atomic_load_relaxed(&async_log.dequeue_pos) == atomic_load_relaxed(&async_log.enqueue_pos))
+			futex_wait_simple(&async_log.writer_idle, 1, FUTEX_PRIVATE);
+		atomic_store_relaxed(&async_log.writer_idle, 0);
+	}
+	return NULL;
+}
+
+static void async_log_wake_writer(void) {
+	atomic_full_barrier();
+	if (atomic_load_relaxed(&async_log.writer_idle)) {
+		atomic_store_relaxed(&async_log.writer_idle, 0);
+		futex_wake(&async_log.writer_idle, 1, FUTEX_PRIVATE);
+	}
+}
+
+// Waits (at most about a second) until everything queued so far has
+// been handed to logd.
+static void async_log_flush(void) {
+	if (!atomic_load_acquire(&async_log.started))
+		return;
+	async_log_wake_writer();
+	for (int i = 0; i < 1000; i++) {
+		atomic_full_barrier();
+		if (atomic_load_relaxed(&async_log.dequeue_pos) == atomic_load_relaxed(&async_log.enqueue_pos)
+				&& atomic_load_relaxed(&async_log.writer_busy) == 0)
+			return;
+		struct timespec ts = { 0, 1000000 };
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void async_log_flush_at_exit(void* arg) {
+	(void) arg;
+	async_log_flush();
+}
+
+static void async_log_fork_child(void) {
+	// The writer thread is gone. Records queued by the parent are its
+	// business, the child starts with an empty ring and a new writer.
+	__libc_lock_init(async_log_lock);
+	if (async_log.started) {
+		async_log_reset_ring();
+		async_log.writer_idle = 0;
+		async_log.writer_busy = 0;
+		async_log.started = 0;
+	}
+}
+
+static bool async_log_start(void) {
+	if (atomic_load_acquire(&async_log.started))
+		return true;
+
+	bool ok = true;
+	__libc_lock_lock(async_log_lock);
+	if (!async_log.started) {
+		if (async_log.slots == NULL) {
+			void* slots = mmap(NULL, sizeof(struct async_log_slot) * ASYNC_LOG_SLOTS,
+					PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (slots == MAP_FAILED) {
+				ok = false;
+			} else {
+				async_log.slots = slots;
+				async_log_reset_ring();
+				__register_atfork(NULL, NULL, async_log_fork_child, NULL);
+				__cxa_atexit(async_log_flush_at_exit, NULL, NULL);
+			}
+		}
+		if (ok) {
+			pthread_t thread;
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+			ok = pthread_create(&thread, &attr, async_log_writer, NULL) == 0;
+			pthread_attr_destroy(&attr);
+		}
+		if (ok)
+			atomic_store_release(&async_log.started, 1);
+	}
+	__libc_lock_unlock(async_log_lock);
+	return ok;
+}
+
+static bool async_log_enabled(void) {
+	int mode = atomic_load_relaxed(&async_log.mode);
+	if (mode == ASYNC_LOG_UNKNOWN) {
+		const char* env = getenv("SYSLOG_ASYNC");
+		if (env == NULL || env[0] == '\0' || strcmp(env, "0") == 0)
+			mode = ASYNC_LOG_OFF;
+		else if (strcmp(env, "oldest") == 0)
+			mode = ASYNC_LOG_DROP_OLDEST;
+		else
+			mode = ASYNC_LOG_DROP_NEWEST;
+		atomic_store_relaxed(&async_log.mode, mode);
+	}
+	if (mode == ASYNC_LOG_OFF && (syslog_options & LOG_ASYNC) != 0)
+		mode = ASYNC_LOG_DROP_NEWEST;
+	return mode != ASYNC_LOG_OFF;
+}
+
+// Queues one line for the writer thread. Returns false if the caller
+// has to log synchronously (the writer could not be started).
+static bool async_log_push(int priority, const char* tag, const char* msg, size_t msg_len) {
+	if (!async_log_start())
+		return false;
+
+	struct async_log_slot* slot;
+	size_t pos = atomic_load_relaxed(&async_log.enqueue_pos);
+	for (;;) {
+		slot = &async_log.slots[pos & (ASYNC_LOG_SLOTS - 1)];
+		size_t seq = atomic_load_acquire(&slot->seq);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (atomic_compare_exchange_weak_relaxed(&async_log.enqueue_pos, &pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			// Full: never wait for logd on the caller's thread.
+			atomic_fetch_add_relaxed(&async_log.dropped, 1);
+			if (atomic_load_relaxed(&async_log.mode) != ASYNC_LOG_DROP_OLDEST)
+				return true;
+			async_log_pop(NULL);
+			pos = atomic_load_relaxed(&async_log.enqueue_pos);
+		} else {
+			pos = atomic_load_relaxed(&async_log.enqueue_pos);
+		}
+	}
+
+	struct async_log_record* rec = &slot->rec;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec->log_id = (priority == ANDROID_LOG_FATAL) ? LOG_ID_CRASH : LOG_ID_MAIN;
+	rec->priority = priority;
+	rec->tid = INTERNAL_SYSCALL_CALL(gettid);
+	rec->realtime.tv_sec = ts.tv_sec;
+	rec->realtime.tv_nsec = ts.tv_nsec;
+	size_t tag_len = strnlen(tag, ASYNC_LOG_TAG_MAX - 1);
+	// The priority byte is sent separately, it still counts for logd.
+	if (tag_len + msg_len + 3 > sizeof(rec->payload))
+		msg_len = sizeof(rec->payload) - tag_len - 3;
+	memcpy(rec->payload, tag, tag_len);
+	rec->payload[tag_len] = '\0';
+	memcpy(rec->payload + tag_len + 1, msg, msg_len);
+	rec->payload[tag_len + 1 + msg_len] = '\0';
+	rec->payload_len = tag_len + msg_len + 2;
+	atomic_store_release(&slot->seq, pos + 1);
+
+	async_log_wake_writer();
+	return true;
+}
+
+// ======================
+// rate limiting
+//
+// Rules come from SYSLOG_RATELIMIT (separated by ';') or, when that is
+// unset, from _PATH_SYSLOG_RATELIMIT (one per line, '#' comments):
+//     <tag|*> <priority|*> <lines per second> <burst>
+// where priority is a syslog level name or number. The first matching
+// rule applies. Every (tag, priority) pair gets its own bucket, kept as a
+// GCRA "theoretical arrival time", so a check is a single CAS done before
+// any formatting. Rejected lines are counted and reported with the next
+// line of the bucket that gets through.
+
+struct log_ratelimit_rule {
+	char tag[ASYNC_LOG_TAG_MAX]; // "" matches any tag
+	int priority; // android priority, -1 matches any
+	uint64_t interval_ns;
+	uint64_t tolerance_ns; // burst * interval
+};
+
+struct log_bucket {
+	uint64_t key; // 0: free
+	const struct log_ratelimit_rule* rule; // NULL: not limited
+	unsigned int ready;
+	uint64_t tat;
+	unsigned int suppressed;
+};
+
+static struct {
+	int loaded;
+	int rule_count;
+	struct log_ratelimit_rule rules[LOG_RATELIMIT_RULES];
+	struct log_bucket buckets[LOG_RATELIMIT_BUCKETS];
+} log_ratelimit;
+__libc_lock_define_initialized(static, log_ratelimit_lock)
+
+static int android_priority_from_syslog(int priority) {
+	if (priority <= LOG_CRIT) // LOG_ALERT LOG_EMERG
+		return ANDROID_LOG_FATAL;
+	else if (priority == LOG_ERR)
+		return ANDROID_LOG_ERROR;
+	else if (priority <= LOG_NOTICE) // LOG_WARNING
+		return ANDROID_LOG_WARN;
+	else if (priority == LOG_INFO)
+		return ANDROID_LOG_INFO;
+	else // LOG_DEBUG
+		return ANDROID_LOG_DEBUG;
+}
+
+static int parse_syslog_level(const char* name) {
+	static const char* const names[] = {
+		"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+	};
+	if (name[0] >= '0' && name[0] <= '7' && name[1] == '\0')
+		return name[0] - '0';
+	for (int i = 0; i < 8; i++)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+	return -1;
+}
+
+static void parse_ratelimit_rule(char* line) {
+	char* saveptr;
+	char* tag = __strtok_r(line, " \t\n", &saveptr);
+	char* level = __strtok_r(NULL, " \t\n", &saveptr);
+	char* rate = __strtok_r(NULL, " \t\n", &saveptr);
+	char* burst = __strtok_r(NULL, " \t\n", &saveptr);
+	if (tag == NULL || tag[0] == '#' || burst == NULL)
+		return;
+	if (log_ratelimit.rule_count == LOG_RATELIMIT_RULES)
+		return;
+
+	unsigned long per_second = strtoul(rate, NULL, 10);
+	unsigned long burst_count = strtoul(burst, NULL, 10);
+	int syslog_level = parse_syslog_level(level);
+	if (per_second == 0 || (strcmp(level, "*") != 0 && syslog_level == -1))
+		return;
+	if (burst_count == 0)
+		burst_count = 1;
+
+	struct log_ratelimit_rule* rule = &log_ratelimit.rules[log_ratelimit.rule_count++];
+	if (strcmp(tag, "*") != 0)
+		strlcpy(rule->tag, tag, sizeof(rule->tag));
+	rule->priority = (syslog_level == -1) ? -1 : android_priority_from_syslog(syslog_level);
+	rule->interval_ns = 1000000000UL / per_second;
+	rule->tolerance_ns = rule->interval_ns * burst_count;
+}
+
+static void load_ratelimit_rules(void) {
+	__libc_lock_lock(log_ratelimit_lock);
+	if (!log_ratelimit.loaded) {
+		char line[256];
+		const char* env = getenv("SYSLOG_RATELIMIT");
+		if (env != NULL) {
+			char rules[1024];
+			char* saveptr;
+			strlcpy(rules, env, sizeof(rules));
+			for (char* rule = __strtok_r(rules, ";", &saveptr); rule != NULL; rule = __strtok_r(NULL, ";", &saveptr)) {
+				strlcpy(line, rule, sizeof(line));
+				parse_ratelimit_rule(line);
+			}
+		} else {
+			FILE* fp = fopen(_PATH_SYSLOG_RATELIMIT, "rce");
+			if (fp != NULL) {
+				while (fgets(line, sizeof(line), fp) != NULL)
+					parse_ratelimit_rule(line);
+				fclose(fp);
+			}
+		}
+		atomic_store_release(&log_ratelimit.loaded, 1);
+	}
+	__libc_lock_unlock(log_ratelimit_lock);
+}
+
+static const struct log_ratelimit_rule* find_ratelimit_rule(const char* tag, int priority) {
+	for (int i = 0; i < log_ratelimit.rule_count; i++) {
+		const struct log_ratelimit_rule* rule = &log_ratelimit.rules[i];
+		if ((rule->tag[0] == '\0' || strcmp(rule->tag, tag) == 0)
+				&& (rule->priority == -1 || rule->priority == priority))
+			return rule;
+	}
+	return NULL;
+}
+
+// Returns the bucket of tag/priority, or NULL if the line is not limited
+// (no rule, or no free bucket left).
+static struct log_bucket* get_log_bucket(const char* tag, int priority) {
+	if (!atomic_load_acquire(&log_ratelimit.loaded))
+		load_ratelimit_rules();
+	if (log_ratelimit.rule_count == 0)
+		return NULL;
+
+	// FNV-1a over the tag, the priority folded in last.
+	uint64_t key = 14695981039346656037ULL;
+	for (const char* p = tag; *p != '\0'; p++)
+		key = (key ^ (unsigned char)*p) * 1099511628211ULL;
+	key = (key ^ priority) * 1099511628211ULL;
+	if (key == 0)
+		key = 1;
+
+	for (size_t i = 0; i < LOG_RATELIMIT_BUCKETS; i++) {
+		struct log_bucket* bucket = &log_ratelimit.buckets[(key + i) % LOG_RATELIMIT_BUCKETS];
+		uint64_t current = atomic_load_acquire(&bucket->key);
+		while (current == 0) {
+			if (atomic_compare_exchange_weak_acquire(&bucket->key, &current, key)) {
+				// Ours now; the rule is matched once per bucket.
+				bucket->rule = find_ratelimit_rule(tag, priority);
+				atomic_store_release(&bucket->ready, 1);
+				return bucket->rule != NULL ? bucket : NULL;
+			}
+		}
+		if (current == key) {
+			// Still being set up by another thread: let the line through.
+			if (!atomic_load_acquire(&bucket->ready) || bucket->rule == NULL)
+				return NULL;
+			return bucket;
+		}
+	}
+	return NULL;
+}
+
+static bool log_bucket_take(struct log_bucket* bucket) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	uint64_t interval = bucket->rule->interval_ns;
+	uint64_t tolerance = bucket->rule->tolerance_ns;
+
+	uint64_t tat = atomic_load_relaxed(&bucket->tat);
+	uint64_t new_tat;
+	do {
+		new_tat = ((tat > now) ? tat : now) + interval;
+		if (new_tat - now > tolerance) {
+			atomic_fetch_add_relaxed(&bucket->suppressed, 1);
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak_relaxed(&bucket->tat, &tat, new_tat));
+	return true;
+}
+
 // ======================
 // syslog functions
 
 void closelog(void) {
+	async_log_flush();
+	close_log_socket();
 	syslog_log_tag = NULL;
 	syslog_options = 0;
 }
@@ -467,6 +2001,13 @@ void closelog(void) {
 void openlog(const char* log_tag, int options, int /*facility*/) {
 	syslog_log_tag = log_tag;
 	syslog_options = options;
+	// LOG_ODELAY is the default: connect with the first message.
+	if ((options & LOG_NDELAY) != 0) {
+		if (get_log_sink() == LOG_SINK_RING)
+			map_log_ring();
+		else if (get_log_sink() == LOG_SINK_LOGD && atomic_load_acquire(&log_socket) == -1)
+			connect_log_socket(-1);
+	}
 }
 
 int setlogmask(int new_mask) {
@@ -478,6 +2019,8 @@ int setlogmask(int new_mask) {
 }
 
 void __vsyslog_internal(int priority, const char* fmt, va_list args, unsigned int mode_flags) {
+	int saved_errno = errno;
+
 	// Check whether we're supposed to be logging messages of this priority.
 	if ((syslog_priority_mask & LOG_MASK(LOG_PRI(priority))) == 0)
 		return;
@@ -489,30 +2032,38 @@ void __vsyslog_internal(int priority, const char* fmt, va_list args, unsigned in
 
 	// What's our Android log priority?
 	priority &= LOG_PRIMASK;
-	int android_log_priority;
-	if (priority <= LOG_CRIT) // LOG_ALERT LOG_EMERG
-		android_log_priority = ANDROID_LOG_FATAL;
-	else if (priority == LOG_ERR)
-		android_log_priority = ANDROID_LOG_ERROR;
-	else if (priority <= LOG_NOTICE) // LOG_WARNING
-		android_log_priority = ANDROID_LOG_WARN;
-	else if (priority == LOG_INFO)
-		android_log_priority = ANDROID_LOG_INFO;
-	else // LOG_DEBUG
-		android_log_priority = ANDROID_LOG_DEBUG;
-
-	// We can't let async_safe_format_log do the formatting because it doesn't
-	// support all the printf functionality.
-	char log_line[1024];
-	int n = __vsnprintf_internal(log_line, sizeof(log_line), fmt, args, mode_flags);
-	if (n < 0) return;
+	int android_log_priority = android_priority_from_syslog(priority);
+
+	// Over the rate limit? Then don't even format the line.
+	struct log_bucket* bucket = get_log_bucket(log_tag, android_log_priority);
+	if (bucket != NULL) {
+		if (!log_bucket_take(bucket)) {
+			errno = saved_errno;
+			return;
+		}
+		unsigned int suppressed = atomic_exchange_relaxed(&bucket->suppressed, 0);
+		if (suppressed != 0)
+			async_safe_format_log(android_log_priority, log_tag, "%u messages suppressed", suppressed);
+	}
 
-	async_safe_format_log(android_log_priority, log_tag, "%s", log_line);
+	// Formatting is async-signal-safe and needs no heap: the line goes
+	// straight into a stack buffer as large as what logd accepts.
+	char line[LOGGER_ENTRY_MAX_PAYLOAD];
+	struct BufferOutputStream os = BufferOutput(line, sizeof(line));
+	errno = saved_errno; // for %m
+	out_vformat(&os, fmt, args, mode_flags);
+	size_t len = (os.total < sizeof(line)) ? os.total : sizeof(line) - 1;
+
+	size_t tag_len = strlen(log_tag);
+	if (!async_log_enabled() || !async_log_push(android_log_priority, log_tag, line, len))
+		write_log(android_log_priority, log_tag, tag_len, line, len);
 	if ((syslog_options & LOG_PERROR) != 0) {
-		bool have_newline =
-				(n > 0 && n < (int)sizeof(log_line) && log_line[n - 1] == '\n');
-		dprintf(STDERR_FILENO, "%s: %s%s", log_tag, log_line, have_newline ? "" : "\n");
+		// write_stderr adds the newline.
+		size_t perror_len = (len > 0 && line[len - 1] == '\n') ? len - 1 : len;
+		write_stderr(log_tag, tag_len, line, perror_len);
 	}
+	// syslog must not clobber errno, sending may have.
+	errno = saved_errno;
 }
 
 void __syslog(int pri, const char *fmt, ...) {
@@ -0,0 +1,92 @@
+/* Cost of selabel_lookup on the file contexts backend for the paths
+   under a directory tree, as a restorecon walk asks for them: one pass
+   over every path, best of 5. Where the prefix index is built in, only
+   the specs whose literal prefix the path starts with run their regex;
+   upstream libselinux tries the specs of the path's stem one by one.
+
+   usage: selabel_lookup [max paths] [root] [file_contexts]
+   Without file_contexts the default of the system is opened.  */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <selinux/label.h>
+#include <selinux/selinux.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+struct path {
+	char* name;
+	mode_t mode;
+};
+
+static struct path* paths;
+static int path_count, path_max;
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int collect(const char* name, const struct stat* st, int flag, struct FTW* ftw) {
+	(void)flag;
+	(void)ftw;
+	paths[path_count].name = strdup(name);
+	paths[path_count].mode = st->st_mode;
+	return paths[path_count].name == NULL || ++path_count == path_max;
+}
+
+int main(int argc, char** argv) {
+	path_max = argc > 1 ? atoi(argv[1]) : 100000;
+	const char* root = argc > 2 ? argv[2] : "/system";
+	struct selinux_opt opts[] = { { SELABEL_OPT_PATH, argc > 3 ? argv[3] : NULL } };
+
+	if (path_max < 1 || (paths = calloc(path_max, sizeof(paths[0]))) == NULL) {
+		fprintf(stderr, "%s: bad path count\n", argv[0]);
+		return 1;
+	}
+	if (nftw(root, collect, 64, FTW_PHYS) < 0 || path_count == 0) {
+		perror(root);
+		return 1;
+	}
+
+	long long start = now_ns();
+	struct selabel_handle* handle = selabel_open(SELABEL_CTX_FILE, opts, argc > 3 ? 1 : 0);
+	if (handle == NULL) {
+		perror("selabel_open");
+		return 1;
+	}
+	printf("selabel_open %9.2f ms, %d paths under %s\n", (now_ns() - start) / 1e6, path_count, root);
+
+	long long best = -1;
+	int unlabeled = 0;
+	for (int pass = 0; pass < 5; pass++) {
+		unlabeled = 0;
+		start = now_ns();
+		for (int i = 0; i < path_count; i++) {
+			char* context;
+			if (selabel_lookup(handle, &context, paths[i].name, paths[i].mode & S_IFMT) == 0)
+				freecon(context);
+			else if (errno == ENOENT)
+				unlabeled++;
+			else {
+				perror(paths[i].name);
+				return 1;
+			}
+		}
+		long long elapsed = now_ns() - start;
+		if (best < 0 || elapsed < best)
+			best = elapsed;
+	}
+	printf("selabel_lookup %7.2f us per path (%d without a context)\n", best / 1e3 / path_count, unlabeled);
+
+	selabel_close(handle);
+	for (int i = 0; i < path_count; i++)
+		free(paths[i].name);
+	free(paths);
+	return 0;
+}
@@ -0,0 +1,130 @@
+/* Cost of selabel_open on the file contexts backend, parsing the text
+   file_contexts and mapping a file_contexts.bin made from it by
+   sefcontext_compile. The contexts are copied to a temporary directory
+   first, so the .bin selinux-compile-contexts keeps for the system file
+   stays out of the first two rows; the last row opens the system file
+   itself, as applications do.
+
+   usage: selabel_open [iterations] [file_contexts]
+   SEFCONTEXT_COMPILE names the compiler, found in PATH by default.  */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <selinux/label.h>
+#include <selinux/selinux.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* default_contexts[] = {
+	"/system/etc/selinux/plat_file_contexts",
+	"/vendor/etc/selinux/vendor_file_contexts",
+	"/etc/selinux/targeted/contexts/files/file_contexts",
+};
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare(const void* a, const void* b) {
+	long long x = *(const long long*)a, y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+static int measure(const char* label, const char* path, int iterations, long long* samples) {
+	struct selinux_opt opts[] = { { SELABEL_OPT_PATH, path } };
+	for (int i = 0; i < iterations; i++) {
+		long long start = now_ns();
+		struct selabel_handle* handle = selabel_open(SELABEL_CTX_FILE, opts, 1);
+		samples[i] = now_ns() - start;
+		if (handle == NULL) {
+			perror(path);
+			return 1;
+		}
+		selabel_close(handle);
+	}
+	qsort(samples, iterations, sizeof(samples[0]), compare);
+	printf("%-18s p50 %9.2f ms  p90 %9.2f ms\n", label, samples[iterations / 2] / 1e6,
+	       samples[iterations * 9 / 10] / 1e6);
+	return 0;
+}
+
+static int copy_file(const char* from, const char* to) {
+	char buf[65536];
+	ssize_t n = 0;
+	int in = open(from, O_RDONLY), out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	while (in >= 0 && out >= 0 && (n = read(in, buf, sizeof(buf))) > 0)
+		if (write(out, buf, n) != n)
+			n = -1;
+	if (in >= 0)
+		close(in);
+	if (out >= 0)
+		close(out);
+	return in < 0 || out < 0 || n < 0 ? -1 : 0;
+}
+
+static int compile(const char* text, const char* bin) {
+	const char* compiler = getenv("SEFCONTEXT_COMPILE");
+	if (compiler == NULL)
+		compiler = "sefcontext_compile";
+	pid_t pid = fork();
+	if (pid == 0) {
+		execlp(compiler, compiler, "-o", bin, text, (char*)NULL);
+		_exit(127);
+	}
+	int status;
+	return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 20;
+	const char* contexts = argc > 2 ? argv[2] : NULL;
+	for (size_t i = 0; contexts == NULL && i < sizeof(default_contexts) / sizeof(default_contexts[0]); i++)
+		if (access(default_contexts[i], R_OK) == 0)
+			contexts = default_contexts[i];
+	long long* samples = malloc(sizeof(samples[0]) * (iterations > 0 ? iterations : 1));
+	if (contexts == NULL || samples == NULL || iterations < 1) {
+		fprintf(stderr, "%s: no readable file_contexts\n", argv[0]);
+		return 1;
+	}
+
+	char dir[] = "/tmp/selabel-bench.XXXXXX";
+	char text[sizeof(dir) + 16], bin[sizeof(dir) + 20];
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(text, sizeof(text), "%s/file_contexts", dir);
+	snprintf(bin, sizeof(bin), "%s/file_contexts.bin", dir);
+
+	int status = 1;
+	if (copy_file(contexts, text) != 0) {
+		perror(contexts);
+		goto out;
+	}
+	printf("%s\n", contexts);
+	if (measure("text", text, iterations, samples) != 0)
+		goto out;
+
+	// label_file.c only takes a .bin that is newer than the text.
+	struct timespec past[2] = { { time(NULL) - 10, 0 }, { time(NULL) - 10, 0 } };
+	utimensat(AT_FDCWD, text, past, 0);
+	if (compile(text, bin) != 0)
+		printf("%-18s (sefcontext_compile failed, set SEFCONTEXT_COMPILE)\n", "file_contexts.bin");
+	else if (measure("file_contexts.bin", text, iterations, samples) != 0)
+		goto out;
+
+	status = measure("system path", contexts, iterations, samples);
+out:
+	unlink(bin);
+	unlink(text);
+	rmdir(dir);
+	free(samples);
+	return status;
+}
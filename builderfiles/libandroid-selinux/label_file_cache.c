@@ -0,0 +1,440 @@
+/*
+ * Prefix index for the file contexts backend.
+ *
+ * label_file.c answers a lookup by trying every spec, last first, until a
+ * regex matches; the stem check only skips specs whose first path
+ * component differs, and most of Android's specs share /system or /data.
+ * A restorecon walk therefore runs hundreds of regexes per path.
+ *
+ * A spec can only match paths that start with the literal text its regex
+ * starts with (libselinux anchors every regex as ^...$).  At init the
+ * literal prefix of every spec is taken from its regex and the specs are
+ * grouped by prefix; a lookup hashes each prefix of the path whose length
+ * some spec prefix has, and merges the matching groups, highest spec index
+ * first.  Only those candidates get their regex run, in the same order
+ * label_file.c uses, so the last matching spec still wins.
+ *
+ * label_file.o is built with selabel_file_init renamed (see
+ * Makefile-android), and the selabel_file_init here wraps the func_lookup
+ * and func_close it installs.  Keys label_file.c would rewrite first
+ * (duplicate or trailing slashes, file_contexts.subs) go to its lookup.
+ *
+ * The wrapper also redirects SELABEL_OPT_PATH.  The file_contexts files
+ * Android passes live on read-only partitions, so no file_contexts.bin
+ * can sit next to them; selinux-compile-contexts copies them (keeping the
+ * mtime) into SELINUX_CACHE_DIR and compiles a .bin beside each copy.  A
+ * copy whose size and mtime still match the system file is opened instead,
+ * and label_file.c then maps its .bin.  Handles opened with
+ * SELABEL_OPT_DIGEST see the digest of the .bin rather than of the text.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "label_internal.h"
+#include "label_file.h"
+#include "regex.h"
+
+int selabel_file_init_uncached(struct selabel_handle *rec,
+			       const struct selinux_opt *opts,
+			       unsigned nopts);
+
+/* Specs sharing one literal prefix. */
+struct prefix_group {
+	const char *prefix;	/* NULL if the slot is unused */
+	uint32_t hash;
+	uint32_t len;
+	uint32_t first;		/* into prefix_index.specs */
+	uint32_t count;
+};
+
+struct prefix_index {
+	struct selabel_handle *rec;
+	struct selabel_lookup_rec *(*lookup) (struct selabel_handle *rec,
+					       const char *key, int type);
+	void (*close) (struct selabel_handle *rec);
+	char *text;			/* the prefixes, NUL-separated */
+	struct prefix_group *groups;	/* open addressing, power of two */
+	uint32_t slots;
+	uint32_t *specs;		/* spec indices, descending per group */
+	unsigned char *has_len;		/* has_len[n]: some prefix is n long */
+	uint32_t max_len;
+	struct prefix_index *next;
+};
+
+/* Few handles are ever open; lookups hold the lock for reading, so a
+ * handle's index cannot be freed under them. */
+static struct prefix_index *indexes;
+static pthread_rwlock_t indexes_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static struct prefix_index *find_index(struct selabel_handle *rec)
+{
+	struct prefix_index *index;
+
+	for (index = indexes; index; index = index->next)
+		if (index->rec == rec)
+			return index;
+	return NULL;
+}
+
+#define HASH_INIT 2166136261u
+#define HASH_STEP(hash, c) (((hash) ^ (unsigned char)(c)) * 16777619u)
+
+/*
+ * Copy the literal text regex starts with to buf and return its length.
+ * Stops at the first metacharacter; a quantifier also takes back the
+ * character it applies to.  An alternation outside any group means the
+ * regex need not start with anything.
+ */
+static size_t literal_prefix(const char *regex, char *buf)
+{
+	const char *c;
+	size_t len = 0;
+	int depth = 0, in_class = 0;
+
+	for (c = regex; *c; c++) {
+		if (*c == '\\') {
+			if (!*++c)
+				break;
+		} else if (in_class) {
+			if (*c == ']')
+				in_class = 0;
+		} else if (*c == '[') {
+			in_class = 1;
+			if (c[1] == '^')
+				c++;
+			if (c[1] == ']')
+				c++;
+		} else if (*c == '(') {
+			depth++;
+		} else if (*c == ')') {
+			depth--;
+		} else if (*c == '|' && depth <= 0) {
+			return 0;
+		}
+	}
+
+	for (c = regex; *c; c++) {
+		switch (*c) {
+		case '?':
+		case '*':
+		case '{':
+			if (len)
+				len--;
+			return len;
+		case '.':
+		case '^':
+		case '$':
+		case '+':
+		case '|':
+		case '[':
+		case ']':
+		case '(':
+		case ')':
+		case '}':
+			return len;
+		case '\\':
+			/* \d, \w, \x.. and friends are not literal. */
+			if (!c[1] || (c[1] >= '0' && c[1] <= '9') ||
+			    (c[1] >= 'a' && c[1] <= 'z') ||
+			    (c[1] >= 'A' && c[1] <= 'Z'))
+				return len;
+			c++;
+			/* fall through */
+		default:
+			buf[len++] = *c;
+		}
+	}
+	return len;
+}
+
+static struct prefix_group *find_group(const struct prefix_index *index,
+				       const char *prefix, uint32_t len,
+				       uint32_t hash)
+{
+	uint32_t i = hash & (index->slots - 1);
+
+	while (index->groups[i].prefix &&
+	       (index->groups[i].hash != hash || index->groups[i].len != len ||
+		memcmp(index->groups[i].prefix, prefix, len) != 0))
+		i = (i + 1) & (index->slots - 1);
+	return &index->groups[i];
+}
+
+static void free_index(struct prefix_index *index)
+{
+	free(index->text);
+	free(index->groups);
+	free(index->specs);
+	free(index->has_len);
+	free(index);
+}
+
+static struct prefix_index *build_index(const struct saved_data *data)
+{
+	struct prefix_index *index;
+	struct prefix_group *group;
+	uint32_t *group_of = NULL, *fill = NULL;
+	size_t text_size = 0, used = 0;
+	uint32_t i, hash, len, total;
+
+	index = calloc(1, sizeof(*index));
+	if (!index)
+		return NULL;
+	for (i = 0; i < data->nspec; i++)
+		text_size += strlen(data->spec_arr[i].regex_str) + 1;
+	index->slots = 16;
+	while (index->slots < 2 * data->nspec)
+		index->slots *= 2;
+
+	index->text = malloc(text_size);
+	index->groups = calloc(index->slots, sizeof(*index->groups));
+	index->specs = malloc(data->nspec * sizeof(*index->specs));
+	group_of = malloc(data->nspec * sizeof(*group_of));
+	if (!index->text || !index->groups || !index->specs || !group_of)
+		goto err;
+
+	for (i = 0; i < data->nspec; i++) {
+		char *prefix = index->text + used;
+
+		len = literal_prefix(data->spec_arr[i].regex_str, prefix);
+		prefix[len] = '\0';
+		for (hash = HASH_INIT; *prefix; prefix++)
+			hash = HASH_STEP(hash, *prefix);
+		group = find_group(index, index->text + used, len, hash);
+		if (!group->prefix) {
+			group->prefix = index->text + used;
+			group->hash = hash;
+			group->len = len;
+			used += len + 1;
+		}
+		group->count++;
+		group_of[i] = group - index->groups;
+		if (len > index->max_len)
+			index->max_len = len;
+	}
+
+	index->has_len = calloc(index->max_len + 1, 1);
+	fill = malloc(index->slots * sizeof(*fill));
+	if (!index->has_len || !fill)
+		goto err;
+	for (i = 0, total = 0; i < index->slots; i++) {
+		group = &index->groups[i];
+		if (!group->prefix)
+			continue;
+		group->first = fill[i] = total;
+		total += group->count;
+		index->has_len[group->len] = 1;
+	}
+	/* Highest index first, the order label_file.c tries them in. */
+	for (i = data->nspec; i-- > 0;)
+		index->specs[fill[group_of[i]]++] = i;
+
+	free(group_of);
+	free(fill);
+	return index;
+
+err:
+	free(group_of);
+	free(fill);
+	free_index(index);
+	return NULL;
+}
+
+/*
+ * Same result as label_file.c's lookup for keys without duplicate or
+ * trailing slashes on a handle without substitutions.
+ */
+static struct selabel_lookup_rec *indexed_lookup(struct selabel_handle *rec,
+						  const char *key, int type)
+{
+	struct saved_data *data = (struct saved_data *)rec->data;
+	struct prefix_index *index;
+	struct selabel_lookup_rec *(*lookup) (struct selabel_handle *rec,
+					       const char *key, int type);
+	const struct prefix_group *groups[64];
+	uint32_t pos[64];
+	struct spec *spec;
+	mode_t mode = (mode_t)type & S_IFMT;
+	uint32_t hash = HASH_INIT, len, count = 0, i, best;
+	int rc;
+
+	pthread_rwlock_rdlock(&indexes_lock);
+	index = find_index(rec);
+	if (!index) {
+		pthread_rwlock_unlock(&indexes_lock);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	len = strlen(key);
+	if (len == 0 || strstr(key, "//") || (len > 1 && key[len - 1] == '/') ||
+	    data->subs || data->dist_subs)
+		goto fallback;
+
+	/* The groups whose prefix starts key, one per prefix length. */
+	for (i = 0; i <= len && i <= index->max_len; i++) {
+		if (index->has_len[i]) {
+			const struct prefix_group *group =
+				find_group(index, key, i, hash);
+
+			if (group->prefix) {
+				if (count == sizeof(groups) / sizeof(groups[0]))
+					goto fallback;
+				groups[count] = group;
+				pos[count++] = 0;
+			}
+		}
+		if (i < len)
+			hash = HASH_STEP(hash, key[i]);
+	}
+
+	for (;;) {
+		/* Next candidate: the highest spec index left in any group. */
+		best = count;
+		for (i = 0; i < count; i++) {
+			if (pos[i] == groups[i]->count)
+				continue;
+			if (best == count ||
+			    index->specs[groups[i]->first + pos[i]] >
+			    index->specs[groups[best]->first + pos[best]])
+				best = i;
+		}
+		if (best == count)
+			break;
+		spec = &data->spec_arr[index->specs[groups[best]->first +
+						     pos[best]++]];
+
+		if (mode && spec->mode && mode != spec->mode)
+			continue;
+		if (compile_regex(spec, NULL) < 0)
+			goto out;
+		rc = regex_match(spec->regex, key, false);
+		if (rc == REGEX_NO_MATCH)
+			continue;
+		if (rc != REGEX_MATCH) {
+			errno = ENOENT;
+			goto out;
+		}
+		__atomic_store_n(&spec->any_matches, true, __ATOMIC_RELAXED);
+		if (strcmp(spec->lr.ctx_raw, "<<none>>") == 0) {
+			errno = ENOENT;
+			goto out;
+		}
+		pthread_rwlock_unlock(&indexes_lock);
+		errno = 0;
+		return &spec->lr;
+	}
+	errno = ENOENT;
+out:
+	pthread_rwlock_unlock(&indexes_lock);
+	return NULL;
+
+fallback:
+	lookup = index->lookup;
+	pthread_rwlock_unlock(&indexes_lock);
+	return lookup(rec, key, type);
+}
+
+static void indexed_close(struct selabel_handle *rec)
+{
+	struct prefix_index **p, *index = NULL;
+
+	pthread_rwlock_wrlock(&indexes_lock);
+	for (p = &indexes; *p; p = &(*p)->next) {
+		if ((*p)->rec == rec) {
+			index = *p;
+			*p = index->next;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&indexes_lock);
+	if (!index)
+		return;
+
+	index->close(rec);
+	free_index(index);
+}
+
+#ifdef SELINUX_CACHE_DIR
+/*
+ * Return the copy of path in SELINUX_CACHE_DIR ('/' in path becomes '_'),
+ * written to buf, if it is still current; path itself otherwise.
+ */
+static const char *compiled_copy(const char *path, char *buf, size_t size)
+{
+	struct stat orig, copy;
+	size_t len = sizeof(SELINUX_CACHE_DIR);
+	const char *p;
+
+	if (!path || path[0] != '/' || len + strlen(path) > size)
+		return path;
+	memcpy(buf, SELINUX_CACHE_DIR "/", len);
+	for (p = path + 1; *p; p++)
+		buf[len++] = *p == '/' ? '_' : *p;
+	buf[len] = '\0';
+
+	if (stat(path, &orig) || stat(buf, &copy))
+		return path;
+	if (orig.st_size != copy.st_size ||
+	    orig.st_mtim.tv_sec != copy.st_mtim.tv_sec ||
+	    orig.st_mtim.tv_nsec != copy.st_mtim.tv_nsec)
+		return path;
+	return buf;
+}
+#endif
+
+int selabel_file_init(struct selabel_handle *rec,
+		      const struct selinux_opt *opts,
+		      unsigned nopts)
+{
+	struct prefix_index *index;
+	struct saved_data *data;
+	int rc;
+
+#ifdef SELINUX_CACHE_DIR
+	struct selinux_opt local_opts[nopts ? nopts : 1];
+	/* Android passes one SELABEL_OPT_PATH per partition. */
+	char copy_paths[nopts ? nopts : 1][PATH_MAX];
+	unsigned i;
+
+	for (i = 0; i < nopts; i++) {
+		local_opts[i] = opts[i];
+		if (opts[i].type == SELABEL_OPT_PATH)
+			local_opts[i].value = compiled_copy(opts[i].value,
+							    copy_paths[i],
+							    sizeof(copy_paths[i]));
+	}
+	if (nopts)
+		opts = local_opts;
+#endif
+
+	rc = selabel_file_init_uncached(rec, opts, nopts);
+	if (rc)
+		return rc;
+
+	/* Without memory for the index the handle still works, unindexed. */
+	data = (struct saved_data *)rec->data;
+	if (!data->nspec)
+		return 0;
+	index = build_index(data);
+	if (!index)
+		return 0;
+	index->rec = rec;
+	index->lookup = rec->func_lookup;
+	index->close = rec->func_close;
+
+	pthread_rwlock_wrlock(&indexes_lock);
+	index->next = indexes;
+	indexes = index;
+	pthread_rwlock_unlock(&indexes_lock);
+
+	rec->func_lookup = indexed_lookup;
+	rec->func_close = indexed_close;
+	return 0;
+}
@@ -3,8 +3,8 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_MODULE    := installer
-LOCAL_SRC_FILES := main.c
+LOCAL_SRC_FILES := main.c extract.c install.c journal.c manifest.c screen.c
 LOCAL_CFLAGS    := -Wall
-LOCAL_LDLIBS    := -llog -landroid
+LOCAL_LDLIBS    := -llog -landroid -lz
 
 include $(BUILD_EXECUTABLE)
\ No newline at end of file
@@ -0,0 +1,856 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+
+#include "extract.h"
+#include "journal.h"
+
+// zip 格式常量
+#define ZIP_EOCD_SIG 0x06054b50
+#define ZIP_EOCD_SIZE 22
+#define ZIP_CDIR_SIG 0x02014b50
+#define ZIP_CDIR_SIZE 46
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_METHOD_STORE 0
+#define ZIP_METHOD_DEFLATE 8
+#define ZIP_FLAG_ENCRYPTED 0x0001
+#define ZIP_HOST_UNIX 3
+
+// 每个线程的输出缓冲区
+#define WRITE_BUFFER_SIZE (256 * 1024)
+// 进度刷新间隔（毫秒）
+#define PROGRESS_INTERVAL_MS 100
+#define INFLATE_CORRUPT -2
+// 解压时的临时文件后缀，写完后 rename 到最终位置
+// 后面再接安装包名和解压线程编号："<路径>.ssb-part.<安装包>.<线程>"，
+// 几个组件同时装到同一目录、或同一个包里有重名条目时临时文件也不会撞上
+#define PART_SUFFIX ".ssb-part"
+// 每装好这么多文件同步一次文件系统，再把它们写进日志
+#define JOURNAL_SYNC_BATCH 256
+// 检查符号链接目标时最多展开这么多次链接，再多按循环拒绝（与内核的 ELOOP 上限相同）
+#define LINK_EXPAND_MAX 40
+
+// 中央目录中的一个条目
+struct ZipEntry {
+    char* name;
+    const unsigned char* data;  // 指向映射中的压缩数据
+    uint32_t compressed_size;
+    uint32_t size;
+    uint32_t crc;
+    uint16_t method;
+    mode_t mode;
+    time_t mtime;
+    char* link_target;  // 符号链接的目标，开始解压前读出并检查过
+};
+
+// 解压任务的共享状态
+struct Extractor {
+    const char* dest;
+    const char* archive_name;  // 安装包文件名，用于日志和临时文件名
+    struct ZipEntry* entries;
+    unsigned int entry_count;
+
+    atomic_uint next;  // 下一个要领取的条目
+    atomic_uint workers;  // 已经启动的解压线程数，用来给线程编号
+    atomic_ullong done_bytes;
+    atomic_uint done_files;
+    atomic_uint skipped_files;
+    atomic_int failed;
+
+    struct Journal journal;
+    int dest_fd;  // 安装目录，用于 syncfs
+    // 已经就位、还没同步到磁盘的文件，同步之后才写日志（由 journal_lock 保护）
+    pthread_mutex_t journal_lock;
+    const struct ZipEntry* pending[JOURNAL_SYNC_BATCH];
+    unsigned int pending_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int running;  // 仍在运行的线程数
+    char* err;
+    size_t err_size;
+};
+
+static uint16_t get16(const unsigned char* p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// 记录第一个错误，其余线程看到 failed 后停止领取任务
+static void set_error(struct Extractor* ex, const char* path, const char* message) {
+    pthread_mutex_lock(&ex->lock);
+    if (!atomic_load(&ex->failed)) {
+        snprintf(ex->err, ex->err_size, "%s: %s", path, message);
+        atomic_store(&ex->failed, 1);
+    }
+    pthread_mutex_unlock(&ex->lock);
+}
+
+// DOS 日期时间（本地时间）转 time_t
+static time_t dos_time(uint16_t date, uint16_t time) {
+    struct tm tm = {0};
+    tm.tm_year = ((date >> 9) & 0x7f) + 80;
+    tm.tm_mon = ((date >> 5) & 0x0f) - 1;
+    tm.tm_mday = date & 0x1f;
+    tm.tm_hour = (time >> 11) & 0x1f;
+    tm.tm_min = (time >> 5) & 0x3f;
+    tm.tm_sec = (time & 0x1f) * 2;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+// 拒绝绝对路径和含 ".." 的路径，防止写到安装目录之外
+static int safe_name(const char* name) {
+    if (name[0] == '/' || name[0] == '\0') return 0;
+    for (const char* p = name; *p; ) {
+        const char* end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 2 && p[0] == '.' && p[1] == '.') return 0;
+        if (!end) break;
+        p = end + 1;
+    }
+    return 1;
+}
+
+// 逐级创建目录，已存在不算错误
+static int make_dirs(char* path, mode_t mode) {
+    for (char* p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        int ret = mkdir(path, 0755);
+        *p = '/';
+        if (ret != 0 && errno != EEXIST) return -1;
+    }
+    if (mkdir(path, mode) != 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+// 从文件尾部向前找中央目录结束记录（后面可能跟着最长 64K 的注释），取出中央目录的位置
+// 成功返回 NULL；失败返回原因
+static const char* find_central_directory(const unsigned char* map, size_t size,
+                                          const unsigned char** cdir, const unsigned char** end,
+                                          unsigned int* count) {
+    const unsigned char* eocd = NULL;
+    if (size >= ZIP_EOCD_SIZE) {
+        size_t min = size > ZIP_EOCD_SIZE + 0xffff ? size - ZIP_EOCD_SIZE - 0xffff : 0;
+        for (size_t i = size - ZIP_EOCD_SIZE + 1; i-- > min; ) {
+            if (get32(map + i) == ZIP_EOCD_SIG) {
+                eocd = map + i;
+                break;
+            }
+        }
+    }
+    if (!eocd) return "not a zip archive";
+
+    uint16_t entries = get16(eocd + 10);
+    uint32_t cdir_size = get32(eocd + 12);
+    uint32_t cdir_offset = get32(eocd + 16);
+    if (entries == 0xffff || cdir_offset == 0xffffffff) return "zip64 archives are not supported";
+    if ((size_t)cdir_offset + cdir_size > size) return "corrupt central directory";
+
+    *cdir = map + cdir_offset;
+    *end = *cdir + cdir_size;
+    *count = entries;
+    return NULL;
+}
+
+// 解析中央目录，目录条目直接在这里创建
+static int read_central_directory(struct Extractor* ex, const unsigned char* map, size_t size,
+                                  unsigned long long* total_bytes) {
+    const unsigned char* p;
+    const unsigned char* end;
+    unsigned int count;
+    const char* message = find_central_directory(map, size, &p, &end, &count);
+    if (message) {
+        snprintf(ex->err, ex->err_size, "%s", message);
+        return -1;
+    }
+
+    ex->entries = calloc(count ? count : 1, sizeof(struct ZipEntry));
+    if (!ex->entries) {
+        snprintf(ex->err, ex->err_size, "out of memory");
+        return -1;
+    }
+
+    char path[PATH_MAX];
+    for (unsigned int i = 0; i < count; i++) {
+        if (p + ZIP_CDIR_SIZE > end || get32(p) != ZIP_CDIR_SIG) {
+            snprintf(ex->err, ex->err_size, "corrupt central directory");
+            return -1;
+        }
+        uint16_t flags = get16(p + 8);
+        uint16_t name_len = get16(p + 28);
+        size_t entry_size = ZIP_CDIR_SIZE + name_len + get16(p + 30) + get16(p + 32);
+        uint32_t local_offset = get32(p + 42);
+        if (p + entry_size > end || (size_t)local_offset + ZIP_LOCAL_SIZE > size
+            || get32(map + local_offset) != ZIP_LOCAL_SIG) {
+            snprintf(ex->err, ex->err_size, "corrupt central directory");
+            return -1;
+        }
+
+        struct ZipEntry* e = &ex->entries[ex->entry_count];
+        e->name = strndup((const char*)p + ZIP_CDIR_SIZE, name_len);
+        if (!e->name) {
+            snprintf(ex->err, ex->err_size, "out of memory");
+            return -1;
+        }
+        e->method = get16(p + 10);
+        e->mtime = dos_time(get16(p + 14), get16(p + 12));
+        e->crc = get32(p + 16);
+        e->compressed_size = get32(p + 20);
+        e->size = get32(p + 24);
+        e->mode = p[5] == ZIP_HOST_UNIX ? (mode_t)(get32(p + 38) >> 16) : 0;
+
+        size_t data_offset = (size_t)local_offset + ZIP_LOCAL_SIZE
+            + get16(map + local_offset + 26) + get16(map + local_offset + 28);
+        if (data_offset + e->compressed_size > size) {
+            snprintf(ex->err, ex->err_size, "%s: truncated archive", e->name);
+            free(e->name);
+            return -1;
+        }
+        e->data = map + data_offset;
+        p += entry_size;
+
+        if (!safe_name(e->name)) {
+            snprintf(ex->err, ex->err_size, "%s: unsafe path in archive", e->name);
+            free(e->name);
+            return -1;
+        }
+        if (flags & ZIP_FLAG_ENCRYPTED) {
+            snprintf(ex->err, ex->err_size, "%s: encrypted entries are not supported", e->name);
+            free(e->name);
+            return -1;
+        }
+
+        size_t len = strlen(e->name);
+        if (len > 0 && e->name[len - 1] == '/') {
+            // 目录条目
+            snprintf(path, sizeof(path), "%s/%s", ex->dest, e->name);
+            mode_t mode = e->mode & 07777 ? e->mode & 07777 : 0755;
+            if (make_dirs(path, mode) != 0) {
+                snprintf(ex->err, ex->err_size, "%s: %s", path, strerror(errno));
+                free(e->name);
+                return -1;
+            }
+            free(e->name);
+            continue;
+        }
+        if (e->method != ZIP_METHOD_STORE && e->method != ZIP_METHOD_DEFLATE) {
+            snprintf(ex->err, ex->err_size, "%s: unsupported compression method %u", e->name, e->method);
+            free(e->name);
+            return -1;
+        }
+
+        // 文件的上级目录也在这里建好，线程里不再处理
+        snprintf(path, sizeof(path), "%s/%s", ex->dest, e->name);
+        char* slash = strrchr(path, '/');
+        *slash = '\0';
+        if (make_dirs(path, 0755) != 0) {
+            snprintf(ex->err, ex->err_size, "%s: %s", path, strerror(errno));
+            free(e->name);
+            return -1;
+        }
+
+        *total_bytes += e->size;
+        ex->entry_count++;
+    }
+    return 0;
+}
+
+// 把 data 全部写入 fd
+static int write_all(int fd, const unsigned char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// 解压一个条目，输出到 fd（fd 为 -1 时只解压到 buffer，供符号链接使用）
+// 返回 0 成功，-1 为 I/O 错误（见 errno），INFLATE_CORRUPT 为数据损坏
+static int inflate_entry(struct Extractor* ex, const struct ZipEntry* e, int fd,
+                         unsigned char* buffer, size_t buffer_size) {
+    uLong crc = crc32(0, Z_NULL, 0);
+
+    if (e->method == ZIP_METHOD_STORE) {
+        const unsigned char* data = e->data;
+        size_t left = e->size;
+        while (left > 0) {
+            size_t chunk = left < buffer_size ? left : buffer_size;
+            crc = crc32(crc, data, chunk);
+            if (fd >= 0 && write_all(fd, data, chunk) != 0) return -1;
+            if (fd < 0) memcpy(buffer, data, chunk);
+            atomic_fetch_add(&ex->done_bytes, chunk);
+            data += chunk;
+            left -= chunk;
+        }
+    } else {
+        z_stream zs = {0};
+        if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+            errno = ENOMEM;
+            return -1;
+        }
+        zs.next_in = (Bytef*)e->data;
+        zs.avail_in = e->compressed_size;
+        int ret;
+        do {
+            zs.next_out = buffer;
+            zs.avail_out = buffer_size;
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+                inflateEnd(&zs);
+                return INFLATE_CORRUPT;
+            }
+            size_t produced = buffer_size - zs.avail_out;
+            crc = crc32(crc, buffer, produced);
+            if (fd >= 0 && write_all(fd, buffer, produced) != 0) {
+                inflateEnd(&zs);
+                return -1;
+            }
+            atomic_fetch_add(&ex->done_bytes, produced);
+            if (fd < 0 && ret != Z_STREAM_END) {
+                // 符号链接目标必须放得进一个缓冲区
+                inflateEnd(&zs);
+                errno = ENAMETOOLONG;
+                return -1;
+            }
+        } while (ret != Z_STREAM_END);
+        uLong total = zs.total_out;
+        inflateEnd(&zs);
+        if (total != e->size) return INFLATE_CORRUPT;
+    }
+
+    if (crc != e->crc) return INFLATE_CORRUPT;
+    return 0;
+}
+
+// 读一遍已安装的文件，核对内容的 CRC32 是否与安装包一致
+static int same_content(const char* path, const struct ZipEntry* e, unsigned char* buffer) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    uLong crc = crc32(0, Z_NULL, 0);
+    size_t total = 0;
+    for (;;) {
+        ssize_t n = read(fd, buffer, WRITE_BUFFER_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(fd);
+            return n == 0 && total == e->size && crc == e->crc;
+        }
+        crc = crc32(crc, buffer, n);
+        total += n;
+    }
+}
+
+// 把安装目录所在的文件系统同步到磁盘，之前 rename 就位的文件内容和目录项都落盘
+// bionic 到 API 28 才有 syncfs()，直接用系统调用
+static int sync_dest(struct Extractor* ex) {
+    if (ex->dest_fd < 0) return -1;
+    return syscall(SYS_syncfs, ex->dest_fd) == 0 ? 0 : -1;
+}
+
+// 同步之后把一批文件写进日志；同步失败就不记，下次安装时读文件核对 CRC
+// 这样断电后日志里有记录的文件一定是完整的，不会把大小和时间对、内容全是 0 的文件当成已装好
+static void journal_commit(struct Extractor* ex, const struct ZipEntry* const* entries,
+                           unsigned int count) {
+    if (count == 0 || sync_dest(ex) != 0) return;
+    for (unsigned int i = 0; i < count; i++) {
+        const struct ZipEntry* e = entries[i];
+        journal_append(&ex->journal, e->name, e->crc, e->size, e->mtime);
+    }
+}
+
+// 记下一个已经就位的文件，攒够一批后同步并写日志（在解压线程上调用）
+static void journal_defer(struct Extractor* ex, const struct ZipEntry* e) {
+    const struct ZipEntry* batch[JOURNAL_SYNC_BATCH];
+    unsigned int count = 0;
+
+    pthread_mutex_lock(&ex->journal_lock);
+    ex->pending[ex->pending_count++] = e;
+    if (ex->pending_count == JOURNAL_SYNC_BATCH) {
+        count = ex->pending_count;
+        memcpy(batch, ex->pending, sizeof(batch));
+        ex->pending_count = 0;
+    }
+    pthread_mutex_unlock(&ex->journal_lock);
+
+    // 同步比较慢，不占着锁，其他线程照常解压
+    journal_commit(ex, batch, count);
+}
+
+// 已安装的文件是否与安装包中的条目相同，相同则可以跳过
+// 先比较大小和修改时间；日志里有记录的文件信任记录（记录都是数据落盘后才写的），没有记录的才读文件核对 CRC
+static int entry_unchanged(struct Extractor* ex, const struct ZipEntry* e, const char* path,
+                           mode_t mode, unsigned char* buffer) {
+    struct stat st;
+    if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode)
+        || (uint32_t)st.st_size != e->size || st.st_mtime != e->mtime) {
+        return 0;
+    }
+
+    const struct JournalRecord* record = journal_find(&ex->journal, e->name);
+    if (record) {
+        if (record->crc != e->crc || record->size != e->size || record->mtime != e->mtime) return 0;
+    } else {
+        // 上次安装在 rename 之后、写日志之前被中断，或者日志丢失
+        if (!same_content(path, e, buffer)) return 0;
+        journal_defer(ex, e);
+    }
+
+    if ((st.st_mode & 07777) != mode) chmod(path, mode);
+    return 1;
+}
+
+// 解压一个文件或符号链接
+// 先写到同目录下的临时文件，完成后 rename 到最终位置，中途被杀也不会留下写了一半的文件
+static int extract_entry(struct Extractor* ex, const struct ZipEntry* e, unsigned int worker,
+                         unsigned char* buffer) {
+    char path[PATH_MAX];
+    char part[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", ex->dest, e->name);
+    if (snprintf(part, sizeof(part), "%s" PART_SUFFIX ".%s.%u", path, ex->archive_name, worker)
+        >= (int)sizeof(part)) {
+        set_error(ex, path, strerror(ENAMETOOLONG));
+        return -1;
+    }
+
+    if (S_ISLNK(e->mode)) {
+        // 链接目标没变就不动它
+        char target[PATH_MAX];
+        ssize_t len = readlink(path, target, sizeof(target));
+        if (len == (ssize_t)e->size && memcmp(target, e->link_target, len) == 0) {
+            atomic_fetch_add(&ex->skipped_files, 1);
+            return 0;
+        }
+
+        unlink(part);
+        if (symlink(e->link_target, part) != 0 || rename(part, path) != 0) {
+            set_error(ex, path, strerror(errno));
+            unlink(part);
+            return -1;
+        }
+        return 0;
+    }
+
+    mode_t mode = e->mode & 07777 ? e->mode & 07777 : 0644;
+    if (entry_unchanged(ex, e, path, mode, buffer)) {
+        atomic_fetch_add(&ex->done_bytes, e->size);
+        atomic_fetch_add(&ex->skipped_files, 1);
+        return 0;
+    }
+
+    int fd = open(part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd < 0) {
+        set_error(ex, path, strerror(errno));
+        return -1;
+    }
+
+    // 预分配空间：减少碎片，空间不足时在写之前就失败
+    if (e->size > 0) {
+        int alloc = posix_fallocate(fd, 0, e->size);
+        if (alloc == ENOSPC) {
+            close(fd);
+            unlink(part);
+            set_error(ex, path, strerror(alloc));
+            return -1;
+        }
+    }
+
+    int ret = inflate_entry(ex, e, fd, buffer, WRITE_BUFFER_SIZE);
+    if (ret != 0) {
+        set_error(ex, path, ret == INFLATE_CORRUPT ? "corrupt data in archive" : strerror(errno));
+        close(fd);
+        unlink(part);
+        return -1;
+    }
+
+    struct timespec times[2] = {
+        { .tv_sec = e->mtime },
+        { .tv_sec = e->mtime },
+    };
+    fchmod(fd, mode);
+    futimens(fd, times);
+    if (close(fd) != 0) {
+        set_error(ex, path, strerror(errno));
+        unlink(part);
+        return -1;
+    }
+
+    // rename 会替换掉旧文件，正在运行的程序也不受影响
+    if (rename(part, path) != 0) {
+        set_error(ex, path, strerror(errno));
+        unlink(part);
+        return -1;
+    }
+    // 文件就位之后再记日志，同步到磁盘前只记在内存里
+    journal_defer(ex, e);
+    return 0;
+}
+
+// 条目名 name 是否就是 path（len 字节，各段之间一个 /），忽略 name 里多余的 / 和 "."
+static int same_path(const char* name, const char* path, size_t len) {
+    const char* end = path + len;
+    for (;;) {
+        while (*name == '/' || (name[0] == '.' && (name[1] == '/' || name[1] == '\0'))) name++;
+        if (*name == '\0') return path == end;
+        size_t n = strcspn(name, "/");
+        if ((size_t)(end - path) < n || memcmp(name, path, n) != 0) return 0;
+        if (path + n != end && path[n] != '/') return 0;
+        name += n;
+        path += n;
+        if (path != end) path++;
+    }
+}
+
+// 去掉 path 的最后一段
+static size_t parent_len(const char* path, size_t len) {
+    while (len > 0 && path[len - 1] != '/') len--;
+    return len > 0 ? len - 1 : 0;
+}
+
+// 从链接所在目录出发逐段解析目标，途经安装包里的其他符号链接时换成它们的目标，
+// 任何一步回到安装目录之上就不安全。目标里可以有 ".."，如 "lib/a.so -> ../b/a.so"
+// 只看安装包本身：安装目录里原有的符号链接不在检查之内
+static int link_stays_inside(const struct ZipEntry* link, struct ZipEntry* const* links, unsigned int link_count) {
+    char resolved[PATH_MAX];  // 已解析的部分，相对于安装目录
+    size_t len = 0;
+    char rest[2 * PATH_MAX], next_rest[2 * PATH_MAX];  // 还没解析的部分
+    size_t name_len = strlen(link->name);
+    while (name_len > 0 && link->name[name_len - 1] == '/') name_len--;
+    int n = snprintf(rest, sizeof(rest), "%.*s/%s", (int)parent_len(link->name, name_len), link->name,
+                     link->link_target);
+    if (n < 0 || (size_t)n >= sizeof(rest)) return 0;
+
+    int expanded = 0;
+    const char* p = rest;
+    while (*p) {
+        size_t part = strcspn(p, "/");
+        const char* next = p[part] ? p + part + 1 : p + part;
+        if (part == 0 || (part == 1 && p[0] == '.')) {
+            p = next;
+            continue;
+        }
+        if (part == 2 && p[0] == '.' && p[1] == '.') {
+            if (len == 0) return 0;
+            len = parent_len(resolved, len);
+            p = next;
+            continue;
+        }
+        if (len + 1 + part >= sizeof(resolved)) return 0;
+        if (len > 0) resolved[len++] = '/';
+        memcpy(resolved + len, p, part);
+        len += part;
+        p = next;
+
+        struct ZipEntry* const* l = links;
+        while (l < links + link_count && !same_path((*l)->name, resolved, len)) l++;
+        if (l == links + link_count) continue;
+        // 换成那个链接的目标，从链接所在目录接着解析
+        if (++expanded > LINK_EXPAND_MAX || (*l)->link_target[0] == '/') return 0;
+        len = parent_len(resolved, len);
+        n = snprintf(next_rest, sizeof(next_rest), "%s/%s", (*l)->link_target, p);
+        if (n < 0 || (size_t)n >= sizeof(next_rest)) return 0;
+        memcpy(rest, next_rest, n + 1);
+        p = rest;
+    }
+    return 1;
+}
+
+// 读出所有符号链接的目标并检查，指向安装目录之外的链接在写任何文件之前就拒绝
+// 否则 "a -> /somewhere" 之后的 "a/f" 会写到 /somewhere/f
+static int read_link_targets(struct Extractor* ex) {
+    unsigned char* buffer = NULL;
+    struct ZipEntry** links = NULL;
+    unsigned int link_count = 0;
+    const struct ZipEntry* failed = NULL;
+    const char* message = NULL;
+
+    // 先读出全部目标，解析一个链接时可能要用到其他链接的目标
+    for (unsigned int i = 0; i < ex->entry_count && !message; i++) {
+        struct ZipEntry* e = &ex->entries[i];
+        if (!S_ISLNK(e->mode)) continue;
+
+        failed = e;
+        if (e->size >= PATH_MAX) {
+            message = strerror(ENAMETOOLONG);
+        } else if (!buffer && !(buffer = malloc(WRITE_BUFFER_SIZE + 1))) {
+            message = strerror(ENOMEM);
+        } else if (!links && !(links = malloc(ex->entry_count * sizeof(*links)))) {
+            message = strerror(ENOMEM);
+        } else {
+            // 读出的字节计入进度，解压线程不会再读一次
+            int ret = inflate_entry(ex, e, -1, buffer, WRITE_BUFFER_SIZE);
+            if (ret != 0) {
+                message = ret == INFLATE_CORRUPT ? "corrupt data in archive" : strerror(errno);
+            } else {
+                buffer[e->size] = '\0';
+                if (strlen((const char*)buffer) != e->size || buffer[0] == '/' || buffer[0] == '\0') {
+                    message = "unsafe symlink target in archive";
+                } else if (!(e->link_target = strdup((const char*)buffer))) {
+                    message = strerror(ENOMEM);
+                } else {
+                    links[link_count++] = e;
+                }
+            }
+        }
+    }
+    for (unsigned int i = 0; i < link_count && !message; i++) {
+        failed = links[i];
+        if (!link_stays_inside(links[i], links, link_count)) message = "unsafe symlink target in archive";
+    }
+
+    if (message) snprintf(ex->err, ex->err_size, "%s: %s", failed->name, message);
+    free(links);
+    free(buffer);
+    return message ? -1 : 0;
+}
+
+// 解压线程：每次领取一个文件
+static void* extract_worker(void* arg) {
+    struct Extractor* ex = arg;
+    unsigned int worker = atomic_fetch_add(&ex->workers, 1);
+    unsigned char* buffer = malloc(WRITE_BUFFER_SIZE + 1);
+
+    if (!buffer) {
+        set_error(ex, "buffer", strerror(ENOMEM));
+    } else {
+        while (!atomic_load(&ex->failed)) {
+            unsigned int i = atomic_fetch_add(&ex->next, 1);
+            if (i >= ex->entry_count) break;
+            if (extract_entry(ex, &ex->entries[i], worker, buffer) != 0) break;
+            atomic_fetch_add(&ex->done_files, 1);
+        }
+        free(buffer);
+    }
+
+    pthread_mutex_lock(&ex->lock);
+    ex->running--;
+    pthread_cond_signal(&ex->finished);
+    pthread_mutex_unlock(&ex->lock);
+    return NULL;
+}
+
+// 安装成功后按本次安装包的内容重写日志
+static void compact_journal(struct Extractor* ex) {
+    struct JournalRecord* records = calloc(ex->entry_count ? ex->entry_count : 1,
+                                           sizeof(struct JournalRecord));
+    if (!records) return;
+    size_t count = 0;
+    for (unsigned int i = 0; i < ex->entry_count; i++) {
+        const struct ZipEntry* e = &ex->entries[i];
+        if (S_ISLNK(e->mode)) continue;
+        records[count].name = e->name;
+        records[count].crc = e->crc;
+        records[count].size = e->size;
+        records[count].mtime = e->mtime;
+        count++;
+    }
+    journal_compact(&ex->journal, records, count);
+    free(records);
+}
+
+static void report(struct Extractor* ex, struct ExtractProgress* progress,
+                   ExtractProgressFn progress_fn, void* arg) {
+    if (!progress_fn) return;
+    progress->done_bytes = atomic_load(&ex->done_bytes);
+    progress->done_files = atomic_load(&ex->done_files);
+    progress->skipped_files = atomic_load(&ex->skipped_files);
+    progress_fn(progress, arg);
+}
+
+// 只读映射整个安装包；失败返回 NULL，原因写入 err
+static unsigned char* map_archive(const char* archive, size_t* size, char* err, size_t err_size) {
+    int fd = open(archive, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(err, err_size, "%s: %s", archive, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        snprintf(err, err_size, "%s: %s", archive, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        snprintf(err, err_size, "%s: empty file", archive);
+        close(fd);
+        return NULL;
+    }
+    unsigned char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        snprintf(err, err_size, "%s: %s", archive, strerror(errno));
+        return NULL;
+    }
+    *size = st.st_size;
+    return map;
+}
+
+int extract_list(const char* archive, ExtractListFn fn, void* arg, char* err, size_t err_size) {
+    size_t size;
+    unsigned char* map = map_archive(archive, &size, err, err_size);
+    if (!map) return -1;
+
+    const unsigned char* p;
+    const unsigned char* end;
+    unsigned int count;
+    const char* message = find_central_directory(map, size, &p, &end, &count);
+    char name[PATH_MAX];
+    for (unsigned int i = 0; !message && i < count; i++) {
+        if (p + ZIP_CDIR_SIZE > end || get32(p) != ZIP_CDIR_SIG) {
+            message = "corrupt central directory";
+            break;
+        }
+        uint16_t name_len = get16(p + 28);
+        size_t entry_size = ZIP_CDIR_SIZE + name_len + get16(p + 30) + get16(p + 32);
+        if (p + entry_size > end) {
+            message = "corrupt central directory";
+            break;
+        }
+        // 目录条目不算：几个组件共用目录是正常的
+        if (name_len > 0 && name_len < sizeof(name) && p[ZIP_CDIR_SIZE + name_len - 1] != '/') {
+            memcpy(name, p + ZIP_CDIR_SIZE, name_len);
+            name[name_len] = '\0';
+            fn(name, arg);
+        }
+        p += entry_size;
+    }
+    munmap(map, size);
+    if (message) {
+        snprintf(err, err_size, "%s: %s", archive, message);
+        return -1;
+    }
+    return 0;
+}
+
+int extract_archive(const char* archive, const char* dest, int thread_count,
+                    ExtractProgressFn progress_fn, void* arg,
+                    char* err, size_t err_size) {
+    struct Extractor ex = {
+        .dest = dest,
+        .err = err,
+        .err_size = err_size,
+        .dest_fd = -1,
+    };
+    struct ExtractProgress progress = {0};
+    pthread_t* threads = NULL;
+    int started = 0;
+    int journaled = 0;
+    int result = -1;
+
+    size_t size;
+    unsigned char* map = map_archive(archive, &size, err, err_size);
+    if (!map) return -1;
+    // 整个包都会被读一遍，让内核提前预读
+    madvise(map, size, MADV_WILLNEED);
+
+    pthread_mutex_init(&ex.lock, NULL);
+    pthread_mutex_init(&ex.journal_lock, NULL);
+    pthread_cond_init(&ex.finished, NULL);
+
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "%s", dest);
+    if (make_dirs(root, 0755) != 0) {
+        snprintf(err, err_size, "%s: %s", dest, strerror(errno));
+        goto out;
+    }
+    ex.dest_fd = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    // 每个安装包一个日志，几个安装包可以同时装到同一个目录
+    ex.archive_name = strrchr(archive, '/');
+    ex.archive_name = ex.archive_name ? ex.archive_name + 1 : archive;
+    if (journal_open(&ex.journal, dest, ex.archive_name, err, err_size) != 0) goto out;
+    journaled = 1;
+    if (read_central_directory(&ex, map, size, &progress.total_bytes) != 0) goto out;
+    if (read_link_targets(&ex) != 0) goto out;
+    progress.total_files = ex.entry_count;
+    report(&ex, &progress, progress_fn, arg);
+
+    if (thread_count <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (int)cpus : 1;
+    }
+    if ((unsigned int)thread_count > ex.entry_count) thread_count = ex.entry_count ? ex.entry_count : 1;
+    threads = calloc(thread_count, sizeof(pthread_t));
+    for (int i = 0; threads && i < thread_count; i++) {
+        pthread_mutex_lock(&ex.lock);
+        ex.running++;
+        pthread_mutex_unlock(&ex.lock);
+        if (pthread_create(&threads[i], NULL, extract_worker, &ex) != 0) {
+            pthread_mutex_lock(&ex.lock);
+            ex.running--;
+            pthread_mutex_unlock(&ex.lock);
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        // 开不了线程就在当前线程里解压
+        ex.running = 1;
+        extract_worker(&ex);
+    }
+
+    // 等线程结束，期间定时刷新进度
+    pthread_mutex_lock(&ex.lock);
+    while (ex.running > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PROGRESS_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&ex.finished, &ex.lock, &deadline);
+        pthread_mutex_unlock(&ex.lock);
+        report(&ex, &progress, progress_fn, arg);
+        pthread_mutex_lock(&ex.lock);
+    }
+    pthread_mutex_unlock(&ex.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report(&ex, &progress, progress_fn, arg);
+
+    // 最后一批：即使安装失败，已经就位的文件也记进日志
+    journal_commit(&ex, ex.pending, ex.pending_count);
+    if (!atomic_load(&ex.failed)) {
+        result = 0;
+        // 重写日志前再同步一次，核对 CRC 时读到的可能是还没落盘的内容
+        if (sync_dest(&ex) == 0) compact_journal(&ex);
+    }
+
+out:
+    if (journaled) journal_close(&ex.journal);
+    if (ex.dest_fd >= 0) close(ex.dest_fd);
+    free(threads);
+    for (unsigned int i = 0; i < ex.entry_count; i++) {
+        free(ex.entries[i].name);
+        free(ex.entries[i].link_target);
+    }
+    free(ex.entries);
+    pthread_cond_destroy(&ex.finished);
+    pthread_mutex_destroy(&ex.journal_lock);
+    pthread_mutex_destroy(&ex.lock);
+    munmap(map, size);
+    return result;
+}
@@ -0,0 +1,30 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include <stddef.h>
+
+// 解压进度（按解压后的字节数和文件数计）
+struct ExtractProgress {
+    unsigned long long total_bytes;
+    unsigned long long done_bytes;
+    unsigned int total_files;
+    unsigned int done_files;
+    unsigned int skipped_files;  // 已安装且没有变化、直接跳过的文件（也计入 done）
+};
+
+// 解压过程中在调用 extract_archive 的线程上周期性调用，最后一次在全部完成时调用
+typedef void (*ExtractProgressFn)(const struct ExtractProgress* progress, void* arg);
+
+// 把 zip 包 archive 解压到 dest 目录，thread_count 个解压线程（0 为每个 CPU 核心一个），每个文件一个任务
+// 已安装的文件记在 dest 下该安装包的安装日志里，重新安装或升级时跳过没有变化的文件
+// 成功返回 0；失败返回 -1，原因写入 err
+int extract_archive(const char* archive, const char* dest, int thread_count,
+                    ExtractProgressFn progress_fn, void* arg,
+                    char* err, size_t err_size);
+
+// 列出安装包里的文件和符号链接（不含目录），对每个路径调用一次 fn
+// 成功返回 0；失败返回 -1，原因写入 err
+typedef void (*ExtractListFn)(const char* name, void* arg);
+int extract_list(const char* archive, ExtractListFn fn, void* arg, char* err, size_t err_size);
+
+#endif // EXTRACT_H
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "install.h"
+
+// 进度刷新间隔（毫秒）
+#define PROGRESS_INTERVAL_MS 100
+#define POSTINST_DIR "etc/postinst.d"
+#define SHELL_PATH "/system/bin/sh"
+
+// 安装任务的共享状态，status 和 running 由 lock 保护
+struct Installer {
+    const struct Manifest* manifest;
+    const char* dest;
+    int extract_threads;  // 每个组件的解压线程数
+    // 包含相同路径的组件不同时安装，按 order 先后安装，后装的覆盖先装的
+    uint32_t overlaps[MANIFEST_MAX_COMPONENTS];  // 与该组件有相同路径的组件（位图）
+    int order[MANIFEST_MAX_COMPONENTS];          // 安装顺序：依赖在前，其余按清单顺序
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;  // 组件状态变化或工作线程退出
+    int running;             // 仍在运行的工作线程数
+    struct InstallStatus status;
+    int failed;
+    char* err;
+    size_t err_size;
+};
+
+// 解压进度回调的参数
+struct ComponentTask {
+    struct Installer* in;
+    int index;
+};
+
+// 解压进度回调，在工作线程上调用
+static void component_progress(const struct ExtractProgress* progress, void* arg) {
+    struct ComponentTask* task = arg;
+    pthread_mutex_lock(&task->in->lock);
+    task->in->status.components[task->index].progress = *progress;
+    pthread_mutex_unlock(&task->in->lock);
+}
+
+// 找一个依赖都已装好的组件，依赖失败的组件标记为跳过（调用时持有 lock）
+// 返回组件下标；-1 表示要等正在安装的组件；-2 表示已经没有要装的组件
+static int next_component(struct Installer* in) {
+    const struct Manifest* manifest = in->manifest;
+    struct ComponentStatus* status = in->status.components;
+    int skipped;
+    do {
+        skipped = 0;
+        int waiting = 0;
+        for (int i = 0; i < manifest->count; i++) {
+            if (status[i].state != COMPONENT_WAITING) continue;
+
+            const struct Component* c = &manifest->components[i];
+            int ready = 1;
+            int blocked = -1;
+            for (int j = 0; j < c->depend_count; j++) {
+                ComponentState dep = status[c->depends[j]].state;
+                if (dep == COMPONENT_FAILED || dep == COMPONENT_SKIPPED) {
+                    blocked = c->depends[j];
+                    break;
+                }
+                if (dep != COMPONENT_DONE) ready = 0;
+            }
+            if (blocked >= 0) {
+                status[i].state = COMPONENT_SKIPPED;
+                snprintf(status[i].err, sizeof(status[i].err), "%s was not installed",
+                         manifest->components[blocked].name);
+                skipped = 1;
+                continue;
+            }
+            // 有相同路径、顺序在前的组件还没装完时等它
+            for (int j = 0; ready && j < manifest->count; j++) {
+                if (!(in->overlaps[i] & (uint32_t)1 << j) || in->order[j] > in->order[i]) continue;
+                if (status[j].state == COMPONENT_WAITING || status[j].state == COMPONENT_RUNNING) {
+                    ready = 0;
+                }
+            }
+            if (ready) return i;
+            waiting++;
+        }
+        if (!skipped) return waiting ? -1 : -2;
+        // 跳过的组件可能又让别的组件被跳过，重新扫描
+    } while (skipped);
+    return -2;
+}
+
+// 路径到包含它的组件的哈希表，用于找出有相同路径的组件
+struct PathOwner {
+    char* name;
+    uint32_t components;  // 位图
+};
+
+struct PathTable {
+    struct PathOwner* owners;  // 开放寻址，容量为 2 的幂
+    size_t slots;
+    size_t count;
+    int component;  // 正在列出的组件
+    int failed;
+};
+
+static size_t hash_path(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static struct PathOwner* find_owner(struct PathOwner* owners, size_t slots, const char* name) {
+    size_t i = hash_path(name) & (slots - 1);
+    while (owners[i].name && strcmp(owners[i].name, name) != 0) {
+        i = (i + 1) & (slots - 1);
+    }
+    return &owners[i];
+}
+
+// extract_list 的回调：记下路径属于当前组件
+static void add_path(const char* name, void* arg) {
+    struct PathTable* table = arg;
+    if (table->failed) return;
+    // 装填率保持在一半以下
+    if ((table->count + 1) * 2 > table->slots) {
+        size_t slots = table->slots ? table->slots * 2 : 4096;
+        struct PathOwner* owners = calloc(slots, sizeof(struct PathOwner));
+        if (!owners) {
+            table->failed = 1;
+            return;
+        }
+        for (size_t i = 0; i < table->slots; i++) {
+            if (table->owners[i].name) {
+                *find_owner(owners, slots, table->owners[i].name) = table->owners[i];
+            }
+        }
+        free(table->owners);
+        table->owners = owners;
+        table->slots = slots;
+    }
+    struct PathOwner* owner = find_owner(table->owners, table->slots, name);
+    if (!owner->name) {
+        owner->name = strdup(name);
+        if (!owner->name) {
+            table->failed = 1;
+            return;
+        }
+        table->count++;
+    }
+    owner->components |= (uint32_t)1 << table->component;
+}
+
+// 读各组件安装包的中央目录，找出装到同一路径的组件
+// 读不了的安装包跳过，解压时会报告错误
+static void find_overlaps(struct Installer* in, const int* closure) {
+    const struct Manifest* manifest = in->manifest;
+    struct PathTable table = {0};
+    char err[256];
+
+    for (int i = 0; i < manifest->count && !table.failed; i++) {
+        if (!closure[i]) continue;
+        table.component = i;
+        extract_list(manifest->components[i].archive, add_path, &table, err, sizeof(err));
+    }
+    for (size_t i = 0; i < table.slots; i++) {
+        uint32_t components = table.owners[i].components;
+        if (components & (components - 1)) {
+            for (int j = 0; j < manifest->count; j++) {
+                if (components & (uint32_t)1 << j) in->overlaps[j] |= components & ~((uint32_t)1 << j);
+            }
+        }
+        free(table.owners[i].name);
+    }
+    free(table.owners);
+}
+
+// 安装顺序：每次取依赖都已排好的组件中清单里最靠前的一个
+static void install_order(struct Installer* in) {
+    const struct Manifest* manifest = in->manifest;
+    int placed[MANIFEST_MAX_COMPONENTS] = {0};
+    for (int n = 0; n < manifest->count; n++) {
+        for (int i = 0; i < manifest->count; i++) {
+            if (placed[i]) continue;
+            const struct Component* c = &manifest->components[i];
+            int ready = 1;
+            for (int j = 0; ready && j < c->depend_count; j++) {
+                if (!placed[c->depends[j]]) ready = 0;
+            }
+            if (ready) {
+                placed[i] = 1;
+                in->order[i] = n;
+                break;
+            }
+        }
+    }
+}
+
+// 工作线程：每次领取一个可以开始的组件
+static void* install_worker(void* arg) {
+    struct Installer* in = arg;
+    char err[256];
+
+    pthread_mutex_lock(&in->lock);
+    for (;;) {
+        int i = next_component(in);
+        if (i == -2) break;
+        if (i == -1) {
+            pthread_cond_wait(&in->changed, &in->lock);
+            continue;
+        }
+
+        const struct Component* c = &in->manifest->components[i];
+        struct ComponentTask task = { .in = in, .index = i };
+        in->status.components[i].state = COMPONENT_RUNNING;
+        pthread_mutex_unlock(&in->lock);
+
+        int ret = extract_archive(c->archive, in->dest, in->extract_threads,
+                                  component_progress, &task, err, sizeof(err));
+
+        pthread_mutex_lock(&in->lock);
+        struct ComponentStatus* status = &in->status.components[i];
+        if (ret == 0) {
+            status->state = COMPONENT_DONE;
+        } else {
+            status->state = COMPONENT_FAILED;
+            snprintf(status->err, sizeof(status->err), "%s", err);
+            if (!in->failed) {
+                snprintf(in->err, in->err_size, "%s: %s", c->name, err);
+                in->failed = 1;
+            }
+        }
+        pthread_cond_broadcast(&in->changed);
+    }
+    in->running--;
+    pthread_cond_broadcast(&in->changed);
+    pthread_mutex_unlock(&in->lock);
+    return NULL;
+}
+
+// 取一份进度快照交给回调；字节数按清单里的 install_size 折算
+static void report(struct Installer* in, InstallProgressFn progress_fn, void* arg) {
+    if (!progress_fn) return;
+    struct InstallStatus snapshot;
+
+    pthread_mutex_lock(&in->lock);
+    snapshot = in->status;
+    pthread_mutex_unlock(&in->lock);
+
+    snapshot.done_bytes = 0;
+    for (int i = 0; i < in->manifest->count; i++) {
+        const struct ComponentStatus* status = &snapshot.components[i];
+        unsigned long long size = in->manifest->components[i].install_size;
+        if (status->state == COMPONENT_DONE) {
+            snapshot.done_bytes += size;
+        } else if (status->state == COMPONENT_RUNNING && status->progress.total_bytes) {
+            snapshot.done_bytes += (unsigned long long)
+                ((double)size * status->progress.done_bytes / status->progress.total_bytes);
+        }
+    }
+    progress_fn(&snapshot, arg);
+}
+
+int install_components(const struct Manifest* manifest, const int* closure, const char* dest,
+                       InstallProgressFn progress_fn, void* arg, char* err, size_t err_size) {
+    struct Installer in = {
+        .manifest = manifest,
+        .dest = dest,
+        .err = err,
+        .err_size = err_size,
+    };
+    pthread_t threads[MANIFEST_MAX_COMPONENTS];
+    int started = 0;
+
+    int count = 0;
+    for (int i = 0; i < manifest->count; i++) {
+        if (!closure[i]) continue;
+        in.status.components[i].state = COMPONENT_WAITING;
+        in.status.total_bytes += manifest->components[i].install_size;
+        count++;
+    }
+
+    find_overlaps(&in, closure);
+    install_order(&in);
+
+    // 组件数和 CPU 核心数取小者作为线程池大小，核心平分给同时安装的组件
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    int worker_count = count < cpus ? count : (int)cpus;
+    if (worker_count < 1) worker_count = 1;
+    in.extract_threads = cpus / worker_count > 1 ? (int)(cpus / worker_count) : 1;
+
+    pthread_mutex_init(&in.lock, NULL);
+    pthread_cond_init(&in.changed, NULL);
+    report(&in, progress_fn, arg);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_mutex_lock(&in.lock);
+        in.running++;
+        pthread_mutex_unlock(&in.lock);
+        if (pthread_create(&threads[i], NULL, install_worker, &in) != 0) {
+            pthread_mutex_lock(&in.lock);
+            in.running--;
+            pthread_mutex_unlock(&in.lock);
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        // 开不了线程就在当前线程里依次安装
+        in.running = 1;
+        install_worker(&in);
+    }
+
+    // 等线程结束，期间定时刷新进度
+    pthread_mutex_lock(&in.lock);
+    while (in.running > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PROGRESS_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&in.changed, &in.lock, &deadline);
+        pthread_mutex_unlock(&in.lock);
+        report(&in, progress_fn, arg);
+        pthread_mutex_lock(&in.lock);
+    }
+    pthread_mutex_unlock(&in.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report(&in, progress_fn, arg);
+
+    pthread_cond_destroy(&in.changed);
+    pthread_mutex_destroy(&in.lock);
+    return in.failed ? -1 : 0;
+}
+
+static int is_hook(const struct dirent* entry) {
+    return entry->d_name[0] != '.';
+}
+
+// 运行一个脚本，标准输入输出都接到 /dev/null，返回退出码；运行不了返回 -1
+static int run_hook(const char* path) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execl(SHELL_PATH, "sh", path, (char*)NULL);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int run_postinst_hooks(const char* dest, char* err, size_t err_size) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/" POSTINST_DIR, dest);
+
+    struct dirent** entries;
+    int count = scandir(dir, &entries, is_hook, alphasort);
+    if (count < 0) return 0;
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+        int ret = run_hook(path);
+        if (ret != 0 && !failed) {
+            snprintf(err, err_size, "%s exited with %d", entries[i]->d_name, ret);
+            failed = 1;
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef INSTALL_H
+#define INSTALL_H
+
+#include <stddef.h>
+
+#include "extract.h"
+#include "manifest.h"
+
+// 组件的安装状态
+typedef enum {
+    COMPONENT_NONE,       // 不在安装闭包里
+    COMPONENT_WAITING,    // 等待依赖装完
+    COMPONENT_RUNNING,
+    COMPONENT_DONE,
+    COMPONENT_FAILED,
+    COMPONENT_SKIPPED,    // 依赖安装失败，没有安装
+} ComponentState;
+
+struct ComponentStatus {
+    ComponentState state;
+    struct ExtractProgress progress;
+    char err[256];
+};
+
+// 全部组件的安装进度
+struct InstallStatus {
+    struct ComponentStatus components[MANIFEST_MAX_COMPONENTS];
+    unsigned long long total_bytes;  // 清单中闭包里各组件 install_size 之和
+    unsigned long long done_bytes;
+};
+
+// 安装过程中在调用线程上周期性调用，最后一次在全部结束时调用
+typedef void (*InstallProgressFn)(const struct InstallStatus* status, void* arg);
+
+// 把 closure（见 manifest_closure）里的组件安装到 dest
+// 依赖装完的组件才开始安装，互不依赖的组件在线程池里同时安装
+// 几个组件包含同一路径时不同时安装：依赖在前，没有依赖关系的按清单顺序，后装的覆盖先装的
+// 全部成功返回 0；否则返回 -1，第一个错误写入 err
+int install_components(const struct Manifest* manifest, const int* closure, const char* dest,
+                       InstallProgressFn progress_fn, void* arg, char* err, size_t err_size);
+
+// 安装完成后按文件名顺序用 sh 运行 dest/etc/postinst.d 下的脚本（如生成 file_contexts.bin）
+// 脚本的输出丢弃；都成功或目录不存在返回 0，否则返回 -1，第一个失败的脚本写入 err
+int run_postinst_hooks(const char* dest, char* err, size_t err_size);
+
+#endif // INSTALL_H
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+#define JOURNAL_PREFIX ".install-journal."
+// 版本 2 起记录只在文件数据同步到磁盘后写入；版本 1 的日志不再信任，整个重建
+#define JOURNAL_HEADER "# ssb install journal 2\n"
+// 一行记录："<crc 十六进制> <大小> <mtime> <路径>\n"
+#define JOURNAL_LINE_MAX (PATH_MAX + 64)
+
+static uint32_t hash_name(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static struct JournalRecord* find_slot(struct JournalRecord* records, size_t slots, const char* name) {
+    size_t i = hash_name(name) & (slots - 1);
+    while (records[i].name && strcmp(records[i].name, name) != 0) {
+        i = (i + 1) & (slots - 1);
+    }
+    return &records[i];
+}
+
+static int grow(struct Journal* journal) {
+    size_t slots = journal->slots ? journal->slots * 2 : 256;
+    struct JournalRecord* records = calloc(slots, sizeof(struct JournalRecord));
+    if (!records) return -1;
+    for (size_t i = 0; i < journal->slots; i++) {
+        if (journal->records[i].name) {
+            *find_slot(records, slots, journal->records[i].name) = journal->records[i];
+        }
+    }
+    free(journal->records);
+    journal->records = records;
+    journal->slots = slots;
+    return 0;
+}
+
+// 插入或覆盖一条记录（同一路径后写的记录为准），name 的所有权转给哈希表
+static int insert(struct Journal* journal, char* name, uint32_t crc, uint32_t size, long long mtime) {
+    // 装填率保持在一半以下
+    if ((journal->count + 1) * 2 > journal->slots && grow(journal) != 0) return -1;
+    struct JournalRecord* record = find_slot(journal->records, journal->slots, name);
+    if (record->name) {
+        free(record->name);
+    } else {
+        journal->count++;
+    }
+    record->name = name;
+    record->crc = crc;
+    record->size = size;
+    record->mtime = mtime;
+    return 0;
+}
+
+// 解析日志内容；没有以换行结尾的最后一行是写到一半被杀掉的，丢弃
+static int parse(struct Journal* journal, char* data, size_t len) {
+    size_t header_len = strlen(JOURNAL_HEADER);
+    if (len < header_len || memcmp(data, JOURNAL_HEADER, header_len) != 0) return -1;
+
+    char* p = data + header_len;
+    char* end = data + len;
+    while (p < end) {
+        char* newline = memchr(p, '\n', end - p);
+        if (!newline) break;
+        *newline = '\0';
+
+        char* field = p;
+        char* next;
+        unsigned long crc = strtoul(field, &next, 16);
+        if (next != field && *next == ' ') {
+            field = next + 1;
+            unsigned long size = strtoul(field, &next, 10);
+            if (next != field && *next == ' ') {
+                field = next + 1;
+                long long mtime = strtoll(field, &next, 10);
+                if (next != field && *next == ' ' && next[1]) {
+                    char* name = strdup(next + 1);
+                    if (!name || insert(journal, name, crc, size, mtime) != 0) {
+                        free(name);
+                        return -1;
+                    }
+                }
+            }
+        }
+        p = newline + 1;
+    }
+    return 0;
+}
+
+static int load(struct Journal* journal) {
+    struct stat st;
+    if (fstat(journal->fd, &st) != 0) return -1;
+    if (st.st_size == 0) return -1;
+
+    char* data = malloc(st.st_size);
+    if (!data) return -1;
+    size_t len = 0;
+    while (len < (size_t)st.st_size) {
+        ssize_t n = pread(journal->fd, data + len, st.st_size - len, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += n;
+    }
+    int ret = parse(journal, data, len);
+    free(data);
+    return ret;
+}
+
+static void free_records(struct Journal* journal) {
+    for (size_t i = 0; i < journal->slots; i++) {
+        free(journal->records[i].name);
+    }
+    free(journal->records);
+    journal->records = NULL;
+    journal->slots = 0;
+    journal->count = 0;
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int format_line(char* line, size_t size, const char* name,
+                       uint32_t crc, uint32_t size_bytes, long long mtime) {
+    int len = snprintf(line, size, "%08x %u %lld %s\n", crc, size_bytes, mtime, name);
+    if (len < 0 || (size_t)len >= size) return -1;
+    return len;
+}
+
+int journal_open(struct Journal* journal, const char* dir, const char* archive_name,
+                 char* err, size_t err_size) {
+    memset(journal, 0, sizeof(*journal));
+    snprintf(journal->path, sizeof(journal->path), "%s/" JOURNAL_PREFIX "%s", dir, archive_name);
+
+    journal->fd = open(journal->path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (journal->fd < 0) {
+        snprintf(err, err_size, "%s: %s", journal->path, strerror(errno));
+        return -1;
+    }
+    if (load(journal) != 0) {
+        // 新日志，或者格式不认识：清空重来，所有文件都会重新核对
+        free_records(journal);
+        if (ftruncate(journal->fd, 0) != 0
+            || write_all(journal->fd, JOURNAL_HEADER, strlen(JOURNAL_HEADER)) != 0) {
+            snprintf(err, err_size, "%s: %s", journal->path, strerror(errno));
+            close(journal->fd);
+            journal->fd = -1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void journal_close(struct Journal* journal) {
+    if (journal->fd >= 0) close(journal->fd);
+    journal->fd = -1;
+    free_records(journal);
+}
+
+const struct JournalRecord* journal_find(const struct Journal* journal, const char* name) {
+    if (journal->count == 0) return NULL;
+    const struct JournalRecord* record = find_slot(journal->records, journal->slots, name);
+    return record->name ? record : NULL;
+}
+
+int journal_append(struct Journal* journal, const char* name,
+                   uint32_t crc, uint32_t size, long long mtime) {
+    // 路径里带换行的文件不记录，下次重新核对
+    if (strchr(name, '\n')) return 0;
+    char line[JOURNAL_LINE_MAX];
+    int len = format_line(line, sizeof(line), name, crc, size, mtime);
+    if (len < 0) return 0;
+    // O_APPEND 下一次 write 写入整行，多个线程同时追加不会交错
+    return write_all(journal->fd, line, len);
+}
+
+int journal_compact(struct Journal* journal, const struct JournalRecord* records, size_t count) {
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.new", journal->path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return -1;
+
+    // 拼成大块再写，避免每条记录一次系统调用
+    char* buffer = malloc(64 * 1024);
+    size_t used = 0;
+    int ret = buffer ? write_all(fd, JOURNAL_HEADER, strlen(JOURNAL_HEADER)) : -1;
+    for (size_t i = 0; ret == 0 && i < count; i++) {
+        if (strchr(records[i].name, '\n')) continue;
+        if (64 * 1024 - used < JOURNAL_LINE_MAX) {
+            ret = write_all(fd, buffer, used);
+            used = 0;
+        }
+        int len = format_line(buffer + used, JOURNAL_LINE_MAX, records[i].name,
+                              records[i].crc, records[i].size, records[i].mtime);
+        if (len > 0) used += len;
+    }
+    if (ret == 0) ret = write_all(fd, buffer, used);
+    free(buffer);
+    if (ret == 0) ret = fsync(fd);
+    if (close(fd) != 0) ret = -1;
+    if (ret == 0) ret = rename(tmp, journal->path);
+    if (ret != 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    // 之后的追加写到新文件里
+    int new_fd = open(journal->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (new_fd >= 0) {
+        close(journal->fd);
+        journal->fd = new_fd;
+    }
+    return 0;
+}
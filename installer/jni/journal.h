@@ -0,0 +1,42 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+// 安装日志中的一条记录：一个已经安装完成的文件
+struct JournalRecord {
+    char* name;        // 相对于安装目录的路径
+    uint32_t crc;      // 内容的 CRC32（与安装包中央目录里的一致）
+    uint32_t size;
+    long long mtime;
+};
+
+// 安装日志：安装目录下的追加写文件，装好的文件同步到磁盘后各追加一行
+// 进程中途被杀后，下次安装据此跳过已经装好且没有变化的文件
+struct Journal {
+    int fd;                         // 以 O_APPEND 打开，供追加记录
+    char path[PATH_MAX];
+    struct JournalRecord* records;  // 开放寻址哈希表，打开时载入的旧记录
+    size_t slots;
+    size_t count;
+};
+
+// 打开 dir 下安装包 archive_name 的安装日志并载入已有记录，不存在或格式不对时新建
+// 成功返回 0；失败返回 -1，原因写入 err
+int journal_open(struct Journal* journal, const char* dir, const char* archive_name,
+                 char* err, size_t err_size);
+void journal_close(struct Journal* journal);
+
+// 查找打开时载入的记录（只读，可在多个线程中同时调用）
+const struct JournalRecord* journal_find(const struct Journal* journal, const char* name);
+
+// 追加一条记录，每条记录一次 write，可在多个线程中同时调用
+int journal_append(struct Journal* journal, const char* name,
+                   uint32_t crc, uint32_t size, long long mtime);
+
+// 安装完成后用 records 重写日志，去掉重复和已不存在的记录（先写临时文件再 rename）
+int journal_compact(struct Journal* journal, const struct JournalRecord* records, size_t count);
+
+#endif // JOURNAL_H
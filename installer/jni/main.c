@@ -4,8 +4,16 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <locale.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/statvfs.h>
+
+#include "install.h"
+#include "manifest.h"
+#include "screen.h"
 
 // ANSI转义码定义
 #define CLEAR_SCREEN "\033[2J\033[H"
@@ -35,16 +43,10 @@
 
 // 固定缓冲区大小
 #define MAX_LINE_LENGTH 256
-#define MAX_OPTIONS 20
+#define MAX_OPTIONS MANIFEST_MAX_COMPONENTS
 #define MAX_HELP_TEXT 512
 
-// Kconfig选项类型
-typedef enum {
-    OPT_BOOL,
-    OPT_TRISTATE,
-} OptionType;
-
-// 选项结构
+// 选项结构（第 i 个选项对应清单中的第 i 个组件）
 struct MenuOption {
     const char* name;
     const char* prompt;
@@ -68,13 +70,24 @@ struct Config {
     struct MenuOption options[MAX_OPTIONS];
     int option_count;
     const char* install_dir;
+    const char* manifest_path;  // 组件清单（package_output 生成的 components.conf）
+    struct Manifest manifest;
     ScreenState state;
     int quit;
     int selected;
     int terminal_rows;
     int terminal_cols;
+    struct Screen screen;  // 所有界面都先画到这里，再一次性输出
 };
 
+// 终端尺寸变化（SIGWINCH）
+static volatile sig_atomic_t terminal_resized = 0;
+
+static void handle_sigwinch(int sig) {
+    (void)sig;
+    terminal_resized = 1;
+}
+
 // 获取终端尺寸
 void get_terminal_size(int *rows, int *cols) {
     struct winsize w;
@@ -106,9 +119,19 @@ void disable_raw_mode() {
     tcsetattr(STDIN_FILENO, TCSANOW, &term);
 }
 
+// 收到 SIGWINCH 后按新尺寸重建屏幕缓冲区
+void update_terminal_size(struct Config* config) {
+    if (!terminal_resized) return;
+    terminal_resized = 0;
+    get_terminal_size(&config->terminal_rows, &config->terminal_cols);
+    screen_resize(&config->screen, config->terminal_rows, config->terminal_cols);
+}
+
 // 完全处理方向键和特殊键
+// 被 SIGWINCH 打断时返回 -1，调用方重绘后再读
 int read_key() {
     unsigned char c;
+    errno = 0;
     if (read(STDIN_FILENO, &c, 1) != 1) return -1;
     
     // 处理方向键序列
@@ -126,170 +149,302 @@ int read_key() {
 }
 
 // 绘制顶部标题栏
-void draw_header(const char* title) {
-    printf(REVERSE " %s " RESET "\n", title);
+void draw_header(struct Screen* screen, const char* title) {
+    screen_move(screen, 0, 0);
+    screen_printf(screen, ATTR_REVERSE, " %s ", title);
+    screen_printf(screen, ATTR_NONE, "\n");
 }
 
-// 绘制底部状态栏
-void draw_footer(const char* message) {
-    printf(REVERSE " %s " RESET "\n", message);
+// 绘制底部状态栏（固定在最后一行）
+void draw_footer(struct Screen* screen, const char* message) {
+    screen_move(screen, screen->rows - 1, 0);
+    screen_printf(screen, ATTR_REVERSE, " %s ", message);
+}
+
+// 选项值指示器
+static void draw_option_value(struct Screen* screen, int value) {
+    if (value == 0) {
+        screen_printf(screen, ATTR_NONE, "   [ ] ");
+    } else if (value == 1) {
+        screen_printf(screen, ATTR_GREEN, "   [*] ");
+    } else {
+        screen_printf(screen, ATTR_YELLOW, "   [M] ");
+    }
 }
 
 // 绘制主菜单
 void draw_main_menu(struct Config* config) {
-    printf(CLEAR_SCREEN);
-    draw_header("Super Develop Environment Configuration");
-    
-    printf("\n" FG_YELLOW "Installation directory: " FG_GREEN "%s" RESET "\n\n", 
-           config->install_dir);
-    
-    for (int i = 0; i < config->option_count; i++) {
-        // 高亮当前选中项
+    struct Screen* screen = &config->screen;
+    screen_clear(screen);
+    draw_header(screen, "Super Develop Environment Configuration");
+
+    screen_printf(screen, ATTR_YELLOW, "\nInstallation directory: ");
+    screen_printf(screen, ATTR_GREEN, "%s", config->install_dir);
+    screen_printf(screen, ATTR_NONE, "\n\n");
+
+    // 选项多于可用行数时滚动，保证选中项可见
+    int visible = screen->rows - screen->row - 2;
+    if (visible < 1) visible = 1;
+    int first = config->selected >= visible ? config->selected - visible + 1 : 0;
+
+    for (int i = first; i < config->option_count && i < first + visible; i++) {
+        int row = screen->row;
+        draw_option_value(screen, config->options[i].value);
+        screen_printf(screen, ATTR_NONE, "%s", config->options[i].prompt);
+
+        // 高亮当前选中项（整行反色）
         if (i == config->selected) {
-            printf(REVERSE);
-        }
-        
-        // 显示选项值指示器
-        if (config->options[i].value == 0) {
-            printf("   [ ] ");
-        } else if (config->options[i].value == 1) {
-            printf(FG_GREEN "   [*] " RESET);
-        } else {
-            printf(FG_YELLOW "   [M] " RESET);
+            for (int col = 0; col < screen->cols; col++) {
+                screen->back[row * screen->cols + col].attr |= ATTR_REVERSE;
+            }
         }
-        
-        // 安全打印选项文本
-        printf("%s", config->options[i].prompt);
-        
-        printf(RESET "\n");
+        screen_printf(screen, ATTR_NONE, "\n");
     }
-    
-    printf("\n");
-    draw_footer("↑↓:Navigate  SPACE:Toggle  H:Help  ENTER:Continue  Q:Quit");
-    fflush(stdout);
+
+    draw_footer(screen, "↑↓:Navigate  SPACE:Toggle  H:Help  ENTER:Continue  Q:Quit");
+    screen_flush(screen, STDOUT_FILENO);
 }
 
 // 绘制帮助屏幕
 void draw_help_screen(struct Config* config) {
-    printf(CLEAR_SCREEN);
-    draw_header("Option Help");
-    
+    struct Screen* screen = &config->screen;
+    screen_clear(screen);
+    draw_header(screen, "Option Help");
+
     if (config->selected >= 0 && config->selected < config->option_count) {
         struct MenuOption* opt = &config->options[config->selected];
-        printf("\n" BOLD "%s" RESET "\n\n", opt->prompt);
-        printf("%s\n\n", opt->help ? opt->help : "No help available for this option.");
-        
-        printf("Symbol: %s\n", opt->name);
-        printf("Type: %s\n", opt->type == OPT_BOOL ? "Boolean" : "Tristate");
-        printf("Status: %s\n", opt->value == 0 ? FG_RED "Disabled" RESET : 
-               (opt->value == 1 ? FG_GREEN "Enabled" RESET : FG_YELLOW "Module" RESET));
-        printf("Default: %s\n", opt->default_value == 0 ? "Disabled" : 
-               (opt->default_value == 1 ? "Enabled" : "Module"));
+        screen_printf(screen, ATTR_BOLD, "\n%s", opt->prompt);
+        screen_printf(screen, ATTR_NONE, "\n\n%s\n\n",
+                      opt->help ? opt->help : "No help available for this option.");
+
+        screen_printf(screen, ATTR_NONE, "Symbol: %s\n", opt->name);
+        screen_printf(screen, ATTR_NONE, "Type: %s\n", opt->type == OPT_BOOL ? "Boolean" : "Tristate");
+        screen_printf(screen, ATTR_NONE, "Status: ");
+        if (opt->value == 0) {
+            screen_printf(screen, ATTR_RED, "Disabled");
+        } else if (opt->value == 1) {
+            screen_printf(screen, ATTR_GREEN, "Enabled");
+        } else {
+            screen_printf(screen, ATTR_YELLOW, "Module");
+        }
+        screen_printf(screen, ATTR_NONE, "\nDefault: %s\n", opt->default_value == 0 ? "Disabled" :
+                      (opt->default_value == 1 ? "Enabled" : "Module"));
+
+        const struct Component* c = &config->manifest.components[config->selected];
+        screen_printf(screen, ATTR_NONE, "Download size: %.1f MiB\n", c->download_size / 1048576.0);
+        screen_printf(screen, ATTR_NONE, "Installed size: %.1f MiB\n", c->install_size / 1048576.0);
+        if (c->depend_count > 0) {
+            screen_printf(screen, ATTR_NONE, "Depends on:");
+            for (int i = 0; i < c->depend_count; i++) {
+                screen_printf(screen, ATTR_NONE, " %s", config->manifest.components[c->depends[i]].name);
+            }
+            screen_printf(screen, ATTR_NONE, "\n");
+        }
     } else {
-        printf("\nNo option selected.\n");
+        screen_printf(screen, ATTR_NONE, "\nNo option selected.\n");
     }
-    
-    printf("\n");
-    draw_footer("Press any key to return to main menu");
-    fflush(stdout);
+
+    draw_footer(screen, "Press any key to return to main menu");
+    screen_flush(screen, STDOUT_FILENO);
+}
+
+// 按当前选择计算安装闭包，返回要安装的组件数
+static int compute_closure(struct Config* config, int* closure) {
+    int values[MAX_OPTIONS];
+    for (int i = 0; i < config->option_count; i++) {
+        values[i] = config->options[i].value;
+    }
+    manifest_closure(&config->manifest, values, closure);
+    int count = 0;
+    for (int i = 0; i < config->option_count; i++) {
+        if (closure[i]) count++;
+    }
+    return count;
 }
 
 // 绘制配置确认界面
 void draw_confirm_screen(struct Config* config) {
-    printf(CLEAR_SCREEN);
-    draw_header("Confirm Installation");
-    
-    printf("\nInstallation directory: " FG_GREEN "%s" RESET "\n\n", config->install_dir);
-    printf("Selected components:\n\n");
-    
-    int enabled_count = 0;
+    struct Screen* screen = &config->screen;
+    screen_clear(screen);
+    draw_header(screen, "Confirm Installation");
+
+    screen_printf(screen, ATTR_NONE, "\nInstallation directory: ");
+    screen_printf(screen, ATTR_GREEN, "%s", config->install_dir);
+    screen_printf(screen, ATTR_NONE, "\n\nComponents to install:\n\n");
+
+    int closure[MAX_OPTIONS];
+    unsigned long long download_size = 0;
+    unsigned long long install_size = 0;
+    int enabled_count = compute_closure(config, closure);
     for (int i = 0; i < config->option_count; i++) {
-        if (config->options[i].value != 0) {
-            enabled_count++;
-            printf("  • ");
-            switch (config->options[i].type) {
-                case OPT_BOOL:
-                    printf("%s: %s\n", config->options[i].prompt, 
-                           config->options[i].value ? "Yes" : "No");
-                    break;
-                case OPT_TRISTATE:
-                    printf("%s: %s\n", config->options[i].prompt, 
-                           config->options[i].value == 2 ? "Module" : "Yes");
-                    break;
-            }
+        if (!closure[i]) continue;
+        const struct Component* c = &config->manifest.components[i];
+        download_size += c->download_size;
+        install_size += c->install_size;
+
+        screen_printf(screen, ATTR_NONE, "  • %-24s %9.1f MiB  ", config->options[i].prompt,
+                      c->install_size / 1048576.0);
+        if (closure[i] == 2) {
+            screen_printf(screen, ATTR_CYAN, "(required by another component)\n");
+        } else if (config->options[i].type == OPT_TRISTATE && config->options[i].value == 2) {
+            screen_printf(screen, ATTR_NONE, "Module\n");
+        } else {
+            screen_printf(screen, ATTR_NONE, "Yes\n");
         }
     }
-    
+
     if (!enabled_count) {
-        printf(FG_RED "  No components selected!" RESET "\n");
+        screen_printf(screen, ATTR_RED, "  No components selected!\n");
+    } else {
+        screen_printf(screen, ATTR_NONE, "\nDownload size: ");
+        screen_printf(screen, ATTR_BOLD, "%.1f MiB", download_size / 1048576.0);
+        screen_printf(screen, ATTR_NONE, "  Disk space required: ");
+        screen_printf(screen, ATTR_BOLD, "%.1f MiB\n", install_size / 1048576.0);
+
+        struct statvfs vfs;
+        if (statvfs(config->install_dir, &vfs) == 0) {
+            unsigned long long available = (unsigned long long)vfs.f_bavail * vfs.f_frsize;
+            screen_printf(screen, available < install_size ? ATTR_RED : ATTR_NONE,
+                          "Available: %.1f MiB\n", available / 1048576.0);
+        }
     }
-    
-    printf("\n");
-    draw_footer("Y: Start Installation  N: Back to Configuration  Q: Quit");
-    fflush(stdout);
+
+    draw_footer(screen, "Y: Start Installation  N: Back to Configuration  Q: Quit");
+    screen_flush(screen, STDOUT_FILENO);
 }
 
-// 绘制安装进度界面
-void draw_install_screen(struct Config* config) {
-    printf(CLEAR_SCREEN);
-    draw_header("Installing Super Develop Environment");
-    
-    printf("\n");
-    printf("Creating installation directory...\n");
-    fflush(stdout);
-    
-    if (mkdir(config->install_dir, 0755) == 0) {
-        printf(FG_GREEN "✓ Created: %s" RESET "\n\n", config->install_dir);
-    } else {
-        printf(FG_RED "✗ Failed to create directory! Using fallback..." RESET "\n\n");
+// 安装界面的状态
+struct InstallView {
+    struct Config* config;
+    int closure[MAX_OPTIONS];
+    struct InstallStatus status;
+    int finished;
+    int failed;
+    int postinst;        // 正在运行 postinst.d 脚本
+    char err[512];
+    char hook_err[256];  // postinst.d 脚本失败的原因，安装本身已完成
+};
+
+// 绘制一个组件的安装状态
+static void draw_component_status(struct Screen* screen, const char* prompt,
+                                  const struct ComponentStatus* status) {
+    const struct ExtractProgress* progress = &status->progress;
+    switch (status->state) {
+        case COMPONENT_WAITING:
+            screen_printf(screen, ATTR_NONE, "  [ waiting ] %s\n", prompt);
+            break;
+        case COMPONENT_RUNNING:
+            screen_printf(screen, ATTR_YELLOW, "  [ %3d%%    ] ", progress->total_bytes
+                          ? (int)(progress->done_bytes * 100 / progress->total_bytes) : 0);
+            screen_printf(screen, ATTR_NONE, "%s  %u/%u files\n", prompt,
+                          progress->done_files, progress->total_files);
+            break;
+        case COMPONENT_DONE:
+            screen_printf(screen, ATTR_GREEN, "  [  done   ] ");
+            screen_printf(screen, ATTR_NONE, "%s", prompt);
+            if (progress->skipped_files > 0) {
+                screen_printf(screen, ATTR_NONE, "  (%u files unchanged)", progress->skipped_files);
+            }
+            screen_printf(screen, ATTR_NONE, "\n");
+            break;
+        case COMPONENT_FAILED:
+        case COMPONENT_SKIPPED:
+            screen_printf(screen, ATTR_RED, "  [ %s ] ", status->state == COMPONENT_FAILED
+                          ? "failed " : "skipped");
+            screen_printf(screen, ATTR_NONE, "%s: %s\n", prompt, status->err);
+            break;
+        case COMPONENT_NONE:
+            break;
     }
-    fflush(stdout);
-    
-    // 安装每个选中的组件
-    int step = 1;
-    int total_steps = 0;
-    
-    // 先计算需要安装的组件数量
+}
+
+// 绘制安装进度界面（每次进度更新重画一帧，只有变化的字符会输出）
+void draw_install_frame(struct InstallView* view) {
+    struct Config* config = view->config;
+    struct Screen* screen = &config->screen;
+    const struct InstallStatus* status = &view->status;
+
+    update_terminal_size(config);
+    screen_clear(screen);
+    draw_header(screen, "Installing Super Develop Environment");
+
+    screen_printf(screen, ATTR_NONE, "\nInstalling to %s\n\n", config->install_dir);
     for (int i = 0; i < config->option_count; i++) {
-        if (config->options[i].value != 0) total_steps++;
+        if (!view->closure[i]) continue;
+        draw_component_status(screen, config->options[i].prompt, &status->components[i]);
     }
-    
-    for (int i = 0; i < config->option_count; i++) {
-        if (config->options[i].value == 0) continue;
-        
-        printf("[%d/%d] ", step++, total_steps);
-        fflush(stdout);
-        
-        switch (config->options[i].value) {
-            case 1: // Enabled
-                printf("Installing %s...\n", config->options[i].prompt);
-                break;
-            case 2: // Module
-                printf("Installing %s module...\n", config->options[i].prompt);
-                break;
+    screen_printf(screen, ATTR_NONE, "\n");
+
+    // 进度条宽度随终端宽度变化
+    char bar[64];
+    int width = screen->cols - 32;
+    if (width > (int)sizeof(bar) - 1) width = sizeof(bar) - 1;
+    if (width < 10) width = 10;
+    int percent = status->total_bytes
+        ? (int)(status->done_bytes * 100 / status->total_bytes) : 100;
+    if (percent > 100) percent = 100;
+    int filled = percent * width / 100;
+    memset(bar, '#', filled);
+    memset(bar + filled, '.', width - filled);
+    bar[width] = '\0';
+    screen_printf(screen, ATTR_NONE, "[%s] %3d%%  %.1f/%.1f MiB\n", bar, percent,
+                  status->done_bytes / 1048576.0, status->total_bytes / 1048576.0);
+
+    if (view->postinst) {
+        screen_printf(screen, ATTR_NONE, "\nRunning post-install steps...\n");
+    } else if (view->finished && !view->failed) {
+        screen_printf(screen, ATTR_GREEN | ATTR_BOLD, "\nInstallation complete!\n");
+        if (view->hook_err[0]) {
+            screen_printf(screen, ATTR_YELLOW, "Post-install step failed: %s\n", view->hook_err);
         }
-        fflush(stdout);
-        
-        usleep(200000); // 模拟安装过程
-        printf(FG_GREEN "✓ Successfully installed\n\n" RESET);
-        fflush(stdout);
+        screen_printf(screen, ATTR_NONE, "\nTo start the environment, run:\n   ");
+        screen_printf(screen, ATTR_CYAN, "%s/bin/sde\n", config->install_dir);
+    } else if (view->finished) {
+        screen_printf(screen, ATTR_RED | ATTR_BOLD, "\nInstallation failed: ");
+        screen_printf(screen, ATTR_RED, "%s\n", view->err);
     }
-    
-    printf("\n" FG_GREEN BOLD "Installation complete!" RESET "\n");
-    printf("\nTo start the environment, run:\n");
-    printf("   " FG_CYAN "%s/bin/sde" RESET "\n\n", config->install_dir);
-    
-    draw_footer("Press any key to exit");
-    fflush(stdout);
-    
-    // 等待任意键退出
+
+    if (view->finished) {
+        draw_footer(screen, "Press any key to exit");
+    }
+    screen_flush(screen, STDOUT_FILENO);
+}
+
+// 安装进度回调
+void draw_install_progress(const struct InstallStatus* status, void* arg) {
+    struct InstallView* view = arg;
+    view->status = *status;
+    draw_install_frame(view);
+}
+
+// 执行安装
+void draw_install_screen(struct Config* config) {
+    struct InstallView view = { .config = config };
+    compute_closure(config, view.closure);
+
+    view.failed = install_components(&config->manifest, view.closure, config->install_dir,
+                                     draw_install_progress, &view, view.err, sizeof(view.err)) != 0;
+    if (!view.failed) {
+        view.postinst = 1;
+        draw_install_frame(&view);
+        run_postinst_hooks(config->install_dir, view.hook_err, sizeof(view.hook_err));
+        view.postinst = 0;
+    }
+    view.finished = 1;
+    draw_install_frame(&view);
+
+    // 等待任意键退出，窗口大小变化时重画
     config->state = EXITING;
-    read_key();
+    while (read_key() == -1 && errno == EINTR) {
+        draw_install_frame(&view);
+    }
 }
 
 // 主应用程序逻辑
 void run_installer(struct Config* config) {
     while (!config->quit) {
+        update_terminal_size(config);
+
         // 根据当前状态绘制界面
         switch (config->state) {
             case MAIN_MENU:
@@ -303,13 +458,16 @@ void run_installer(struct Config* config) {
                 break;
             case INSTALLING:
                 draw_install_screen(config);
-                break;
+                continue; // 安装界面自己等待按键
             case EXITING:
                 config->quit = 1;
                 continue; // 跳过按键处理
         }
         
         int key = read_key();
+        if (key == -1 && errno == EINTR) {
+            continue;  // 窗口大小变化，重绘
+        }
         
         switch (config->state) {
             case MAIN_MENU:
@@ -355,7 +513,12 @@ void run_installer(struct Config* config) {
             case CONFIRM_SCREEN:
                 switch (key) {
                     case KEY_Y:
-                        config->state = INSTALLING;
+                    case KEY_ENTER:  // 确认界面的回车键相当于确认
+                        {
+                            // 没有选中任何组件时不开始安装
+                            int closure[MAX_OPTIONS];
+                            if (compute_closure(config, closure) > 0) config->state = INSTALLING;
+                        }
                         break;
                     case KEY_N:
                     case KEY_ESCAPE:
@@ -364,9 +527,6 @@ void run_installer(struct Config* config) {
                     case KEY_Q:
                         config->state = EXITING;
                         break;
-                    case KEY_ENTER:  // 确认界面的回车键相当于确认
-                        config->state = INSTALLING;
-                        break;
                 }
                 break;
                 
@@ -377,38 +537,48 @@ void run_installer(struct Config* config) {
     }
 }
 
-int main() {
+int main(int argc, char** argv) {
     // 初始化配置
     struct Config config = {0};
+    // 按 UTF-8 计算字符宽度，中日韩文字占两列
+    if (!setlocale(LC_CTYPE, "C.UTF-8")) setlocale(LC_CTYPE, "");
     
-    // 初始化选项
-    struct MenuOption options[] = {
-        {"PKGMGR", "Package Manager", OPT_TRISTATE, 1, 1, 
-            "Install the system package manager for managing software components"},
-        {"DEVTOOLS", "Development Tools", OPT_TRISTATE, 1, 1, 
-            "Essential development tools including compilers and debuggers"},
-        {"SHELL", "Custom Shell", OPT_BOOL, 0, 0, 
-            "Install the enhanced Terminal Shell environment"},
-        {"SAMPLES", "Sample Projects", OPT_TRISTATE, 0, 1, 
-            "Install sample projects for learning and demonstration purposes"},
-        {"PYTHON", "Python Support", OPT_BOOL, 1, 1, 
-            "Install Python interpreter and basic libraries"},
-    };
-    
-    // 复制选项到配置
-    config.option_count = sizeof(options) / sizeof(options[0]);
-    if (config.option_count > MAX_OPTIONS) config.option_count = MAX_OPTIONS;
-    memcpy(config.options, options, sizeof(options));
-    
-    config.install_dir = "/data/data/com.manager.ssb/files";
+    // 组件清单可由第一个参数指定，安装包与清单放在同一目录；安装目录可由第二个参数指定
+    config.install_dir = argc > 2 ? argv[2] : "/data/data/com.manager.ssb/files";
+    config.manifest_path = argc > 1 ? argv[1] : "/data/data/com.manager.ssb/files/components.conf";
+    char err[512];
+    if (manifest_load(&config.manifest, config.manifest_path, err, sizeof(err)) != 0) {
+        fprintf(stderr, "Failed to load component manifest: %s\n", err);
+        return 1;
+    }
+
+    // 每个组件一个选项，初始值取清单中的默认值
+    config.option_count = config.manifest.count;
+    for (int i = 0; i < config.option_count; i++) {
+        const struct Component* c = &config.manifest.components[i];
+        config.options[i] = (struct MenuOption){
+            c->name, c->prompt, c->type, c->default_value, c->default_value,
+            c->help[0] ? c->help : NULL,
+        };
+    }
+
     config.state = MAIN_MENU;
     config.selected = 0;
     
     // 获取终端尺寸
     get_terminal_size(&config.terminal_rows, &config.terminal_cols);
-    
+    if (screen_init(&config.screen, config.terminal_rows, config.terminal_cols) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    // 窗口大小变化时打断 read，不自动重启
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_sigwinch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+
     // 设置终端
-    setvbuf(stdout, NULL, _IONBF, 0);
     printf(CURSOR_HIDE);
     fflush(stdout);
     enable_raw_mode();
@@ -419,9 +589,10 @@ int main() {
     // 清理
     printf(CURSOR_SHOW);
     disable_raw_mode();
-    printf(CLEAR_SCREEN);
+    printf(RESET CLEAR_SCREEN);
     printf("Installation completed!\n");
     fflush(stdout);
+    screen_free(&config.screen);
     
     return 0;
 }
\ No newline at end of file
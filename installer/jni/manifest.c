@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "manifest.h"
+
+#define MANIFEST_LINE_MAX 1024
+
+// 去掉首尾空白，返回新的起点
+static char* trim(char* s) {
+    while (isspace((unsigned char)*s)) s++;
+    char* end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+static int find_component(const struct Manifest* manifest, const char* name) {
+    for (int i = 0; i < manifest->count; i++) {
+        if (strcmp(manifest->components[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static int parse_value(const char* value) {
+    if (strcmp(value, "y") == 0) return 1;
+    if (strcmp(value, "m") == 0) return 2;
+    if (strcmp(value, "n") == 0) return 0;
+    return -1;
+}
+
+// 把 key = value 写入组件，depends 先原样存起来，全部读完后再解析
+static int set_field(struct Component* c, char* depends, const char* dir,
+                     const char* key, const char* value) {
+    if (strcmp(key, "prompt") == 0) {
+        snprintf(c->prompt, sizeof(c->prompt), "%s", value);
+    } else if (strcmp(key, "help") == 0) {
+        snprintf(c->help, sizeof(c->help), "%s", value);
+    } else if (strcmp(key, "type") == 0) {
+        if (strcmp(value, "bool") == 0) {
+            c->type = OPT_BOOL;
+        } else if (strcmp(value, "tristate") == 0) {
+            c->type = OPT_TRISTATE;
+        } else {
+            return -1;
+        }
+    } else if (strcmp(key, "default") == 0) {
+        c->default_value = parse_value(value);
+        if (c->default_value < 0) return -1;
+    } else if (strcmp(key, "archive") == 0) {
+        if (value[0] == '/') {
+            snprintf(c->archive, sizeof(c->archive), "%s", value);
+        } else {
+            snprintf(c->archive, sizeof(c->archive), "%s/%s", dir, value);
+        }
+    } else if (strcmp(key, "download_size") == 0 || strcmp(key, "install_size") == 0) {
+        char* end;
+        errno = 0;
+        unsigned long long size = strtoull(value, &end, 10);
+        if (errno != 0 || end == value || *end != '\0') return -1;
+        if (key[0] == 'd') {
+            c->download_size = size;
+        } else {
+            c->install_size = size;
+        }
+    } else if (strcmp(key, "depends") == 0) {
+        snprintf(depends, MANIFEST_LINE_MAX, "%s", value);
+    }
+    // 不认识的键忽略，便于以后扩展清单格式
+    return 0;
+}
+
+// 解析组件的依赖列表（空格分隔的组件名）
+static int resolve_depends(struct Manifest* manifest, struct Component* c, char* depends,
+                           char* err, size_t err_size) {
+    for (char* name = strtok(depends, " \t,"); name; name = strtok(NULL, " \t,")) {
+        int dep = find_component(manifest, name);
+        if (dep < 0) {
+            snprintf(err, err_size, "%s: unknown dependency %s", c->name, name);
+            return -1;
+        }
+        if (c->depend_count >= MANIFEST_MAX_DEPENDS) {
+            snprintf(err, err_size, "%s: too many dependencies", c->name);
+            return -1;
+        }
+        c->depends[c->depend_count++] = dep;
+    }
+    return 0;
+}
+
+// 深度优先检查依赖环，state：0 未访问，1 访问中，2 已完成
+static int find_cycle(const struct Manifest* manifest, int i, int* state) {
+    if (state[i] == 1) return i;
+    if (state[i] == 2) return -1;
+    state[i] = 1;
+    const struct Component* c = &manifest->components[i];
+    for (int j = 0; j < c->depend_count; j++) {
+        int cycle = find_cycle(manifest, c->depends[j], state);
+        if (cycle >= 0) return cycle;
+    }
+    state[i] = 2;
+    return -1;
+}
+
+int manifest_load(struct Manifest* manifest, const char* path, char* err, size_t err_size) {
+    memset(manifest, 0, sizeof(*manifest));
+
+    FILE* fp = fopen(path, "re");
+    if (!fp) {
+        snprintf(err, err_size, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    // 安装包路径相对于清单所在目录
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+    } else {
+        strcpy(dir, ".");
+    }
+
+    static char depends[MANIFEST_MAX_COMPONENTS][MANIFEST_LINE_MAX];
+    char line[MANIFEST_LINE_MAX];
+    int line_no = 0;
+    struct Component* c = NULL;
+    int ret = -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        char* s = trim(line);
+        if (*s == '\0' || *s == '#') continue;
+
+        if (*s == '[') {
+            char* end = strchr(s, ']');
+            if (!end || end[1] != '\0' || end == s + 1) {
+                snprintf(err, err_size, "%s:%d: bad section header", path, line_no);
+                goto out;
+            }
+            *end = '\0';
+            if (find_component(manifest, s + 1) >= 0) {
+                snprintf(err, err_size, "%s:%d: duplicate component %s", path, line_no, s + 1);
+                goto out;
+            }
+            if (manifest->count >= MANIFEST_MAX_COMPONENTS) {
+                snprintf(err, err_size, "%s:%d: too many components", path, line_no);
+                goto out;
+            }
+            c = &manifest->components[manifest->count];
+            depends[manifest->count][0] = '\0';
+            manifest->count++;
+            snprintf(c->name, sizeof(c->name), "%s", s + 1);
+            snprintf(c->prompt, sizeof(c->prompt), "%s", s + 1);
+            c->type = OPT_BOOL;
+            continue;
+        }
+
+        char* eq = strchr(s, '=');
+        if (!eq || !c) {
+            snprintf(err, err_size, "%s:%d: expected key = value", path, line_no);
+            goto out;
+        }
+        *eq = '\0';
+        char* key = trim(s);
+        char* value = trim(eq + 1);
+        if (set_field(c, depends[c - manifest->components], dir, key, value) != 0) {
+            snprintf(err, err_size, "%s:%d: bad value for %s", path, line_no, key);
+            goto out;
+        }
+    }
+
+    if (manifest->count == 0) {
+        snprintf(err, err_size, "%s: no components", path);
+        goto out;
+    }
+    for (int i = 0; i < manifest->count; i++) {
+        c = &manifest->components[i];
+        if (c->archive[0] == '\0') {
+            snprintf(err, err_size, "%s: no archive", c->name);
+            goto out;
+        }
+        // bool 组件没有 m
+        if (c->type == OPT_BOOL && c->default_value == 2) c->default_value = 1;
+        if (resolve_depends(manifest, c, depends[i], err, err_size) != 0) goto out;
+    }
+
+    int state[MANIFEST_MAX_COMPONENTS] = {0};
+    for (int i = 0; i < manifest->count; i++) {
+        int cycle = find_cycle(manifest, i, state);
+        if (cycle >= 0) {
+            snprintf(err, err_size, "%s: circular dependency", manifest->components[cycle].name);
+            goto out;
+        }
+    }
+    ret = 0;
+
+out:
+    fclose(fp);
+    return ret;
+}
+
+static void add_depends(const struct Manifest* manifest, int i, int* closure) {
+    const struct Component* c = &manifest->components[i];
+    for (int j = 0; j < c->depend_count; j++) {
+        int dep = c->depends[j];
+        if (closure[dep]) continue;
+        closure[dep] = 2;
+        add_depends(manifest, dep, closure);
+    }
+}
+
+void manifest_closure(const struct Manifest* manifest, const int* values, int* closure) {
+    for (int i = 0; i < manifest->count; i++) {
+        closure[i] = values[i] ? 1 : 0;
+    }
+    for (int i = 0; i < manifest->count; i++) {
+        if (values[i]) add_depends(manifest, i, closure);
+    }
+}
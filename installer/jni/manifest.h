@@ -0,0 +1,54 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stddef.h>
+#include <limits.h>
+
+#define MANIFEST_MAX_COMPONENTS 20
+#define MANIFEST_MAX_DEPENDS 8
+
+// 组件类型，与 Kconfig 一致
+typedef enum {
+    OPT_BOOL,
+    OPT_TRISTATE,
+} OptionType;
+
+// 清单中的一个组件
+struct Component {
+    char name[32];
+    char prompt[64];
+    char help[256];
+    OptionType type;
+    int default_value;                      // 0 = n，1 = y，2 = m
+    char archive[PATH_MAX];                 // 安装包的完整路径
+    unsigned long long download_size;       // 安装包大小
+    unsigned long long install_size;        // 解压后的大小
+    int depends[MANIFEST_MAX_DEPENDS];      // 依赖的组件下标
+    int depend_count;
+};
+
+// 组件清单（随安装包一起发布的 components.conf）
+//
+//   [NAME]
+//   prompt = Package Manager
+//   type = tristate
+//   default = y
+//   archive = pkgmgr.zip          （相对于清单所在目录）
+//   download_size = 1234
+//   install_size = 5678
+//   depends = BASE OTHER
+//   help = ...
+struct Manifest {
+    struct Component components[MANIFEST_MAX_COMPONENTS];
+    int count;
+};
+
+// 读取并检查清单：依赖必须存在且不能成环
+// 成功返回 0；失败返回 -1，原因写入 err
+int manifest_load(struct Manifest* manifest, const char* path, char* err, size_t err_size);
+
+// 计算安装闭包：values[i] 非 0 的组件及其全部依赖
+// closure[i] 为 0 表示不安装，1 表示被选中，2 表示作为依赖被带入
+void manifest_closure(const struct Manifest* manifest, const int* values, int* closure);
+
+#endif // MANIFEST_H
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "screen.h"
+
+static const struct Cell blank_cell = { .ch = " ", .len = 1, .attr = ATTR_NONE };
+
+static void fill_blank(struct Cell* cells, int count) {
+    for (int i = 0; i < count; i++) cells[i] = blank_cell;
+}
+
+int screen_init(struct Screen* screen, int rows, int cols) {
+    memset(screen, 0, sizeof(*screen));
+    return screen_resize(screen, rows, cols);
+}
+
+void screen_free(struct Screen* screen) {
+    free(screen->front);
+    free(screen->back);
+    free(screen->out);
+    memset(screen, 0, sizeof(*screen));
+}
+
+int screen_resize(struct Screen* screen, int rows, int cols) {
+    if (rows < 1) rows = 1;
+    if (cols < 1) cols = 1;
+    struct Cell* front = malloc(sizeof(struct Cell) * rows * cols);
+    struct Cell* back = malloc(sizeof(struct Cell) * rows * cols);
+    if (!front || !back) {
+        free(front);
+        free(back);
+        return -1;
+    }
+    free(screen->front);
+    free(screen->back);
+    screen->front = front;
+    screen->back = back;
+    screen->rows = rows;
+    screen->cols = cols;
+    screen->full_redraw = 1;
+    screen_clear(screen);
+    return 0;
+}
+
+void screen_clear(struct Screen* screen) {
+    fill_blank(screen->back, screen->rows * screen->cols);
+    screen->row = 0;
+    screen->col = 0;
+}
+
+void screen_move(struct Screen* screen, int row, int col) {
+    screen->row = row;
+    screen->col = col;
+}
+
+// 续格左边的宽字符被覆盖了一半时，把剩下的一半清成空格
+static void break_wide(struct Screen* screen, int row, int col) {
+    struct Cell* line = &screen->back[row * screen->cols];
+    if (col > 0 && col < screen->cols && line[col].len == 0) line[col - 1] = blank_cell;
+    if (col + 1 < screen->cols && line[col + 1].len == 0) line[col + 1] = blank_cell;
+}
+
+// 在绘制光标处放一个 width 列宽（1 或 2）的字符
+static void put_char(struct Screen* screen, int attr, const char* text, int len, int width) {
+    if (screen->col + width > screen->cols) {
+        screen->row++;
+        screen->col = 0;
+    }
+    if (screen->row >= 0 && screen->row < screen->rows && screen->col >= 0) {
+        struct Cell* cell = &screen->back[screen->row * screen->cols + screen->col];
+        break_wide(screen, screen->row, screen->col);
+        if (width == 2) break_wide(screen, screen->row, screen->col + 1);
+        memcpy(cell->ch, text, len);
+        cell->len = len;
+        cell->attr = attr;
+        if (width == 2) {
+            cell[1].len = 0;
+            cell[1].attr = attr;
+        }
+    }
+    screen->col += width;
+}
+
+// 零宽的组合字符并到前一个字符格里，放不下就丢掉
+static void put_combining(struct Screen* screen, const char* text, int len) {
+    if (screen->row < 0 || screen->row >= screen->rows || screen->col <= 0) return;
+    int col = screen->col - 1;
+    if (col >= screen->cols) col = screen->cols - 1;
+    struct Cell* cell = &screen->back[screen->row * screen->cols + col];
+    if (cell->len == 0 && col > 0) cell--;
+    if (cell->len + len > (int)sizeof(cell->ch)) return;
+    memcpy(cell->ch + cell->len, text, len);
+    cell->len += len;
+}
+
+static void put_text(struct Screen* screen, int attr, const char* text) {
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    while (*text) {
+        if (*text == '\n') {
+            screen->row++;
+            screen->col = 0;
+            text++;
+            continue;
+        }
+        wchar_t wc;
+        size_t len = mbrtowc(&wc, text, MB_CUR_MAX, &state);
+        if (len == (size_t)-2) break;  // 末尾是不完整的字符
+        if (len == (size_t)-1) {
+            // 不是合法的多字节序列：显示为 '?'，跳过一个字节
+            memset(&state, 0, sizeof(state));
+            put_char(screen, attr, "?", 1, 1);
+            text++;
+            continue;
+        }
+        int width = wcwidth(wc);
+        if (width == 0) {
+            put_combining(screen, text, len);
+        } else {
+            put_char(screen, attr, text, len, width == 2 ? 2 : 1);
+        }
+        text += len;
+    }
+}
+
+void screen_printf(struct Screen* screen, int attr, const char* fmt, ...) {
+    char buf[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    put_text(screen, attr, buf);
+}
+
+static int out_append(struct Screen* screen, const char* data, size_t len) {
+    if (screen->out_len + len > screen->out_size) {
+        size_t size = screen->out_size ? screen->out_size : 4096;
+        while (size < screen->out_len + len) size *= 2;
+        char* out = realloc(screen->out, size);
+        if (!out) return -1;
+        screen->out = out;
+        screen->out_size = size;
+    }
+    memcpy(screen->out + screen->out_len, data, len);
+    screen->out_len += len;
+    return 0;
+}
+
+static void out_attr(struct Screen* screen, int attr) {
+    char sgr[32];
+    int len = snprintf(sgr, sizeof(sgr), "\033[0%s%s", attr & ATTR_BOLD ? ";1" : "",
+                       attr & ATTR_REVERSE ? ";7" : "");
+    if (attr & ATTR_FG_MASK) {
+        len += snprintf(sgr + len, sizeof(sgr) - len, ";3%d", (attr & ATTR_FG_MASK) - 1);
+    }
+    sgr[len++] = 'm';
+    out_append(screen, sgr, len);
+}
+
+static int same_cell(const struct Cell* a, const struct Cell* b) {
+    return a->len == b->len && a->attr == b->attr && memcmp(a->ch, b->ch, a->len) == 0;
+}
+
+int screen_flush(struct Screen* screen, int fd) {
+    int attr = -1;
+    screen->out_len = 0;
+
+    if (screen->full_redraw) {
+        // 整屏重画：先清屏，front 视为空白
+        out_append(screen, "\033[0m\033[2J", 8);
+        attr = ATTR_NONE;
+        fill_blank(screen->front, screen->rows * screen->cols);
+    }
+
+    for (int row = 0; row < screen->rows; row++) {
+        struct Cell* front = &screen->front[row * screen->cols];
+        struct Cell* back = &screen->back[row * screen->cols];
+
+        // 找出这一行中第一个和最后一个变化的字符格，中间部分整体重写
+        int first = -1, last = -1;
+        for (int col = 0; col < screen->cols; col++) {
+            if (!same_cell(&front[col], &back[col])) {
+                if (first < 0) first = col;
+                last = col;
+            }
+        }
+        if (first < 0) continue;
+        // 从宽字符的前半格开始输出，输出宽字符会同时写好后面的续格
+        if (first > 0 && back[first].len == 0) first--;
+        if (last + 1 < screen->cols && back[last + 1].len == 0) last++;
+
+        char move[32];
+        int len = snprintf(move, sizeof(move), "\033[%d;%dH", row + 1, first + 1);
+        out_append(screen, move, len);
+        for (int col = first; col <= last; col++) {
+            if (back[col].len == 0) continue;
+            if (back[col].attr != attr) {
+                attr = back[col].attr;
+                out_attr(screen, attr);
+            }
+            out_append(screen, back[col].ch, back[col].len);
+        }
+        memcpy(&front[first], &back[first], sizeof(struct Cell) * (last - first + 1));
+    }
+    if (attr != -1 && attr != ATTR_NONE) out_append(screen, "\033[0m", 4);
+    screen->full_redraw = 0;
+
+    // 整帧一次写出
+    const char* data = screen->out;
+    size_t left = screen->out_len;
+    while (left > 0) {
+        ssize_t n = write(fd, data, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            screen->full_redraw = 1;
+            return -1;
+        }
+        data += n;
+        left -= n;
+    }
+    return 0;
+}
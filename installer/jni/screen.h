@@ -0,0 +1,57 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stddef.h>
+
+// 单元格属性：低 4 位为前景色（0 表示默认色），其余为字形
+#define ATTR_NONE 0x00
+#define ATTR_FG(color) ((color) + 1)
+#define ATTR_FG_MASK 0x0f
+#define ATTR_BOLD 0x10
+#define ATTR_REVERSE 0x20
+
+#define ATTR_RED ATTR_FG(1)
+#define ATTR_GREEN ATTR_FG(2)
+#define ATTR_YELLOW ATTR_FG(3)
+#define ATTR_BLUE ATTR_FG(4)
+#define ATTR_CYAN ATTR_FG(6)
+
+// 一个字符格：一个 UTF-8 字符（可带一个组合字符）加属性
+// 占两列的字符（如中日韩文字）后面跟一个 len 为 0 的续格，输出时跳过
+struct Cell {
+    char ch[8];
+    unsigned char len;
+    unsigned char attr;
+};
+
+// 双缓冲屏幕：先画到 back，screen_flush 时与 front 比较，只输出变化的部分
+struct Screen {
+    int rows;
+    int cols;
+    struct Cell* front;  // 终端上当前的内容
+    struct Cell* back;   // 正在绘制的一帧
+    int full_redraw;     // 下次刷新时整屏重画（首帧或尺寸变化后）
+    int row;             // 绘制光标
+    int col;
+    char* out;           // 输出缓冲区
+    size_t out_len;
+    size_t out_size;
+};
+
+int screen_init(struct Screen* screen, int rows, int cols);
+void screen_free(struct Screen* screen);
+// 改变尺寸，下一帧整屏重画
+int screen_resize(struct Screen* screen, int rows, int cols);
+
+// 清空 back 并把绘制光标移到左上角
+void screen_clear(struct Screen* screen);
+void screen_move(struct Screen* screen, int row, int col);
+// 在绘制光标处输出文本，'\n' 换行，超出右边界自动折行，超出底部的内容丢弃
+// 字符宽度按 wcwidth 计算，需要先用 setlocale 选定 UTF-8 的 LC_CTYPE
+void screen_printf(struct Screen* screen, int attr, const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// 把 back 与 front 的差异用一次 write 输出到终端
+int screen_flush(struct Screen* screen, int fd);
+
+#endif // SCREEN_H